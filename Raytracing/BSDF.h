@@ -0,0 +1,128 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Random.h"
+#include "Scene.h"
+
+//Metallic/roughness surface model: a Lambert lobe for the diffuse part and a GGX microfacet lobe for reflections.
+//Reflectance at normal incidence goes from 4% for dielectrics to the albedo for metals, so metals lose the
+//diffuse lobe entirely. Directions point away from the surface, normal faces the side the path arrived from.
+class BSDF
+{
+public:
+	BSDF(const Material& material, const glm::vec3& normal, const glm::vec3& toViewer)
+		: _normal(normal), _toViewer(toViewer)
+	{
+		float metallic = glm::clamp(material.metallic, 0.0f, 1.0f);
+
+		_diffuse = material.albedo * (1.0f - metallic);
+		_specular = glm::mix(glm::vec3(0.04f), material.albedo, metallic);
+
+		//Squared roughness is perceptually linear, the floor keeps mirror-like materials from producing infinities
+		float roughness = glm::clamp(material.roughness, 0.0f, 1.0f);
+		_alpha = glm::max(roughness * roughness, 1e-3f);
+
+		_cosView = glm::max(glm::dot(_normal, _toViewer), 1e-4f);
+
+		//Light reflected at the surface never reaches the diffuse layer underneath
+		glm::vec3 viewFresnel = Fresnel(_cosView);
+		_diffuse *= glm::vec3(1.0f) - viewFresnel;
+
+		//Pick the lobe in proportion to how much light each one is expected to return
+		float specularWeight = Luminance(viewFresnel);
+		float diffuseWeight = Luminance(_diffuse);
+		_specularProbability = specularWeight + diffuseWeight > 0.0f ? specularWeight / (specularWeight + diffuseWeight) : 1.0f;
+	}
+
+	//BSDF times the cosine towards toLight, and the pdf Sample would have picked toLight with
+	glm::vec3 Evaluate(const glm::vec3& toLight, float& pdf) const {
+		pdf = 0.0f;
+
+		float cosLight = glm::dot(_normal, toLight);
+		if (cosLight <= 0.0f) return glm::vec3(0.0f);
+
+		glm::vec3 half = glm::normalize(_toViewer + toLight);
+		float cosHalf = glm::max(glm::dot(_normal, half), 0.0f);
+		float cosViewHalf = glm::max(glm::dot(_toViewer, half), 1e-4f);
+
+		glm::vec3 fresnel = Fresnel(cosViewHalf);
+		float distribution = Distribution(cosHalf);
+
+		glm::vec3 specular = fresnel * (distribution * Geometry(_cosView) * Geometry(cosLight) / (4.0f * _cosView * cosLight));
+		glm::vec3 diffuse = _diffuse * InvPi;
+
+		pdf = _specularProbability * distribution * cosHalf / (4.0f * cosViewHalf) + (1.0f - _specularProbability) * cosLight * InvPi;
+		return (diffuse + specular) * cosLight;
+	}
+
+	//Picks a lobe, then a direction from it: cosine weighted for diffuse, GGX distributed half vectors for
+	//reflections. weight is BSDF * cosine / pdf, with pdf over both lobes. Returns false for directions below the surface.
+	bool Sample(Random& random, glm::vec3& direction, glm::vec3& weight, float& pdf) const {
+		if (random.Float() < _specularProbability) {
+			float u = random.Float();
+			float phi = random.Float() * 6.28318530718f;
+
+			float cosTheta = glm::sqrt((1.0f - u) / (1.0f + (_alpha * _alpha - 1.0f) * u));
+			float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+			glm::vec3 tangent, bitangent;
+			Basis(_normal, tangent, bitangent);
+			glm::vec3 half = (tangent * glm::cos(phi) + bitangent * glm::sin(phi)) * sinTheta + _normal * cosTheta;
+
+			direction = glm::reflect(-_toViewer, half);
+		}
+		else {
+			direction = random.CosineHemisphere(_normal);
+		}
+
+		glm::vec3 value = Evaluate(direction, pdf);
+		if (pdf <= 0.0f) return false;
+
+		weight = value / pdf;
+		return true;
+	}
+
+	//Orthonormal tangents of a unit normal without a branch on its direction (Duff et al. 2017)
+	static void Basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent) {
+		float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+		tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+	}
+
+private:
+	static constexpr float InvPi = 0.318309886f;
+
+	static float Luminance(const glm::vec3& color) {
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	//Schlick's approximation
+	glm::vec3 Fresnel(float cosine) const {
+		float m = 1.0f - cosine;
+		float m2 = m * m;
+		return _specular + (glm::vec3(1.0f) - _specular) * (m2 * m2 * m);
+	}
+
+	float Distribution(float cosHalf) const {
+		float a2 = _alpha * _alpha;
+		float d = cosHalf * cosHalf * (a2 - 1.0f) + 1.0f;
+		return a2 * InvPi / (d * d);
+	}
+
+	//Smith masking for one direction, used separably for the view and the light
+	float Geometry(float cosine) const {
+		float a2 = _alpha * _alpha;
+		return 2.0f * cosine / (cosine + glm::sqrt(a2 + (1.0f - a2) * cosine * cosine));
+	}
+
+	glm::vec3 _normal;
+	glm::vec3 _toViewer;
+	glm::vec3 _diffuse;
+	glm::vec3 _specular;
+	float _alpha;
+	float _cosView;
+	float _specularProbability;
+};
@@ -0,0 +1,229 @@
+#include "BVH.h"
+
+#include <algorithm>
+
+namespace Utils {
+	static constexpr int BinCount = 12;
+
+	//Relative cost of one ray/AABB test against one ray/primitive test
+	static constexpr float TraversalCost = 1.0f;
+	static constexpr float IntersectionCost = 1.0f;
+}
+
+void BVH::Build(const std::vector<AABB>& primitiveBounds, uint32_t leafWidth)
+{
+	Clear();
+	_leafWidth = leafWidth > 0 ? leafWidth : 1;
+
+	uint32_t primitiveCount = (uint32_t)primitiveBounds.size();
+	if (primitiveCount == 0) return;
+
+	_primitiveIndices.resize(primitiveCount);
+	std::vector<glm::vec3> centroids(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++) {
+		_primitiveIndices[i] = i;
+		centroids[i] = primitiveBounds[i].Center();
+	}
+
+	//A binary tree over N leaves has at most 2N - 1 nodes
+	_nodes.reserve(primitiveCount * 2 - 1);
+
+	BVHNode& root = _nodes.emplace_back();
+	root.leftFirst = 0;
+	root.count = primitiveCount;
+	UpdateNodeBounds(0, primitiveBounds);
+
+	Subdivide(0, 1, primitiveBounds, centroids);
+
+	_nodes.shrink_to_fit();
+
+	LinkNodes();
+}
+
+void BVH::Refit(const std::vector<AABB>& primitiveBounds)
+{
+	//Children are always stored after their parent, so a reverse sweep updates leaves before interiors
+	for (size_t i = _nodes.size(); i-- > 0;) {
+		BVHNode& node = _nodes[i];
+
+		if (node.IsLeaf()) {
+			UpdateNodeBounds((uint32_t)i, primitiveBounds);
+			continue;
+		}
+
+		const BVHNode& left = _nodes[node.leftFirst];
+		const BVHNode& right = _nodes[node.leftFirst + 1];
+		node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+		node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+	}
+}
+
+void BVH::Clear()
+{
+	_nodes.clear();
+	_primitiveIndices.clear();
+	_parents.clear();
+	_primitiveLeaves.clear();
+	_primitiveSlots.clear();
+}
+
+AABB BVH::GetBounds() const
+{
+	AABB bounds;
+	if (!_nodes.empty()) {
+		bounds.min = _nodes[0].boundsMin;
+		bounds.max = _nodes[0].boundsMax;
+	}
+	return bounds;
+}
+
+void BVH::LinkNodes()
+{
+	_parents.assign(_nodes.size(), 0);
+	_primitiveLeaves.resize(_primitiveIndices.size());
+	_primitiveSlots.resize(_primitiveIndices.size());
+
+	for (uint32_t i = 0; i < (uint32_t)_nodes.size(); i++) {
+		const BVHNode& node = _nodes[i];
+
+		if (!node.IsLeaf()) {
+			_parents[node.leftFirst] = i;
+			_parents[node.leftFirst + 1] = i;
+			continue;
+		}
+
+		for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; slot++) {
+			_primitiveLeaves[_primitiveIndices[slot]] = i;
+			_primitiveSlots[_primitiveIndices[slot]] = slot;
+		}
+	}
+}
+
+void BVH::UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds)
+{
+	BVHNode& node = _nodes[nodeIndex];
+
+	AABB bounds;
+	for (uint32_t i = 0; i < node.count; i++) {
+		bounds.Grow(primitiveBounds[_primitiveIndices[node.leftFirst + i]]);
+	}
+
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+}
+
+void BVH::Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids)
+{
+	BVHNode& node = _nodes[nodeIndex];
+	if (node.count <= 1 || depth >= MaxDepth) return;
+
+	int axis;
+	float splitPos;
+	float splitCost = FindBestSplit(node, primitiveBounds, centroids, axis, splitPos);
+
+	AABB nodeBounds;
+	nodeBounds.min = node.boundsMin;
+	nodeBounds.max = node.boundsMax;
+	float leafCost = Utils::IntersectionCost * LeafCost(node.count) * nodeBounds.Area();
+	if (splitCost >= leafCost) return;
+
+	//Partition the primitive range in place around the split plane
+	uint32_t first = node.leftFirst;
+	uint32_t* begin = _primitiveIndices.data() + first;
+	uint32_t* end = begin + node.count;
+	uint32_t* middle = std::partition(begin, end, [&](uint32_t index) {
+		return centroids[index][axis] < splitPos;
+	});
+
+	uint32_t leftCount = (uint32_t)(middle - begin);
+	if (leftCount == 0 || leftCount == node.count) return;
+
+	uint32_t leftIndex = (uint32_t)_nodes.size();
+	uint32_t rightCount = node.count - leftCount;
+
+	_nodes.emplace_back();
+	_nodes.emplace_back();
+
+	//emplace_back may have reallocated, so re-fetch rather than reuse node
+	BVHNode& left = _nodes[leftIndex];
+	left.leftFirst = first;
+	left.count = leftCount;
+
+	BVHNode& right = _nodes[leftIndex + 1];
+	right.leftFirst = first + leftCount;
+	right.count = rightCount;
+
+	_nodes[nodeIndex].leftFirst = leftIndex;
+	_nodes[nodeIndex].count = 0;
+
+	UpdateNodeBounds(leftIndex, primitiveBounds);
+	UpdateNodeBounds(leftIndex + 1, primitiveBounds);
+
+	Subdivide(leftIndex, depth + 1, primitiveBounds, centroids);
+	Subdivide(leftIndex + 1, depth + 1, primitiveBounds, centroids);
+}
+
+float BVH::FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids, int& axis, float& splitPos) const
+{
+	struct Bin {
+		AABB bounds;
+		uint32_t count = 0;
+	};
+
+	float bestCost = FLT_MAX;
+	axis = 0;
+	splitPos = 0.0f;
+
+	AABB centroidBounds;
+	for (uint32_t i = 0; i < node.count; i++) {
+		centroidBounds.Grow(centroids[_primitiveIndices[node.leftFirst + i]]);
+	}
+
+	for (int a = 0; a < 3; a++) {
+		float boundsMin = centroidBounds.min[a];
+		float boundsMax = centroidBounds.max[a];
+		if (boundsMin == boundsMax) continue;
+
+		Bin bins[Utils::BinCount];
+		float scale = Utils::BinCount / (boundsMax - boundsMin);
+		for (uint32_t i = 0; i < node.count; i++) {
+			uint32_t index = _primitiveIndices[node.leftFirst + i];
+			int binIndex = std::min(Utils::BinCount - 1, (int)((centroids[index][a] - boundsMin) * scale));
+			bins[binIndex].count++;
+			bins[binIndex].bounds.Grow(primitiveBounds[index]);
+		}
+
+		//Sweep from both ends so each plane's cost is O(1)
+		float leftArea[Utils::BinCount - 1], rightArea[Utils::BinCount - 1];
+		uint32_t leftCount[Utils::BinCount - 1], rightCount[Utils::BinCount - 1];
+		AABB leftBox, rightBox;
+		uint32_t leftSum = 0, rightSum = 0;
+		for (int i = 0; i < Utils::BinCount - 1; i++) {
+			leftSum += bins[i].count;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].bounds);
+			leftArea[i] = leftSum ? leftBox.Area() : 0.0f;
+
+			rightSum += bins[Utils::BinCount - 1 - i].count;
+			rightCount[Utils::BinCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[Utils::BinCount - 1 - i].bounds);
+			rightArea[Utils::BinCount - 2 - i] = rightSum ? rightBox.Area() : 0.0f;
+		}
+
+		float binWidth = (boundsMax - boundsMin) / Utils::BinCount;
+		for (int i = 0; i < Utils::BinCount - 1; i++) {
+			float cost = Utils::IntersectionCost * (LeafCost(leftCount[i]) * leftArea[i] + LeafCost(rightCount[i]) * rightArea[i]);
+			if (cost < bestCost) {
+				bestCost = cost;
+				axis = a;
+				splitPos = boundsMin + binWidth * (i + 1);
+			}
+		}
+	}
+
+	AABB nodeBounds;
+	nodeBounds.min = node.boundsMin;
+	nodeBounds.max = node.boundsMax;
+
+	return bestCost + Utils::TraversalCost * nodeBounds.Area();
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Ray.h"
+
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void Grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void Grow(const AABB& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+
+	glm::vec3 Center() const { return (min + max) * 0.5f; }
+
+	float Area() const {
+		glm::vec3 e = max - min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+//32 bytes so two siblings share a cache line
+struct BVHNode {
+	glm::vec3 boundsMin;
+	uint32_t leftFirst; //first child index for interior nodes, first primitive for leaves
+	glm::vec3 boundsMax;
+	uint32_t count; //0 for interior nodes
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+//Binned SAH bounding volume hierarchy, flattened into one contiguous node array.
+//Primitives are referenced through GetPrimitiveIndices() so callers can reorder their own data to match the leaves.
+class BVH
+{
+public:
+	//leafWidth is how many primitives the leaf kernel tests at once, SAH costs leaves in batches of that size
+	void Build(const std::vector<AABB>& primitiveBounds, uint32_t leafWidth = 1);
+
+	//Recomputes node bounds bottom-up without changing the topology, for primitives that moved
+	void Refit(const std::vector<AABB>& primitiveBounds);
+
+	//Refit limited to the leaves holding the given primitives and the nodes above them.
+	//getBounds(primitive) returns a primitive's current bounds, it is asked for the other primitives of those leaves too.
+	template<typename GetBoundsFn>
+	void RefitPrimitives(const std::vector<uint32_t>& primitives, GetBoundsFn&& getBounds);
+
+	void Clear();
+
+	bool IsEmpty() const { return _nodes.empty(); }
+	uint32_t GetPrimitiveCount() const { return (uint32_t)_primitiveIndices.size(); }
+	const std::vector<uint32_t>& GetPrimitiveIndices() const { return _primitiveIndices; }
+	//Where the primitive sits in GetPrimitiveIndices(), and so in data reordered to match it
+	uint32_t GetPrimitiveSlot(uint32_t primitive) const { return _primitiveSlots[primitive]; }
+	const std::vector<BVHNode>& GetNodes() const { return _nodes; }
+	AABB GetBounds() const;
+
+	//Visits leaves front to back. intersectLeaf(first, count) tests primitives
+	//GetPrimitiveIndices()[first .. first + count) and shrinks closestT when it finds a nearer hit.
+	template<typename IntersectLeafFn>
+	void Traverse(const Ray& ray, const float& closestT, IntersectLeafFn&& intersectLeaf) const;
+
+	static constexpr uint32_t MaxDepth = 64;
+
+	static float IntersectAABB(const Ray& ray, const glm::vec3& invDirection, const glm::vec3& bmin, const glm::vec3& bmax, float closestT);
+
+private:
+	//Pops the next stacked node that is still closer than closestT
+	bool PopNode(const uint32_t* stack, const float* stackT, uint32_t& stackSize, float closestT, const BVHNode*& node) const {
+		while (stackSize > 0) {
+			stackSize--;
+			if (stackT[stackSize] < closestT) {
+				node = &_nodes[stack[stackSize]];
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds);
+	//Fills the parent, leaf and slot lookups used by RefitPrimitives once the tree is built
+	void LinkNodes();
+	void Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids);
+	float LeafCost(uint32_t count) const { return (float)((count + _leafWidth - 1) / _leafWidth); }
+	float FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids, int& axis, float& splitPos) const;
+
+private:
+	std::vector<BVHNode> _nodes;
+	std::vector<uint32_t> _primitiveIndices;
+	uint32_t _leafWidth = 1;
+
+	//Parent of every node (the root's is 0), and the leaf and slot of every primitive
+	std::vector<uint32_t> _parents;
+	std::vector<uint32_t> _primitiveLeaves;
+	std::vector<uint32_t> _primitiveSlots;
+};
+
+template<typename GetBoundsFn>
+void BVH::RefitPrimitives(const std::vector<uint32_t>& primitives, GetBoundsFn&& getBounds)
+{
+	for (uint32_t primitive : primitives) {
+		uint32_t nodeIndex = _primitiveLeaves[primitive];
+
+		BVHNode& leaf = _nodes[nodeIndex];
+		AABB bounds;
+		for (uint32_t i = 0; i < leaf.count; i++) {
+			bounds.Grow(getBounds(_primitiveIndices[leaf.leftFirst + i]));
+		}
+		leaf.boundsMin = bounds.min;
+		leaf.boundsMax = bounds.max;
+
+		//Walk up until a node comes out unchanged, everything above it is then unchanged as well
+		while (nodeIndex != 0) {
+			nodeIndex = _parents[nodeIndex];
+			BVHNode& node = _nodes[nodeIndex];
+
+			const BVHNode& left = _nodes[node.leftFirst];
+			const BVHNode& right = _nodes[node.leftFirst + 1];
+			glm::vec3 boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			glm::vec3 boundsMax = glm::max(left.boundsMax, right.boundsMax);
+
+			if (boundsMin == node.boundsMin && boundsMax == node.boundsMax) break;
+
+			node.boundsMin = boundsMin;
+			node.boundsMax = boundsMax;
+		}
+	}
+}
+
+inline float BVH::IntersectAABB(const Ray& ray, const glm::vec3& invDirection, const glm::vec3& bmin, const glm::vec3& bmax, float closestT)
+{
+	glm::vec3 t0 = (bmin - ray.origin) * invDirection;
+	glm::vec3 t1 = (bmax - ray.origin) * invDirection;
+
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float tEnter = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+	float tExit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+
+	if (tExit >= tEnter && tEnter < closestT && tExit > 0.0f) {
+		return tEnter;
+	}
+
+	return FLT_MAX;
+}
+
+template<typename IntersectLeafFn>
+void BVH::Traverse(const Ray& ray, const float& closestT, IntersectLeafFn&& intersectLeaf) const
+{
+	if (_nodes.empty()) return;
+
+	glm::vec3 invDirection = 1.0f / ray.direction;
+
+	uint32_t stack[MaxDepth];
+	float stackT[MaxDepth];
+	uint32_t stackSize = 0;
+
+	const BVHNode* node = &_nodes[0];
+	if (IntersectAABB(ray, invDirection, node->boundsMin, node->boundsMax, closestT) == FLT_MAX) return;
+
+	while (true) {
+		if (node->IsLeaf()) {
+			intersectLeaf(node->leftFirst, node->count);
+
+			if (!PopNode(stack, stackT, stackSize, closestT, node)) break;
+			continue;
+		}
+
+		uint32_t nearIndex = node->leftFirst;
+		uint32_t farIndex = node->leftFirst + 1;
+		const BVHNode& nearNode = _nodes[nearIndex];
+		const BVHNode& farNode = _nodes[farIndex];
+
+		float nearT = IntersectAABB(ray, invDirection, nearNode.boundsMin, nearNode.boundsMax, closestT);
+		float farT = IntersectAABB(ray, invDirection, farNode.boundsMin, farNode.boundsMax, closestT);
+
+		if (nearT > farT) {
+			std::swap(nearT, farT);
+			std::swap(nearIndex, farIndex);
+		}
+
+		if (nearT == FLT_MAX) {
+			if (!PopNode(stack, stackT, stackSize, closestT, node)) break;
+			continue;
+		}
+
+		node = &_nodes[nearIndex];
+		if (farT != FLT_MAX) {
+			stack[stackSize] = farIndex;
+			stackT[stackSize] = farT;
+			stackSize++;
+		}
+	}
+}
@@ -0,0 +1,131 @@
+#include "BackgroundWriter.h"
+
+#include <cstdio>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Utils {
+	//Makes sure the data reached the disk, so a crash after the rename cannot leave a file with missing contents
+	static bool SyncFile(FILE* file) {
+		if (fflush(file) != 0) return false;
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	//The rename itself is only durable once the directory holding it is synced
+	static void SyncDirectory(const std::string& path) {
+#ifndef _WIN32
+		size_t separator = path.find_last_of('/');
+		std::string directory = separator == std::string::npos ? "." : separator == 0 ? "/" : path.substr(0, separator);
+
+		int descriptor = open(directory.c_str(), O_RDONLY);
+		if (descriptor < 0) return;
+		fsync(descriptor);
+		close(descriptor);
+#else
+		(void)path;
+#endif
+	}
+}
+
+BackgroundWriter::BackgroundWriter()
+{
+	_thread = std::thread(&BackgroundWriter::WorkerLoop, this);
+}
+
+BackgroundWriter::~BackgroundWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeCondition.notify_one();
+	_thread.join();
+}
+
+void BackgroundWriter::Write(const std::string& path, EncodeFn encode)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back({ path, std::move(encode) });
+		_pending++;
+	}
+	_wakeCondition.notify_one();
+}
+
+void BackgroundWriter::Write(const std::string& path, std::vector<uint8_t> data)
+{
+	auto shared = std::make_shared<std::vector<uint8_t>>(std::move(data));
+	Write(path, [shared]() { return std::move(*shared); });
+}
+
+uint32_t BackgroundWriter::GetPendingCount() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _pending;
+}
+
+bool BackgroundWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_doneCondition.wait(lock, [this]() { return _pending == 0; });
+
+	_error = std::move(_pendingError);
+	_pendingError.clear();
+	return _error.empty();
+}
+
+void BackgroundWriter::WorkerLoop()
+{
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeCondition.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+
+			//Stopping still drains the queue
+			if (_jobs.empty()) return;
+
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+
+		std::vector<uint8_t> data = job.encode();
+
+		std::string temporaryPath = job.path + ".tmp";
+		bool written = false;
+		if (FILE* file = fopen(temporaryPath.c_str(), "wb")) {
+			written = fwrite(data.data(), 1, data.size(), file) == data.size() && Utils::SyncFile(file);
+			written = fclose(file) == 0 && written;
+		}
+
+		//Windows refuses to rename over an existing file
+		if (written && std::rename(temporaryPath.c_str(), job.path.c_str()) != 0) {
+			std::remove(job.path.c_str());
+			written = std::rename(temporaryPath.c_str(), job.path.c_str()) == 0;
+		}
+
+		if (written) {
+			Utils::SyncDirectory(job.path);
+		}
+		else {
+			std::remove(temporaryPath.c_str());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!written) _pendingError += "Failed to write " + job.path + "\n";
+			_pending--;
+		}
+		_doneCondition.notify_all();
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Writes files on a thread of its own, in the order they were queued, so rendering never waits for the disk.
+//Each file is written under a temporary name and renamed once complete, a crash never leaves a partial file behind.
+class BackgroundWriter
+{
+public:
+	using EncodeFn = std::function<std::vector<uint8_t>()>;
+
+	BackgroundWriter();
+	//Finishes the queued writes first
+	~BackgroundWriter();
+
+	BackgroundWriter(const BackgroundWriter&) = delete;
+	BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+	//Writes what encode returns to path. encode runs on the writer's thread, so it must only use data it owns.
+	void Write(const std::string& path, EncodeFn encode);
+	void Write(const std::string& path, std::vector<uint8_t> data);
+
+	//Writes queued or in progress
+	uint32_t GetPendingCount() const;
+
+	//Waits for every queued write, false when any of them failed since the last Flush
+	bool Flush();
+
+	//Failures since the last Flush, one line per file
+	const std::string& GetError() const { return _error; }
+
+private:
+	void WorkerLoop();
+
+private:
+	struct Job {
+		std::string path;
+		EncodeFn encode;
+	};
+
+	std::thread _thread;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _doneCondition;
+
+	std::deque<Job> _jobs;
+	uint32_t _pending = 0;
+	bool _stopping = false;
+
+	std::string _error;
+	std::string _pendingError;
+};
@@ -6,11 +6,18 @@
 class Camera
 {
 public:
+	enum class RayDirectionMode {
+		OnTheFly,	//GetRayDirection computes from three basis vectors, no per-pixel storage
+		Cached		//Full width * height table, rebuilt whenever the camera changes
+	};
+
 	Camera(float verticalFOV, float nearClip, float farClip);
 
-	bool OnUpdate(float ts);
 	void OnResize(uint32_t width, uint32_t height);
 
+	//Moves the camera and rebuilds the view and cached ray directions
+	void SetView(const glm::vec3& position, const glm::vec3& forwardDirection);
+
 	const glm::mat4& GetProjection() const { return _projection; }
 	const glm::mat4& GetInverseProjection() const { return _inverseProjection; }
 	const glm::mat4& GetView() const { return _view; }
@@ -19,9 +26,21 @@ public:
 	const glm::vec3& GetPosition() const { return _position; }
 	const glm::vec3& GetDirection() const { return _forwardDirection; }
 
+	//Direction through pixel (x, y). The view direction is an affine function of the pixel, so it is
+	//rebuilt from a corner vector and per-pixel steps rather than a matrix product per pixel.
+	glm::vec3 GetRayDirection(uint32_t x, uint32_t y) const {
+		if (_rayDirectionMode == RayDirectionMode::Cached) {
+			return _rayDirections[x + y * _viewportWidth];
+		}
+		return glm::normalize(_rayBasisOrigin + (float)x * _rayBasisStepX + (float)y * _rayBasisStepY);
+	}
+
+	//Empty unless the mode is Cached
 	const std::vector<glm::vec3>& GetRayDirections() const { return _rayDirections; }
 
-	float GetRotationSpeed();
+	void SetRayDirectionMode(RayDirectionMode mode);
+	RayDirectionMode GetRayDirectionMode() const { return _rayDirectionMode; }
+
 private:
 	void RecalculateProjection();
 	void RecalculateView();
@@ -40,9 +59,14 @@ private:
 	glm::vec3 _position{ 0.0f };
 	glm::vec3 _forwardDirection{ 0.0f };
 
-	std::vector<glm::vec3> _rayDirections;
+	RayDirectionMode _rayDirectionMode = RayDirectionMode::OnTheFly;
+
+	//Unnormalized world space direction through pixel (0, 0) and its change per pixel step
+	glm::vec3 _rayBasisOrigin{ 0.0f };
+	glm::vec3 _rayBasisStepX{ 0.0f };
+	glm::vec3 _rayBasisStepY{ 0.0f };
 
-	glm::vec2 _lastMousePosition{ 0.0f };
+	std::vector<glm::vec3> _rayDirections;
 
 	uint32_t _viewportWidth = 0;
 	uint32_t _viewportHeight = 0;
@@ -0,0 +1,398 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define RT_X64 1
+	#include <immintrin.h>
+#else
+	#define RT_X64 0
+#endif
+
+namespace DenoiseKernels {
+	//B3 spline, the kernel of every pass is its outer product with itself
+	static const float Spline[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	//3x3 blur of the variance before it is used for the luminance weight
+	static const float Gaussian[3] = { 1.0f / 4.0f, 1.0f / 2.0f, 1.0f / 4.0f };
+
+	//Raising the normal similarity to this power ends the filter at creases
+	static constexpr uint32_t NormalPowerSquarings = 7; //cosine^128
+
+	//e^-e for e >= 0, as 2^t with a polynomial for the fraction. Written step by step the way the SSE kernel
+	//computes it, so both round identically.
+	static float ExpNegative(float e) {
+		float t = e * -1.44269504f;
+		t = t > -126.0f ? t : -126.0f;
+
+		int32_t i = (int32_t)t;
+		float f = t - (float)i;
+
+		float p = 1.33335581e-3f;
+		p = p * f + 9.61812911e-3f;
+		p = p * f + 5.55041087e-2f;
+		p = p * f + 2.40226507e-1f;
+		p = p * f + 6.93147181e-1f;
+		p = p * f + 1.0f;
+
+		uint32_t bits = (uint32_t)(i + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, sizeof(scale));
+		return p * scale;
+	}
+
+	static float Luminance(float r, float g, float b) {
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+
+	void FilterScalar(const Pass& pass, uint32_t first, uint32_t count)
+	{
+		int32_t stride = (int32_t)pass.stride;
+		int32_t step = (int32_t)pass.step;
+		float depthSigma = pass.depthSigma * (float)pass.step;
+
+		for (uint32_t p = first; p < first + count; p++) {
+			float nx = pass.normal[0][p], ny = pass.normal[1][p], nz = pass.normal[2][p];
+
+			if (nx * nx + ny * ny + nz * nz == 0.0f) {
+				for (uint32_t c = 0; c < 3; c++) pass.outColor[c][p] = pass.color[c][p];
+				pass.outVariance[p] = pass.variance[p];
+				continue;
+			}
+
+			float luminance = Luminance(pass.color[0][p], pass.color[1][p], pass.color[2][p]);
+			float z = pass.depth[p];
+
+			float blurredVariance = 0.0f;
+			for (int32_t dy = -1; dy <= 1; dy++) {
+				for (int32_t dx = -1; dx <= 1; dx++) {
+					blurredVariance += Gaussian[dy + 1] * Gaussian[dx + 1] * pass.variance[p + dy * stride + dx];
+				}
+			}
+
+			float deviation = std::sqrt(blurredVariance > 0.0f ? blurredVariance : 0.0f);
+			float luminanceScale = 1.0f / (pass.luminanceSigma * deviation + 1e-4f);
+			float depthScale = 1.0f / (depthSigma * pass.depthGradient[p] + 1e-3f * z + 1e-6f);
+
+			float sumWeight = 0.0f, sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, sumVariance = 0.0f;
+
+			for (int32_t dy = -2; dy <= 2; dy++) {
+				for (int32_t dx = -2; dx <= 2; dx++) {
+					uint32_t q = (uint32_t)((int32_t)p + (dy * stride + dx) * step);
+
+					float cosine = nx * pass.normal[0][q] + ny * pass.normal[1][q] + nz * pass.normal[2][q];
+					cosine = cosine > 0.0f ? cosine : 0.0f;
+					for (uint32_t s = 0; s < NormalPowerSquarings; s++) cosine *= cosine;
+
+					float r = pass.color[0][q], g = pass.color[1][q], b = pass.color[2][q];
+					float e = std::fabs(luminance - Luminance(r, g, b)) * luminanceScale + std::fabs(z - pass.depth[q]) * depthScale;
+
+					float weight = Spline[dy + 2] * Spline[dx + 2] * cosine * ExpNegative(e);
+
+					sumWeight += weight;
+					sumR += weight * r;
+					sumG += weight * g;
+					sumB += weight * b;
+					sumVariance += weight * weight * pass.variance[q];
+				}
+			}
+
+			pass.outColor[0][p] = sumR / sumWeight;
+			pass.outColor[1][p] = sumG / sumWeight;
+			pass.outColor[2][p] = sumB / sumWeight;
+			pass.outVariance[p] = sumVariance / (sumWeight * sumWeight);
+		}
+	}
+
+#if RT_X64
+	static __m128 ExpNegative4(__m128 e) {
+		__m128 t = _mm_max_ps(_mm_mul_ps(e, _mm_set1_ps(-1.44269504f)), _mm_set1_ps(-126.0f));
+
+		__m128i i = _mm_cvttps_epi32(t);
+		__m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+
+		__m128 p = _mm_set1_ps(1.33335581e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+		return _mm_mul_ps(p, scale);
+	}
+
+	static __m128 Luminance4(__m128 r, __m128 g, __m128 b) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.2126f), r), _mm_mul_ps(_mm_set1_ps(0.7152f), g)), _mm_mul_ps(_mm_set1_ps(0.0722f), b));
+	}
+
+	void FilterSSE(const Pass& pass, uint32_t first, uint32_t count)
+	{
+		int32_t stride = (int32_t)pass.stride;
+		int32_t step = (int32_t)pass.step;
+		float depthSigma = pass.depthSigma * (float)pass.step;
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		for (uint32_t p = first; p < first + count; p += 4) {
+			__m128 nx = _mm_loadu_ps(pass.normal[0] + p);
+			__m128 ny = _mm_loadu_ps(pass.normal[1] + p);
+			__m128 nz = _mm_loadu_ps(pass.normal[2] + p);
+
+			__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+			__m128 surface = _mm_cmpneq_ps(length2, zero);
+
+			__m128 centerR = _mm_loadu_ps(pass.color[0] + p);
+			__m128 centerG = _mm_loadu_ps(pass.color[1] + p);
+			__m128 centerB = _mm_loadu_ps(pass.color[2] + p);
+			__m128 centerVariance = _mm_loadu_ps(pass.variance + p);
+
+			if (_mm_movemask_ps(surface) == 0) {
+				_mm_storeu_ps(pass.outColor[0] + p, centerR);
+				_mm_storeu_ps(pass.outColor[1] + p, centerG);
+				_mm_storeu_ps(pass.outColor[2] + p, centerB);
+				_mm_storeu_ps(pass.outVariance + p, centerVariance);
+				continue;
+			}
+
+			__m128 luminance = Luminance4(centerR, centerG, centerB);
+			__m128 z = _mm_loadu_ps(pass.depth + p);
+
+			__m128 blurredVariance = zero;
+			for (int32_t dy = -1; dy <= 1; dy++) {
+				for (int32_t dx = -1; dx <= 1; dx++) {
+					__m128 weight = _mm_set1_ps(Gaussian[dy + 1] * Gaussian[dx + 1]);
+					blurredVariance = _mm_add_ps(blurredVariance, _mm_mul_ps(weight, _mm_loadu_ps(pass.variance + p + dy * stride + dx)));
+				}
+			}
+
+			__m128 deviation = _mm_sqrt_ps(_mm_max_ps(blurredVariance, zero));
+			__m128 luminanceScale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pass.luminanceSigma), deviation), _mm_set1_ps(1e-4f)));
+			__m128 depthScale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthSigma), _mm_loadu_ps(pass.depthGradient + p)),
+				_mm_mul_ps(_mm_set1_ps(1e-3f), z)), _mm_set1_ps(1e-6f)));
+
+			__m128 sumWeight = zero, sumR = zero, sumG = zero, sumB = zero, sumVariance = zero;
+
+			for (int32_t dy = -2; dy <= 2; dy++) {
+				for (int32_t dx = -2; dx <= 2; dx++) {
+					uint32_t q = (uint32_t)((int32_t)p + (dy * stride + dx) * step);
+
+					__m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(pass.normal[0] + q)), _mm_mul_ps(ny, _mm_loadu_ps(pass.normal[1] + q))),
+						_mm_mul_ps(nz, _mm_loadu_ps(pass.normal[2] + q)));
+					cosine = _mm_max_ps(cosine, zero);
+					for (uint32_t s = 0; s < NormalPowerSquarings; s++) cosine = _mm_mul_ps(cosine, cosine);
+
+					__m128 r = _mm_loadu_ps(pass.color[0] + q);
+					__m128 g = _mm_loadu_ps(pass.color[1] + q);
+					__m128 b = _mm_loadu_ps(pass.color[2] + q);
+
+					__m128 luminanceDelta = _mm_and_ps(_mm_sub_ps(luminance, Luminance4(r, g, b)), absMask);
+					__m128 depthDelta = _mm_and_ps(_mm_sub_ps(z, _mm_loadu_ps(pass.depth + q)), absMask);
+					__m128 e = _mm_add_ps(_mm_mul_ps(luminanceDelta, luminanceScale), _mm_mul_ps(depthDelta, depthScale));
+
+					__m128 weight = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(Spline[dy + 2] * Spline[dx + 2]), cosine), ExpNegative4(e));
+
+					sumWeight = _mm_add_ps(sumWeight, weight);
+					sumR = _mm_add_ps(sumR, _mm_mul_ps(weight, r));
+					sumG = _mm_add_ps(sumG, _mm_mul_ps(weight, g));
+					sumB = _mm_add_ps(sumB, _mm_mul_ps(weight, b));
+					sumVariance = _mm_add_ps(sumVariance, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(pass.variance + q)));
+				}
+			}
+
+			//Lanes without a surface divide by zero, the blend throws their result away
+			__m128 outR = _mm_div_ps(sumR, sumWeight);
+			__m128 outG = _mm_div_ps(sumG, sumWeight);
+			__m128 outB = _mm_div_ps(sumB, sumWeight);
+			__m128 outVariance = _mm_div_ps(sumVariance, _mm_mul_ps(sumWeight, sumWeight));
+
+			_mm_storeu_ps(pass.outColor[0] + p, _mm_or_ps(_mm_and_ps(surface, outR), _mm_andnot_ps(surface, centerR)));
+			_mm_storeu_ps(pass.outColor[1] + p, _mm_or_ps(_mm_and_ps(surface, outG), _mm_andnot_ps(surface, centerG)));
+			_mm_storeu_ps(pass.outColor[2] + p, _mm_or_ps(_mm_and_ps(surface, outB), _mm_andnot_ps(surface, centerB)));
+			_mm_storeu_ps(pass.outVariance + p, _mm_or_ps(_mm_and_ps(surface, outVariance), _mm_andnot_ps(surface, centerVariance)));
+		}
+	}
+#else
+	void FilterSSE(const Pass& pass, uint32_t first, uint32_t count)
+	{
+		FilterScalar(pass, first, count);
+	}
+#endif
+
+	FilterFn Select()
+	{
+	#if RT_X64
+		//SSE2 is part of the x64 baseline
+		return FilterSSE;
+	#else
+		return FilterScalar;
+	#endif
+	}
+}
+
+namespace Utils {
+	static float Luminance(const glm::vec3& color) {
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
+}
+
+void Denoiser::Allocate(uint32_t width, uint32_t height, uint32_t iterations)
+{
+	//The last pass reaches twice its step away, the SSE kernel needs at least three pixels to run over
+	uint32_t padding = std::max(4u, 1u << iterations);
+	uint32_t stride = (width + 2 * padding + 3) & ~3u;
+
+	if (width == _width && height == _height && padding == _padding) return;
+
+	_width = width;
+	_height = height;
+	_padding = padding;
+	_stride = stride;
+
+	size_t size = (size_t)stride * (height + 2 * padding);
+
+	for (uint32_t c = 0; c < 3; c++) {
+		_color[0][c].assign(size, 0.0f);
+		_color[1][c].assign(size, 0.0f);
+		_albedo[c].assign(size, 0.0f);
+		_normal[c].assign(size, 0.0f);
+	}
+	_variance[0].assign(size, 0.0f);
+	_variance[1].assign(size, 0.0f);
+	_depth.assign(size, 0.0f);
+	_depthGradient.assign(size, 0.0f);
+}
+
+void Denoiser::Prepare(const Input& input, uint32_t y)
+{
+	for (uint32_t x = 0; x < _width; x++) {
+		uint32_t pixel = x + y * _width;
+		uint32_t index = PlaneIndex(x, y);
+		uint32_t n = input.SampleCounts[pixel];
+
+		glm::vec3 color(0.0f), albedo(1.0f), normal(0.0f);
+		float depth = 0.0f, variance = 0.0f;
+
+		if (n > 0) {
+			float inverseCount = 1.0f / (float)n;
+			color = glm::vec3(input.Accumulation[pixel]) * inverseCount;
+			normal = input.Normal[pixel] * inverseCount;
+
+			float length = glm::length(normal);
+			if (length > 1e-3f) {
+				normal /= length;
+				depth = input.Depth[pixel] * inverseCount;
+
+				//Dividing out the albedo leaves the lighting, which is smooth across material and texture edges
+				albedo = glm::max(input.Albedo[pixel] * inverseCount, glm::vec3(1e-3f));
+
+				//Variance of the pixel's mean. One sample says nothing about it, so assume the noise is as large as the signal.
+				float luminance = Utils::Luminance(color);
+				variance = n > 1 ? glm::max(input.LuminanceSquared[pixel] * inverseCount - luminance * luminance, 0.0f) / (float)(n - 1) : luminance * luminance;
+
+				float albedoLuminance = glm::max(Utils::Luminance(albedo), 1e-3f);
+				variance /= albedoLuminance * albedoLuminance;
+
+				color /= albedo;
+			}
+			else {
+				normal = glm::vec3(0.0f);
+			}
+		}
+
+		for (uint32_t c = 0; c < 3; c++) {
+			_color[0][c][index] = color[c];
+			_albedo[c][index] = albedo[c];
+			_normal[c][index] = normal[c];
+		}
+		_variance[0][index] = variance;
+		_depth[index] = depth;
+	}
+}
+
+void Denoiser::Denoise(const Input& input, uint32_t iterations, float luminanceSigma, float depthSigma, glm::vec4* output, ThreadPool& threadPool)
+{
+	iterations = std::min(iterations, 8u);
+	Allocate(input.Width, input.Height, iterations);
+
+	threadPool.ParallelFor(_height, [&](uint32_t y, uint32_t)
+		{
+			Prepare(input, y);
+		}
+	);
+
+	//Neighbours across a depth edge or without a surface would make the slope look steeper than it is, so the
+	//gentler side is used in each direction
+	threadPool.ParallelFor(_height, [&](uint32_t y, uint32_t)
+		{
+			for (uint32_t x = 0; x < _width; x++) {
+				uint32_t index = PlaneIndex(x, y);
+				float z = _depth[index];
+
+				float gradient = 0.0f;
+				if (z > 0.0f) {
+					uint32_t offsets[2] = { 1, _stride };
+					for (uint32_t offset : offsets) {
+						float before = _depth[index - offset], after = _depth[index + offset];
+						float slope = FLT_MAX;
+						if (before > 0.0f) slope = std::min(slope, std::fabs(z - before));
+						if (after > 0.0f) slope = std::min(slope, std::fabs(z - after));
+						if (slope != FLT_MAX) gradient = std::max(gradient, slope);
+					}
+				}
+
+				_depthGradient[index] = gradient;
+			}
+		}
+	);
+
+	uint32_t source = 0;
+	for (uint32_t i = 0; i < iterations; i++) {
+		DenoiseKernels::Pass pass;
+		for (uint32_t c = 0; c < 3; c++) {
+			pass.color[c] = _color[source][c].data();
+			pass.outColor[c] = _color[source ^ 1][c].data();
+			pass.normal[c] = _normal[c].data();
+		}
+		pass.variance = _variance[source].data();
+		pass.outVariance = _variance[source ^ 1].data();
+		pass.depth = _depth.data();
+		pass.depthGradient = _depthGradient.data();
+		pass.stride = _stride;
+		pass.step = 1u << i;
+		pass.luminanceSigma = luminanceSigma;
+		pass.depthSigma = depthSigma;
+
+		threadPool.ParallelFor(_height, [&](uint32_t y, uint32_t)
+			{
+				_filter(pass, PlaneIndex(0, y), _width);
+			}
+		);
+
+		source ^= 1;
+	}
+
+	//Back to sums over the sample counts, pixels without a surface are copied as they were
+	threadPool.ParallelFor(_height, [&](uint32_t y, uint32_t)
+		{
+			for (uint32_t x = 0; x < _width; x++) {
+				uint32_t pixel = x + y * _width;
+				uint32_t index = PlaneIndex(x, y);
+				glm::vec4 sum = input.Accumulation[pixel];
+
+				if (_normal[0][index] != 0.0f || _normal[1][index] != 0.0f || _normal[2][index] != 0.0f) {
+					glm::vec3 color;
+					for (uint32_t c = 0; c < 3; c++) {
+						color[c] = _color[source][c][index] * _albedo[c][index];
+					}
+					sum = glm::vec4(color * (float)input.SampleCounts[pixel], sum.a);
+				}
+
+				output[pixel] = sum;
+			}
+		}
+	);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include "AlignedAllocator.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace DenoiseKernels {
+	//Planes of one à-trous pass, every one laid out with the same stride and enough zero padding around the
+	//image that no tap leaves the allocation. Pixels without a surface have a zero normal, which gives them no
+	//weight as a neighbour and passes them through unfiltered.
+	struct Pass {
+		const float* color[3];
+		const float* variance;
+		float* outColor[3];
+		float* outVariance;
+
+		const float* normal[3];
+		const float* depth;
+		//Largest depth change to a horizontal or vertical neighbour, so depth edges are judged relative to the slope
+		const float* depthGradient;
+
+		uint32_t stride;
+		//Distance between taps, doubles every pass
+		uint32_t step;
+		float luminanceSigma;
+		float depthSigma;
+	};
+
+	//Filters count pixels starting at index first with a 5x5 B3 spline kernel, each tap weighted by how closely its
+	//normal, depth and luminance match the center pixel, and propagates the variance with the squared weights.
+	//The SSE kernel works four pixels at a time and may write up to three pixels past the end, into the padding.
+	//Both kernels produce identical results.
+	using FilterFn = void(*)(const Pass& pass, uint32_t first, uint32_t count);
+
+	void FilterScalar(const Pass& pass, uint32_t first, uint32_t count);
+	void FilterSSE(const Pass& pass, uint32_t first, uint32_t count);
+
+	FilterFn Select();
+}
+
+//Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) with the variance guided luminance weight of SVGF
+//(Schied et al. 2017), run on the accumulated mean of every pixel. Lighting is demodulated by the first hit albedo
+//before filtering and multiplied back afterwards, so texture and material edges stay sharp.
+class Denoiser
+{
+public:
+	//Per pixel sums, in the layout the renderer accumulates them
+	struct Input {
+		uint32_t Width = 0, Height = 0;
+		const glm::vec4* Accumulation = nullptr;
+		const uint32_t* SampleCounts = nullptr;
+		const float* LuminanceSquared = nullptr;
+		const glm::vec3* Albedo = nullptr;
+		const glm::vec3* Normal = nullptr;
+		const float* Depth = nullptr;
+	};
+
+	//Writes the filtered pixels to output as sums over the same sample counts, so they resolve like the accumulation.
+	//Each iteration doubles the filter footprint, 5 covers 63x63 pixels.
+	void Denoise(const Input& input, uint32_t iterations, float luminanceSigma, float depthSigma, glm::vec4* output, ThreadPool& threadPool);
+
+private:
+	void Allocate(uint32_t width, uint32_t height, uint32_t iterations);
+
+	//Fills the first color/variance planes and the guides from the accumulation
+	void Prepare(const Input& input, uint32_t y);
+
+	uint32_t PlaneIndex(uint32_t x, uint32_t y) const { return (x + _padding) + (y + _padding) * _stride; }
+
+private:
+	using Plane = std::vector<float, AlignedAllocator<float, 16>>;
+
+	uint32_t _width = 0, _height = 0;
+	uint32_t _padding = 0, _stride = 0;
+
+	//Ping-pong color and variance planes
+	Plane _color[2][3];
+	Plane _variance[2];
+	Plane _albedo[3];
+
+	Plane _normal[3];
+	Plane _depth;
+	Plane _depthGradient;
+
+	DenoiseKernels::FilterFn _filter = DenoiseKernels::Select();
+};
@@ -8,10 +8,22 @@ struct HitPayload {
 	glm::vec3 WorldPosition;
 	glm::vec3 WorldNormal;
 
+	//Sphere index, or the triangle for meshes and the element index for other primitives
 	uint32_t ObjectIndex;
+	//Instance the sphere was reached through, -1 for spheres placed directly in the scene
+	int InstanceIndex;
+	int MaterialIndex;
 };
 
-class Hittable {
-public: 
-	virtual bool Hit(const Ray& r, float tMin, float tMax, HitPayload& rec) const = 0;
-};
\ No newline at end of file
+//What intersection found, without any shading data. The renderer rebuilds the HitPayload from it only when shading.
+struct HitRecord {
+	enum Kind : int32_t { Miss = -1, Sphere = 0, InstancedSphere = 1, Primitive = 2 };
+
+	float T = -1.0f;
+	//Sphere in the scene or in the instance's group, or the element of a ScenePrimitives array
+	uint32_t Object = 0;
+	//Instance for instanced spheres, part (a mesh's triangle) for primitives
+	uint32_t Detail = 0;
+	//A Kind, primitives store Primitive plus their ScenePrimitives type
+	int32_t Type = Miss;
+};
@@ -0,0 +1,211 @@
+#include "ImageEncoding.h"
+
+#include <cstring>
+#include <string>
+
+namespace Utils {
+	template<typename T>
+	static void Append(std::vector<uint8_t>& out, const T& value) {
+		size_t offset = out.size();
+		out.resize(offset + sizeof(T));
+		memcpy(out.data() + offset, &value, sizeof(T));
+	}
+
+	static void AppendString(std::vector<uint8_t>& out, const std::string& text) {
+		out.insert(out.end(), text.begin(), text.end());
+	}
+
+	//Name, type and size of an EXR header attribute, its value follows
+	static void AppendAttribute(std::vector<uint8_t>& out, const char* name, const char* type, uint32_t size) {
+		out.insert(out.end(), name, name + strlen(name) + 1);
+		out.insert(out.end(), type, type + strlen(type) + 1);
+		Append(out, size);
+	}
+}
+
+namespace ImageEncoding {
+	uint16_t FloatToHalf(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		uint32_t sign = (bits >> 16) & 0x8000;
+		uint32_t exponent = (bits >> 23) & 0xff;
+		uint32_t mantissa = bits & 0x7fffff;
+
+		//Infinity stays infinity, NaN stays NaN
+		if (exponent == 0xff) {
+			return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+		}
+
+		int32_t halfExponent = (int32_t)exponent - 127 + 15;
+		if (halfExponent >= 31) {
+			return (uint16_t)(sign | 0x7c00);
+		}
+
+		//Denormal halves, anything below half of the smallest one rounds to zero
+		if (halfExponent <= 0) {
+			if (halfExponent < -10) return (uint16_t)sign;
+
+			mantissa |= 0x800000;
+			uint32_t shift = (uint32_t)(14 - halfExponent);
+			uint32_t half = mantissa >> shift;
+			uint32_t rest = mantissa & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+
+			if (rest > halfway || (rest == halfway && (half & 1))) half++;
+			return (uint16_t)(sign | half);
+		}
+
+		//A carry out of the mantissa correctly moves on to the next exponent, or to infinity
+		uint32_t half = ((uint32_t)halfExponent << 10) | (mantissa >> 13);
+		uint32_t rest = mantissa & 0x1fff;
+
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+		return (uint16_t)(sign | half);
+	}
+
+	void EncodeEXR(const glm::vec3* pixels, const uint32_t* sampleCounts, uint32_t width, uint32_t height, EXRPixelType type, std::vector<uint8_t>& out) {
+		enum : int32_t { UIntChannel = 0, HalfChannel = 1, FloatChannel = 2 };
+
+		struct Channel {
+			const char* Name;
+			int32_t Type;
+			uint32_t Size;
+		};
+
+		//Channels have to be listed in alphabetical order, scanlines store them in the same order
+		int32_t colorType = type == EXRPixelType::Half ? HalfChannel : FloatChannel;
+		uint32_t colorSize = type == EXRPixelType::Half ? 2 : 4;
+
+		std::vector<Channel> channels = { { "B", colorType, colorSize }, { "G", colorType, colorSize }, { "R", colorType, colorSize } };
+		if (sampleCounts) {
+			channels.push_back({ "samples", UIntChannel, 4 });
+		}
+
+		uint32_t lineSize = 0;
+		uint32_t channelListSize = 1;
+		for (const Channel& channel : channels) {
+			lineSize += channel.Size * width;
+			channelListSize += (uint32_t)strlen(channel.Name) + 1 + 16;
+		}
+
+		out.clear();
+		Utils::Append(out, (int32_t)20000630);
+		//Version 2, single part scanline file
+		Utils::Append(out, (int32_t)2);
+
+		Utils::AppendAttribute(out, "channels", "chlist", channelListSize);
+		for (const Channel& channel : channels) {
+			out.insert(out.end(), channel.Name, channel.Name + strlen(channel.Name) + 1);
+			Utils::Append(out, channel.Type);
+			//pLinear and three reserved bytes
+			Utils::Append(out, (uint32_t)0);
+			//x and y sampling
+			Utils::Append(out, (int32_t)1);
+			Utils::Append(out, (int32_t)1);
+		}
+		out.push_back(0);
+
+		Utils::AppendAttribute(out, "compression", "compression", 1);
+		out.push_back(0);
+
+		int32_t window[4] = { 0, 0, (int32_t)width - 1, (int32_t)height - 1 };
+		Utils::AppendAttribute(out, "dataWindow", "box2i", sizeof(window));
+		Utils::Append(out, window);
+		Utils::AppendAttribute(out, "displayWindow", "box2i", sizeof(window));
+		Utils::Append(out, window);
+
+		//Increasing y, top row first
+		Utils::AppendAttribute(out, "lineOrder", "lineOrder", 1);
+		out.push_back(0);
+
+		Utils::AppendAttribute(out, "pixelAspectRatio", "float", 4);
+		Utils::Append(out, 1.0f);
+
+		float center[2] = { 0.0f, 0.0f };
+		Utils::AppendAttribute(out, "screenWindowCenter", "v2f", sizeof(center));
+		Utils::Append(out, center);
+
+		Utils::AppendAttribute(out, "screenWindowWidth", "float", 4);
+		Utils::Append(out, 1.0f);
+
+		out.push_back(0);
+
+		//One uncompressed scanline per chunk, each chunk is its y, its size and the lines of every channel
+		size_t tableOffset = out.size();
+		size_t chunkSize = 8 + (size_t)lineSize;
+		size_t dataOffset = tableOffset + (size_t)height * sizeof(uint64_t);
+		out.resize(dataOffset + (size_t)height * chunkSize);
+
+		for (uint32_t y = 0; y < height; y++) {
+			uint64_t offset = dataOffset + y * chunkSize;
+			memcpy(out.data() + tableOffset + y * sizeof(uint64_t), &offset, sizeof(offset));
+
+			uint8_t* chunk = out.data() + offset;
+			int32_t lineY = (int32_t)y;
+			memcpy(chunk, &lineY, sizeof(lineY));
+			memcpy(chunk + 4, &lineSize, sizeof(lineSize));
+			chunk += 8;
+
+			//EXR rows go top down
+			const glm::vec3* row = pixels + (size_t)(height - 1 - y) * width;
+
+			for (int component = 2; component >= 0; component--) {
+				for (uint32_t x = 0; x < width; x++) {
+					float value = row[x][component];
+
+					if (type == EXRPixelType::Half) {
+						uint16_t half = FloatToHalf(value);
+						memcpy(chunk, &half, sizeof(half));
+						chunk += sizeof(half);
+					}
+					else {
+						memcpy(chunk, &value, sizeof(value));
+						chunk += sizeof(value);
+					}
+				}
+			}
+
+			if (sampleCounts) {
+				memcpy(chunk, sampleCounts + (size_t)(height - 1 - y) * width, width * sizeof(uint32_t));
+			}
+		}
+	}
+
+	void EncodePFM(const glm::vec3* pixels, uint32_t width, uint32_t height, std::vector<uint8_t>& out) {
+		out.clear();
+
+		//A negative scale marks little endian data. Rows are stored bottom up, like ours.
+		Utils::AppendString(out, "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n");
+
+		size_t offset = out.size();
+		out.resize(offset + (size_t)width * height * 3 * sizeof(float));
+
+		float* data = (float*)(out.data() + offset);
+		for (size_t i = 0; i < (size_t)width * height; i++) {
+			data[i * 3 + 0] = pixels[i].r;
+			data[i * 3 + 1] = pixels[i].g;
+			data[i * 3 + 2] = pixels[i].b;
+		}
+	}
+
+	void EncodePPM(const uint32_t* pixels, uint32_t width, uint32_t height, std::vector<uint8_t>& out) {
+		out.clear();
+		Utils::AppendString(out, "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n");
+
+		size_t offset = out.size();
+		out.resize(offset + (size_t)width * height * 3);
+		uint8_t* data = out.data() + offset;
+
+		//Flipped so the first row written is the top of the image
+		for (uint32_t y = height; y-- > 0;) {
+			for (uint32_t x = 0; x < width; x++) {
+				uint32_t rgba = pixels[x + y * width];
+				data[0] = (uint8_t)(rgba & 0xff);
+				data[1] = (uint8_t)((rgba >> 8) & 0xff);
+				data[2] = (uint8_t)((rgba >> 16) & 0xff);
+				data += 3;
+			}
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//Linear HDR image files. Pixels are given bottom row first, like the renderer's buffers, and written in host byte
+//order, which both formats require to be little endian.
+namespace ImageEncoding {
+	enum class EXRPixelType {
+		Half, Float
+	};
+
+	//Uncompressed scanline OpenEXR with R, G and B channels. With sampleCounts a "samples" channel of 32 bit
+	//integers is added, so compositing can weight pixels of adaptive or reprojected renders by their sample count.
+	void EncodeEXR(const glm::vec3* pixels, const uint32_t* sampleCounts, uint32_t width, uint32_t height, EXRPixelType type, std::vector<uint8_t>& out);
+
+	//Portable float map, three 32 bit floats per pixel
+	void EncodePFM(const glm::vec3* pixels, uint32_t width, uint32_t height, std::vector<uint8_t>& out);
+
+	//Binary PPM of an RGBA8 image, alpha is dropped
+	void EncodePPM(const uint32_t* pixels, uint32_t width, uint32_t height, std::vector<uint8_t>& out);
+
+	//IEEE half precision, rounded to nearest even. Values beyond the half range become infinity.
+	uint16_t FloatToHalf(float value);
+}
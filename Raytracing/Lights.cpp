@@ -0,0 +1,61 @@
+#include "Lights.h"
+
+#include "Scene.h"
+
+float SphereLights::GetPower(const Sphere& sphere, const Material& material)
+{
+	glm::vec3 emission = material.GetEmission();
+	float luminance = 0.2126f * emission.r + 0.7152f * emission.g + 0.0722f * emission.b;
+	return glm::max(luminance, 0.0f) * sphere.radius * sphere.radius;
+}
+
+void SphereLights::Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials)
+{
+	entries.clear();
+	totalPower = 0.0f;
+
+	std::vector<float> powers;
+	for (uint32_t i = 0; i < (uint32_t)spheres.size(); i++) {
+		const Sphere& sphere = spheres[i];
+		if (sphere.materialIndex < 0 || sphere.materialIndex >= (int)materials.size()) continue;
+
+		float power = GetPower(sphere, materials[sphere.materialIndex]);
+		if (power <= 0.0f) continue;
+
+		Entry entry;
+		entry.sphere = i;
+		entry.alias = i;
+		entries.push_back(entry);
+		powers.push_back(power);
+		totalPower += power;
+	}
+
+	if (entries.empty()) return;
+
+	//Scale so the average slot holds 1, then let every slot below 1 take the rest from one above 1
+	uint32_t count = (uint32_t)entries.size();
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < count; i++) {
+		powers[i] *= count / totalPower;
+		(powers[i] < 1.0f ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		uint32_t below = small.back();
+		uint32_t above = large.back();
+		small.pop_back();
+
+		entries[below].threshold = powers[below];
+		entries[below].alias = entries[above].sphere;
+
+		powers[above] -= 1.0f - powers[below];
+		if (powers[above] < 1.0f) {
+			large.pop_back();
+			small.push_back(above);
+		}
+	}
+
+	//Whatever is left is 1 up to rounding
+	for (uint32_t i : small) entries[i].threshold = 1.0f;
+	for (uint32_t i : large) entries[i].threshold = 1.0f;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Random.h"
+
+struct Sphere;
+struct Material;
+
+//Emissive spheres of a scene in an alias table (Vose's method), so picking a light in proportion to its power
+//costs one table lookup however many lights there are
+struct SphereLights {
+	struct Entry {
+		//Probability of keeping this slot's own sphere instead of its alias
+		float threshold = 1.0f;
+		uint32_t sphere = 0;
+		uint32_t alias = 0;
+	};
+
+	std::vector<Entry> entries;
+	float totalPower = 0.0f;
+
+	//Must be rebuilt after spheres are added, removed or resized and after emission changes
+	void Build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials);
+
+	bool Empty() const { return entries.empty(); }
+
+	//Index into Scene::spheres, chosen with probability GetProbability
+	uint32_t Sample(Random& random) const {
+		const Entry& entry = entries[std::min((uint32_t)(random.Float() * entries.size()), (uint32_t)entries.size() - 1)];
+		return random.Float() < entry.threshold ? entry.sphere : entry.alias;
+	}
+
+	float GetProbability(const Sphere& sphere, const Material& material) const {
+		return totalPower > 0.0f ? GetPower(sphere, material) / totalPower : 0.0f;
+	}
+
+	//Proportional to the flux the sphere emits, constant factors are left out
+	static float GetPower(const Sphere& sphere, const Material& material);
+};
@@ -0,0 +1,236 @@
+#include "Mesh.h"
+
+#include "MappedFile.h"
+
+#include <charconv>
+#include <unordered_map>
+
+namespace Utils {
+	static bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static const char* SkipSpaces(const char* it, const char* end) {
+		while (it < end && IsSpace(*it)) it++;
+		return it;
+	}
+
+	template<typename T>
+	static bool ParseNumber(const char*& it, const char* end, T& value) {
+		std::from_chars_result result = std::from_chars(it, end, value);
+		if (result.ec != std::errc()) return false;
+		it = result.ptr;
+		return true;
+	}
+
+	//OBJ indices are 1-based, negative ones count back from the last element read so far
+	static bool ResolveIndex(int index, size_t count, uint32_t& out) {
+		int64_t resolved = index < 0 ? (int64_t)count + index : (int64_t)index - 1;
+		if (resolved < 0 || resolved >= (int64_t)count) return false;
+		out = (uint32_t)resolved;
+		return true;
+	}
+}
+
+bool Mesh::LoadOBJ(const std::string& filepath, std::string& error)
+{
+	MappedFile file;
+	if (!file.Open(filepath)) {
+		error = "cannot open " + filepath;
+		return false;
+	}
+
+	std::vector<glm::vec3> objPositions;
+	std::vector<glm::vec3> objNormals;
+
+	//Position and normal index of every triangle corner, normal is UINT32_MAX when the face gave none
+	struct Corner {
+		uint32_t position;
+		uint32_t normal;
+	};
+	std::vector<Corner> corners;
+	std::vector<Corner> face;
+
+	const char* it = (const char*)file.GetData();
+	const char* end = it + file.GetSize();
+	uint64_t line = 0;
+
+	auto fail = [&](const char* message) {
+		error = filepath + ":" + std::to_string(line) + ": " + message;
+		return false;
+	};
+
+	while (it < end) {
+		line++;
+
+		const char* lineEnd = it;
+		while (lineEnd < end && *lineEnd != '\n') lineEnd++;
+
+		it = Utils::SkipSpaces(it, lineEnd);
+
+		//'v' position, 'n' normal, 'f' face, anything else is skipped
+		char type = 0;
+		if (lineEnd - it >= 2 && (it[0] == 'v' || it[0] == 'f') && Utils::IsSpace(it[1])) type = it[0];
+		else if (lineEnd - it >= 3 && it[0] == 'v' && it[1] == 'n' && Utils::IsSpace(it[2])) type = 'n';
+
+		if (type != 0) {
+			it += type == 'n' ? 2 : 1;
+
+			if (type == 'f') {
+				face.clear();
+
+				while ((it = Utils::SkipSpaces(it, lineEnd)) < lineEnd) {
+					int index = 0;
+					Corner corner = { 0, UINT32_MAX };
+
+					if (!Utils::ParseNumber(it, lineEnd, index) || !Utils::ResolveIndex(index, objPositions.size(), corner.position)) {
+						return fail("invalid position index in face");
+					}
+
+					//v, v/vt, v//vn or v/vt/vn, texture coordinates are skipped
+					if (it < lineEnd && *it == '/') {
+						it++;
+						if (it < lineEnd && *it != '/' && !Utils::ParseNumber(it, lineEnd, index)) return fail("invalid texture index in face");
+
+						if (it < lineEnd && *it == '/') {
+							it++;
+							if (!Utils::ParseNumber(it, lineEnd, index) || !Utils::ResolveIndex(index, objNormals.size(), corner.normal)) {
+								return fail("invalid normal index in face");
+							}
+						}
+					}
+
+					if (it < lineEnd && !Utils::IsSpace(*it)) return fail("unexpected character in face");
+
+					face.push_back(corner);
+				}
+
+				if (face.size() < 3) return fail("face has fewer than three vertices");
+
+				for (size_t i = 1; i + 1 < face.size(); i++) {
+					corners.push_back(face[0]);
+					corners.push_back(face[i]);
+					corners.push_back(face[i + 1]);
+				}
+			}
+			else {
+				glm::vec3 v;
+				for (int axis = 0; axis < 3; axis++) {
+					it = Utils::SkipSpaces(it, lineEnd);
+					if (!Utils::ParseNumber(it, lineEnd, v[axis])) return fail(type == 'n' ? "invalid normal" : "invalid position");
+				}
+
+				(type == 'n' ? objNormals : objPositions).push_back(v);
+			}
+		}
+
+		it = lineEnd + 1;
+	}
+
+	positions.clear();
+	normals.clear();
+	indices.clear();
+	indices.reserve(corners.size());
+
+	bool hasNormals = false;
+	for (const Corner& corner : corners) {
+		hasNormals |= corner.normal != UINT32_MAX;
+	}
+
+	if (!hasNormals) {
+		positions = std::move(objPositions);
+		for (const Corner& corner : corners) {
+			indices.push_back(corner.position);
+		}
+	}
+	else {
+		//OBJ indexes positions and normals separately, every distinct pair becomes one vertex
+		std::unordered_map<uint64_t, uint32_t> vertexIndices;
+		vertexIndices.reserve(objPositions.size());
+
+		for (const Corner& corner : corners) {
+			uint64_t key = ((uint64_t)corner.position << 32) | corner.normal;
+			auto [entry, inserted] = vertexIndices.try_emplace(key, (uint32_t)positions.size());
+
+			if (inserted) {
+				positions.push_back(objPositions[corner.position]);
+				//Corners without a normal get zero and fall back to the face normal when hit
+				normals.push_back(corner.normal == UINT32_MAX ? glm::vec3(0.0f) : objNormals[corner.normal]);
+			}
+
+			indices.push_back(entry->second);
+		}
+	}
+
+	path = filepath;
+	return true;
+}
+
+void Mesh::BuildAccelerationStructure()
+{
+	uint32_t triangleCount = GetTriangleCount();
+	std::vector<AABB> bounds(triangleCount);
+
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		bounds[i].Grow(positions[indices[i * 3 + 0]]);
+		bounds[i].Grow(positions[indices[i * 3 + 1]]);
+		bounds[i].Grow(positions[indices[i * 3 + 2]]);
+	}
+
+	bvh.Build(bounds, TriangleKernels::GetSelectedWidth());
+	packedTriangles.Build(positions, indices, bvh.GetPrimitiveIndices());
+}
+
+bool Mesh::Intersect(const Ray& ray, float tMin, float& closestT, uint32_t& part) const
+{
+	if (!IsBuilt()) return false;
+
+	TriangleKernels::IntersectFn intersect = TriangleKernels::Select();
+	int closestLane = -1;
+
+	bvh.Traverse(ray, closestT, [&](uint32_t first, uint32_t count) {
+		intersect(packedTriangles, ray, first, count, tMin, closestT, closestLane);
+	});
+
+	if (closestLane < 0) return false;
+
+	part = packedTriangles.triangleIndex[closestLane];
+	return true;
+}
+
+void Mesh::FillPayload(const Ray& ray, float t, uint32_t part, HitPayload& payload) const
+{
+	uint32_t i0 = indices[part * 3 + 0], i1 = indices[part * 3 + 1], i2 = indices[part * 3 + 2];
+
+	glm::vec3 e1 = positions[i1] - positions[i0];
+	glm::vec3 e2 = positions[i2] - positions[i0];
+
+	glm::vec3 normal(0.0f);
+	if (!normals.empty()) {
+		//Barycentrics of the hit, only needed for the one triangle that won
+		glm::vec3 p = glm::cross(ray.direction, e2);
+		float invDet = 1.0f / glm::dot(e1, p);
+		glm::vec3 toOrigin = ray.origin - positions[i0];
+		glm::vec3 q = glm::cross(toOrigin, e1);
+		float u = glm::dot(toOrigin, p) * invDet;
+		float v = glm::dot(ray.direction, q) * invDet;
+
+		normal = normals[i0] * (1.0f - u - v) + normals[i1] * u + normals[i2] * v;
+	}
+
+	if (glm::dot(normal, normal) == 0.0f) {
+		normal = glm::cross(e1, e2);
+	}
+
+	//Triangles are two-sided, shade the side the ray arrived from
+	normal = glm::normalize(normal);
+	if (glm::dot(normal, ray.direction) > 0.0f) {
+		normal = -normal;
+	}
+
+	payload.HitDistance = t;
+	payload.WorldPosition = ray.origin + ray.direction * t;
+	payload.WorldNormal = normal;
+	payload.ObjectIndex = part;
+	payload.MaterialIndex = materialIndex;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Hittable.h"
+#include "BVH.h"
+#include "PackedTriangles.h"
+
+//Indexed triangle mesh with its own BVH, traced as one of the ScenePrimitives
+struct Mesh {
+public:
+	//File the mesh was loaded from, written back when the scene is saved
+	std::string path;
+	int materialIndex = 0;
+
+	std::vector<glm::vec3> positions;
+	//Per vertex, empty when the file had none and the mesh is shaded with face normals
+	std::vector<glm::vec3> normals;
+	//Three per triangle
+	std::vector<uint32_t> indices;
+
+	BVH bvh;
+	PackedTriangles packedTriangles;
+
+	//Reads v, vn and f records. Polygons are fanned into triangles, everything else in the file is ignored.
+	bool LoadOBJ(const std::string& filepath, std::string& error);
+
+	void BuildAccelerationStructure();
+	bool IsBuilt() const { return bvh.GetPrimitiveCount() == GetTriangleCount() && packedTriangles.count == GetTriangleCount(); }
+
+	uint32_t GetTriangleCount() const { return (uint32_t)(indices.size() / 3); }
+
+	//Walks the BVH, part is the nearest triangle
+	bool Intersect(const Ray& ray, float tMin, float& closestT, uint32_t& part) const;
+	//Interpolates the vertex normals of the triangle and reports it as ObjectIndex
+	void FillPayload(const Ray& ray, float t, uint32_t part, HitPayload& payload) const;
+};
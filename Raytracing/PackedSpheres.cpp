@@ -0,0 +1,254 @@
+#include "PackedSpheres.h"
+
+#include "Scene.h"
+
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define RT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define RT_TARGET_AVX2
+	#else
+		#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#else
+	#define RT_X64 0
+#endif
+
+void PackedSpheres::Build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order)
+{
+	count = (uint32_t)order.size();
+	sphereIndex = order;
+
+	uint32_t paddedCount = count + Padding;
+	x.assign(paddedCount, 0.0f);
+	y.assign(paddedCount, 0.0f);
+	z.assign(paddedCount, 0.0f);
+	//A negative infinite radius squared makes the discriminant -inf, so padding lanes always miss
+	radius2.assign(paddedCount, -std::numeric_limits<float>::infinity());
+	materialIndex.assign(paddedCount, 0);
+
+	Update(spheres);
+}
+
+void PackedSpheres::Update(const std::vector<Sphere>& spheres)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		UpdateLane(spheres, i);
+	}
+}
+
+void PackedSpheres::Update(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& lanes)
+{
+	for (uint32_t i : lanes) {
+		UpdateLane(spheres, i);
+	}
+}
+
+void PackedSpheres::UpdateLane(const std::vector<Sphere>& spheres, uint32_t lane)
+{
+	const Sphere& sphere = spheres[sphereIndex[lane]];
+	x[lane] = sphere.pos.x;
+	y[lane] = sphere.pos.y;
+	z[lane] = sphere.pos.z;
+	radius2[lane] = sphere.radius * sphere.radius;
+	materialIndex[lane] = sphere.materialIndex;
+}
+
+void PackedSpheres::Clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	radius2.clear();
+	materialIndex.clear();
+	sphereIndex.clear();
+	count = 0;
+}
+
+namespace SphereKernels {
+
+	//Same arithmetic, in the same order, as the scalar sphere test in Renderer so every kernel agrees bit for bit.
+	//Lanes past the end of a leaf belong to real neighbouring spheres or padding, testing them is harmless.
+	void IntersectScalar(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane)
+	{
+		float a = ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z;
+
+		for (uint32_t i = first; i < first + count; i++) {
+			float ox = ray.origin.x - spheres.x[i];
+			float oy = ray.origin.y - spheres.y[i];
+			float oz = ray.origin.z - spheres.z[i];
+
+			float half_b = ox * ray.direction.x + oy * ray.direction.y + oz * ray.direction.z;
+			float c = (ox * ox + oy * oy + oz * oz) - spheres.radius2[i];
+			float discriminant = half_b * half_b - a * c;
+
+			if (discriminant < 0.0f) continue;
+
+			float t = (-half_b - std::sqrt(discriminant)) / a;
+			if (t > 0.0f && t < closestT) {
+				closestT = t;
+				closestLane = (int)i;
+			}
+		}
+	}
+
+#if RT_X64
+	void IntersectSSE(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane)
+	{
+		const __m128 rox = _mm_set1_ps(ray.origin.x), roy = _mm_set1_ps(ray.origin.y), roz = _mm_set1_ps(ray.origin.z);
+		const __m128 rdx = _mm_set1_ps(ray.direction.x), rdy = _mm_set1_ps(ray.direction.y), rdz = _mm_set1_ps(ray.direction.z);
+		const __m128 a = _mm_set1_ps(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+		for (uint32_t i = first; i < first + count; i += 4) {
+			__m128 ox = _mm_sub_ps(rox, _mm_loadu_ps(&spheres.x[i]));
+			__m128 oy = _mm_sub_ps(roy, _mm_loadu_ps(&spheres.y[i]));
+			__m128 oz = _mm_sub_ps(roz, _mm_loadu_ps(&spheres.z[i]));
+
+			__m128 halfB = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, rdx), _mm_mul_ps(oy, rdy)), _mm_mul_ps(oz, rdz));
+			__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)), _mm_loadu_ps(&spheres.radius2[i]));
+			__m128 discriminant = _mm_sub_ps(_mm_mul_ps(halfB, halfB), _mm_mul_ps(a, c));
+
+			__m128 hitMask = _mm_cmpge_ps(discriminant, zero);
+			if (_mm_movemask_ps(hitMask) == 0) continue;
+
+			__m128 t = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, halfB), _mm_sqrt_ps(_mm_max_ps(discriminant, zero))), a);
+			hitMask = _mm_and_ps(hitMask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+
+			int mask = _mm_movemask_ps(hitMask);
+			if (mask == 0) continue;
+
+			//Horizontal min, then the first lane holding it
+			t = _mm_or_ps(_mm_and_ps(hitMask, t), _mm_andnot_ps(hitMask, inf));
+			__m128 m = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+			m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			int lane = 0;
+			int minMask = _mm_movemask_ps(_mm_cmpeq_ps(t, m)) & mask;
+			while (!(minMask & (1 << lane))) lane++;
+
+			closestT = _mm_cvtss_f32(m);
+			closestLane = (int)i + lane;
+		}
+	}
+
+	RT_TARGET_AVX2 void IntersectAVX2(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane)
+	{
+		const __m256 rox = _mm256_set1_ps(ray.origin.x), roy = _mm256_set1_ps(ray.origin.y), roz = _mm256_set1_ps(ray.origin.z);
+		const __m256 rdx = _mm256_set1_ps(ray.direction.x), rdy = _mm256_set1_ps(ray.direction.y), rdz = _mm256_set1_ps(ray.direction.z);
+		const __m256 a = _mm256_set1_ps(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+
+		for (uint32_t i = first; i < first + count; i += 8) {
+			__m256 ox = _mm256_sub_ps(rox, _mm256_loadu_ps(&spheres.x[i]));
+			__m256 oy = _mm256_sub_ps(roy, _mm256_loadu_ps(&spheres.y[i]));
+			__m256 oz = _mm256_sub_ps(roz, _mm256_loadu_ps(&spheres.z[i]));
+
+			//Separate mul/add rather than FMA keeps results identical to the scalar kernel
+			__m256 halfB = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, rdx), _mm256_mul_ps(oy, rdy)), _mm256_mul_ps(oz, rdz));
+			__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy)), _mm256_mul_ps(oz, oz)), _mm256_loadu_ps(&spheres.radius2[i]));
+			__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(halfB, halfB), _mm256_mul_ps(a, c));
+
+			__m256 hitMask = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+			if (_mm256_movemask_ps(hitMask) == 0) continue;
+
+			__m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, halfB), _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero))), a);
+			hitMask = _mm256_and_ps(hitMask, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)));
+
+			int mask = _mm256_movemask_ps(hitMask);
+			if (mask == 0) continue;
+
+			t = _mm256_blendv_ps(inf, t, hitMask);
+			__m256 m = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+			m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+			m = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 0x01));
+
+			int lane = 0;
+			int minMask = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)) & mask;
+			while (!(minMask & (1 << lane))) lane++;
+
+			closestT = _mm256_cvtss_f32(m);
+			closestLane = (int)i + lane;
+		}
+	}
+
+	static bool CPUSupportsAVX2() {
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) return false;
+
+		//OS must save the upper halves of the YMM registers
+		if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	#else
+		return __builtin_cpu_supports("avx2");
+	#endif
+	}
+#else
+	void IntersectSSE(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane)
+	{
+		IntersectScalar(spheres, ray, first, count, closestT, closestLane);
+	}
+
+	void IntersectAVX2(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane)
+	{
+		IntersectScalar(spheres, ray, first, count, closestT, closestLane);
+	}
+
+	static bool CPUSupportsAVX2() { return false; }
+#endif
+
+	static const char* s_SelectedName = "";
+	static uint32_t s_SelectedWidth = 1;
+
+	static IntersectFn Detect()
+	{
+	#if RT_X64
+		if (CPUSupportsAVX2()) {
+			s_SelectedName = "AVX2";
+			s_SelectedWidth = 8;
+			return IntersectAVX2;
+		}
+
+		//SSE2 is part of the x64 baseline
+		s_SelectedName = "SSE";
+		s_SelectedWidth = 4;
+		return IntersectSSE;
+	#else
+		s_SelectedName = "Scalar";
+		return IntersectScalar;
+	#endif
+	}
+
+	IntersectFn Select()
+	{
+		static const IntersectFn selected = Detect();
+		return selected;
+	}
+
+	const char* GetSelectedName()
+	{
+		Select();
+		return s_SelectedName;
+	}
+
+	uint32_t GetSelectedWidth()
+	{
+		Select();
+		return s_SelectedWidth;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "Ray.h"
+
+#include <cstdint>
+#include <vector>
+
+struct Sphere;
+
+//Structure-of-arrays copy of Scene::spheres in BVH leaf order, so a leaf is a contiguous run of lanes.
+//Arrays are padded with spheres that can never be hit so kernels may read a full SIMD width past any leaf.
+struct PackedSpheres {
+	static constexpr uint32_t Padding = 8;
+
+	AlignedVector<float> x, y, z;
+	AlignedVector<float> radius2;
+	std::vector<int> materialIndex;
+
+	//Index into Scene::spheres for each packed lane
+	std::vector<uint32_t> sphereIndex;
+
+	uint32_t count = 0;
+
+	void Build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order);
+
+	//Rewrites positions and radii in the existing order
+	void Update(const std::vector<Sphere>& spheres);
+	//Same for the given lanes only
+	void Update(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& lanes);
+
+	void Clear();
+
+private:
+	void UpdateLane(const std::vector<Sphere>& spheres, uint32_t lane);
+};
+
+namespace SphereKernels {
+	//Tests the ray against packed lanes [first, first + count) and updates closestT/closestLane on a nearer hit
+	using IntersectFn = void(*)(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane);
+
+	void IntersectScalar(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane);
+	void IntersectSSE(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane);
+	void IntersectAVX2(const PackedSpheres& spheres, const Ray& ray, uint32_t first, uint32_t count, float& closestT, int& closestLane);
+
+	//Picks the widest kernel the CPU supports, checked once
+	IntersectFn Select();
+	const char* GetSelectedName();
+
+	//Spheres tested per instruction by the selected kernel
+	uint32_t GetSelectedWidth();
+}
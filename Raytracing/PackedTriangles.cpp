@@ -0,0 +1,236 @@
+#include "PackedTriangles.h"
+
+#include "PackedSpheres.h"
+
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define RT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#define RT_TARGET_AVX2
+	#else
+		#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#else
+	#define RT_X64 0
+#endif
+
+void PackedTriangles::Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& order)
+{
+	count = (uint32_t)order.size();
+	triangleIndex = order;
+
+	//Zero edges give a zero determinant, so padding lanes always miss
+	uint32_t paddedCount = count + Padding;
+	AlignedVector<float>* arrays[] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	for (AlignedVector<float>* array : arrays) {
+		array->assign(paddedCount, 0.0f);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t triangle = order[i];
+		const glm::vec3& p0 = positions[indices[triangle * 3 + 0]];
+		const glm::vec3& p1 = positions[indices[triangle * 3 + 1]];
+		const glm::vec3& p2 = positions[indices[triangle * 3 + 2]];
+
+		glm::vec3 e1 = p1 - p0;
+		glm::vec3 e2 = p2 - p0;
+
+		v0x[i] = p0.x; v0y[i] = p0.y; v0z[i] = p0.z;
+		e1x[i] = e1.x; e1y[i] = e1.y; e1z[i] = e1.z;
+		e2x[i] = e2.x; e2y[i] = e2.y; e2z[i] = e2.z;
+	}
+}
+
+void PackedTriangles::Clear()
+{
+	AlignedVector<float>* arrays[] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	for (AlignedVector<float>* array : arrays) {
+		array->clear();
+	}
+	triangleIndex.clear();
+	count = 0;
+}
+
+namespace TriangleKernels {
+
+	//Möller–Trumbore. Conditions are written as "inside" tests so NaNs from near-degenerate triangles reject
+	//the lane exactly as the SIMD compare masks do.
+	void IntersectScalar(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane)
+	{
+		const float dx = ray.direction.x, dy = ray.direction.y, dz = ray.direction.z;
+
+		for (uint32_t i = first; i < first + count; i++) {
+			float e1x = triangles.e1x[i], e1y = triangles.e1y[i], e1z = triangles.e1z[i];
+			float e2x = triangles.e2x[i], e2y = triangles.e2y[i], e2z = triangles.e2z[i];
+
+			float px = dy * e2z - dz * e2y;
+			float py = dz * e2x - dx * e2z;
+			float pz = dx * e2y - dy * e2x;
+			float det = e1x * px + e1y * py + e1z * pz;
+			if (!(det != 0.0f)) continue;
+
+			float invDet = 1.0f / det;
+			float tx = ray.origin.x - triangles.v0x[i];
+			float ty = ray.origin.y - triangles.v0y[i];
+			float tz = ray.origin.z - triangles.v0z[i];
+
+			float u = (tx * px + ty * py + tz * pz) * invDet;
+			if (!(u >= 0.0f && u <= 1.0f)) continue;
+
+			float qx = ty * e1z - tz * e1y;
+			float qy = tz * e1x - tx * e1z;
+			float qz = tx * e1y - ty * e1x;
+
+			float v = (dx * qx + dy * qy + dz * qz) * invDet;
+			if (!(v >= 0.0f && u + v <= 1.0f)) continue;
+
+			float t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+			if (t > tMin && t < closestT) {
+				closestT = t;
+				closestLane = (int)i;
+			}
+		}
+	}
+
+#if RT_X64
+	void IntersectSSE(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane)
+	{
+		const __m128 rox = _mm_set1_ps(ray.origin.x), roy = _mm_set1_ps(ray.origin.y), roz = _mm_set1_ps(ray.origin.z);
+		const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 minT = _mm_set1_ps(tMin);
+		const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+		for (uint32_t i = first; i < first + count; i += 4) {
+			__m128 e1x = _mm_loadu_ps(&triangles.e1x[i]), e1y = _mm_loadu_ps(&triangles.e1y[i]), e1z = _mm_loadu_ps(&triangles.e1z[i]);
+			__m128 e2x = _mm_loadu_ps(&triangles.e2x[i]), e2y = _mm_loadu_ps(&triangles.e2y[i]), e2z = _mm_loadu_ps(&triangles.e2z[i]);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 hitMask = _mm_cmpneq_ps(det, zero);
+
+			__m128 invDet = _mm_div_ps(one, det);
+			__m128 tx = _mm_sub_ps(rox, _mm_loadu_ps(&triangles.v0x[i]));
+			__m128 ty = _mm_sub_ps(roy, _mm_loadu_ps(&triangles.v0y[i]));
+			__m128 tz = _mm_sub_ps(roz, _mm_loadu_ps(&triangles.v0z[i]));
+
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+			hitMask = _mm_and_ps(hitMask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+			if (_mm_movemask_ps(hitMask) == 0) continue;
+
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			hitMask = _mm_and_ps(hitMask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+			hitMask = _mm_and_ps(hitMask, _mm_and_ps(_mm_cmpgt_ps(t, minT), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+
+			int mask = _mm_movemask_ps(hitMask);
+			if (mask == 0) continue;
+
+			//Horizontal min, then the first lane holding it
+			t = _mm_or_ps(_mm_and_ps(hitMask, t), _mm_andnot_ps(hitMask, inf));
+			__m128 m = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+			m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			int lane = 0;
+			int minMask = _mm_movemask_ps(_mm_cmpeq_ps(t, m)) & mask;
+			while (!(minMask & (1 << lane))) lane++;
+
+			closestT = _mm_cvtss_f32(m);
+			closestLane = (int)i + lane;
+		}
+	}
+
+	RT_TARGET_AVX2 void IntersectAVX2(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane)
+	{
+		const __m256 rox = _mm256_set1_ps(ray.origin.x), roy = _mm256_set1_ps(ray.origin.y), roz = _mm256_set1_ps(ray.origin.z);
+		const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 minT = _mm256_set1_ps(tMin);
+		const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+
+		for (uint32_t i = first; i < first + count; i += 8) {
+			__m256 e1x = _mm256_loadu_ps(&triangles.e1x[i]), e1y = _mm256_loadu_ps(&triangles.e1y[i]), e1z = _mm256_loadu_ps(&triangles.e1z[i]);
+			__m256 e2x = _mm256_loadu_ps(&triangles.e2x[i]), e2y = _mm256_loadu_ps(&triangles.e2y[i]), e2z = _mm256_loadu_ps(&triangles.e2z[i]);
+
+			//Separate mul/add rather than FMA keeps results identical to the scalar kernel
+			__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+			__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+			__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+			__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+			__m256 hitMask = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+
+			__m256 invDet = _mm256_div_ps(one, det);
+			__m256 tx = _mm256_sub_ps(rox, _mm256_loadu_ps(&triangles.v0x[i]));
+			__m256 ty = _mm256_sub_ps(roy, _mm256_loadu_ps(&triangles.v0y[i]));
+			__m256 tz = _mm256_sub_ps(roz, _mm256_loadu_ps(&triangles.v0z[i]));
+
+			__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+			hitMask = _mm256_and_ps(hitMask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+			if (_mm256_movemask_ps(hitMask) == 0) continue;
+
+			__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+			__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+			__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+			__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+			__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+			hitMask = _mm256_and_ps(hitMask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+			hitMask = _mm256_and_ps(hitMask, _mm256_and_ps(_mm256_cmp_ps(t, minT, _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)));
+
+			int mask = _mm256_movemask_ps(hitMask);
+			if (mask == 0) continue;
+
+			t = _mm256_blendv_ps(inf, t, hitMask);
+			__m256 m = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+			m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+			m = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 0x01));
+
+			int lane = 0;
+			int minMask = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)) & mask;
+			while (!(minMask & (1 << lane))) lane++;
+
+			closestT = _mm256_cvtss_f32(m);
+			closestLane = (int)i + lane;
+		}
+	}
+#else
+	void IntersectSSE(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane)
+	{
+		IntersectScalar(triangles, ray, first, count, tMin, closestT, closestLane);
+	}
+
+	void IntersectAVX2(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane)
+	{
+		IntersectScalar(triangles, ray, first, count, tMin, closestT, closestLane);
+	}
+#endif
+
+	IntersectFn Select()
+	{
+		static const IntersectFn selected = [] {
+			switch (SphereKernels::GetSelectedWidth()) {
+			case 8: return IntersectAVX2;
+			case 4: return IntersectSSE;
+			default: return IntersectScalar;
+			}
+		}();
+		return selected;
+	}
+
+	uint32_t GetSelectedWidth()
+	{
+		return SphereKernels::GetSelectedWidth();
+	}
+}
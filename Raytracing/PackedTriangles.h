@@ -0,0 +1,42 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "Ray.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+//Structure-of-arrays copy of a mesh's triangles in BVH leaf order, stored as one vertex and two edges
+//so Möller–Trumbore needs no subtraction per test. Padded with degenerate triangles that can never be hit.
+struct PackedTriangles {
+	static constexpr uint32_t Padding = 8;
+
+	AlignedVector<float> v0x, v0y, v0z;
+	AlignedVector<float> e1x, e1y, e1z;
+	AlignedVector<float> e2x, e2y, e2z;
+
+	//Index of the triangle in the mesh's index buffer for each packed lane
+	std::vector<uint32_t> triangleIndex;
+
+	uint32_t count = 0;
+
+	void Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& order);
+
+	void Clear();
+};
+
+namespace TriangleKernels {
+	//Tests the ray against packed lanes [first, first + count), both faces, and updates closestT/closestLane on a hit
+	//with tMin < t < closestT. Every kernel agrees bit for bit.
+	using IntersectFn = void(*)(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane);
+
+	void IntersectScalar(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane);
+	void IntersectSSE(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane);
+	void IntersectAVX2(const PackedTriangles& triangles, const Ray& ray, uint32_t first, uint32_t count, float tMin, float& closestT, int& closestLane);
+
+	//Same CPU check and width as SphereKernels::Select
+	IntersectFn Select();
+	uint32_t GetSelectedWidth();
+}
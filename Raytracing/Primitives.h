@@ -0,0 +1,140 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "Hittable.h"
+#include "Ray.h"
+
+//Every primitive type kept in a homogeneous Scene array provides
+//	bool Intersect(const Ray& ray, float tMin, float& closestT, uint32_t& part) const
+//		shrinks closestT on a hit with tMin < t < closestT, part says which piece was hit (a mesh's triangle)
+//	void FillPayload(const Ray& ray, float t, uint32_t part, HitPayload& payload) const
+//		only called for the nearest hit, the normal must face the ray. ObjectIndex arrives set to the element's
+//		index in its array and may be replaced by something more specific.
+//and is listed in ScenePrimitives, so the intersection loops are resolved at compile time and can be inlined.
+
+//Infinite two-sided plane of points p with dot(normal, p) == offset
+struct Plane {
+	glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	float offset = 0.0f;
+
+	int materialIndex = 0;
+
+	bool Intersect(const Ray& ray, float tMin, float& closestT, uint32_t& part) const {
+		float denominator = glm::dot(normal, ray.direction);
+		if (denominator == 0.0f) return false;
+
+		float t = (offset - glm::dot(normal, ray.origin)) / denominator;
+		if (!(t > tMin && t < closestT)) return false;
+
+		closestT = t;
+		part = 0;
+		return true;
+	}
+
+	void FillPayload(const Ray& ray, float t, uint32_t /*part*/, HitPayload& payload) const {
+		glm::vec3 n = glm::normalize(normal);
+
+		payload.HitDistance = t;
+		payload.WorldPosition = ray.origin + ray.direction * t;
+		payload.WorldNormal = glm::dot(n, ray.direction) > 0.0f ? -n : n;
+		payload.MaterialIndex = materialIndex;
+	}
+};
+
+//Axis-aligned solid box, rays starting inside hit the far side
+struct Box {
+	glm::vec3 min = glm::vec3(-0.5f);
+	glm::vec3 max = glm::vec3(0.5f);
+
+	int materialIndex = 0;
+
+	bool Intersect(const Ray& ray, float tMin, float& closestT, uint32_t& part) const {
+		glm::vec3 invDirection = 1.0f / ray.direction;
+		glm::vec3 t0 = (min - ray.origin) * invDirection;
+		glm::vec3 t1 = (max - ray.origin) * invDirection;
+
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+
+		float tEnter = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+		float tExit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+		if (tExit < tEnter) return false;
+
+		float t = tEnter > tMin ? tEnter : tExit;
+		if (!(t > tMin && t < closestT)) return false;
+
+		closestT = t;
+		part = 0;
+		return true;
+	}
+
+	void FillPayload(const Ray& ray, float t, uint32_t /*part*/, HitPayload& payload) const {
+		glm::vec3 position = ray.origin + ray.direction * t;
+
+		//The face hit is the axis where the point lies furthest out relative to the box's half size
+		glm::vec3 local = (position - (min + max) * 0.5f) / glm::max((max - min) * 0.5f, glm::vec3(1e-6f));
+		glm::vec3 distance = glm::abs(local);
+		int axis = distance.x > distance.y ? (distance.x > distance.z ? 0 : 2) : (distance.y > distance.z ? 1 : 2);
+
+		glm::vec3 normal(0.0f);
+		normal[axis] = local[axis] > 0.0f ? 1.0f : -1.0f;
+
+		payload.HitDistance = t;
+		payload.WorldPosition = position;
+		payload.WorldNormal = glm::dot(normal, ray.direction) > 0.0f ? -normal : normal;
+		payload.MaterialIndex = materialIndex;
+	}
+};
+
+//Which registered array the nearest hit came from, type is -1 when nothing was hit
+struct PrimitiveHit {
+	int type = -1;
+	uint32_t index = 0;
+	uint32_t part = 0;
+};
+
+//Statically dispatched intersection over the Scene arrays given as pointers to members.
+//Each array gets its own loop over a concrete type, there are no indirect calls per primitive.
+template<typename SceneType, auto... Arrays>
+struct PrimitiveRegistry {
+	static constexpr int TypeCount = sizeof...(Arrays);
+
+	static void Intersect(const SceneType& scene, const Ray& ray, float tMin, float& closestT, PrimitiveHit& hit) {
+		int type = 0;
+		(IntersectArray(scene.*Arrays, type++, ray, tMin, closestT, hit), ...);
+	}
+
+	static void FillPayload(const SceneType& scene, const Ray& ray, float t, const PrimitiveHit& hit, HitPayload& payload) {
+		payload.ObjectIndex = hit.index;
+		payload.InstanceIndex = -1;
+
+		int type = 0;
+		((type++ == hit.type ? (scene.*Arrays)[hit.index].FillPayload(ray, t, hit.part, payload) : void()), ...);
+	}
+
+	static int GetMaterialIndex(const SceneType& scene, const PrimitiveHit& hit) {
+		int materialIndex = 0;
+		int type = 0;
+		((type++ == hit.type ? (void)(materialIndex = (scene.*Arrays)[hit.index].materialIndex) : void()), ...);
+		return materialIndex;
+	}
+
+	static size_t GetCount(const SceneType& scene) {
+		return (size_t(0) + ... + (scene.*Arrays).size());
+	}
+
+private:
+	template<typename T>
+	static void IntersectArray(const std::vector<T>& primitives, int type, const Ray& ray, float tMin, float& closestT, PrimitiveHit& hit) {
+		for (uint32_t i = 0; i < (uint32_t)primitives.size(); i++) {
+			uint32_t part = 0;
+			if (primitives[i].Intersect(ray, tMin, closestT, part)) {
+				hit = { type, i, part };
+			}
+		}
+	}
+};
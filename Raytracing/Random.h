@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+//Counter-based PCG generator. Each pixel seeds its own instance from (pixel index, frame index, seed), so a sample
+//is the same whichever thread renders it and workers share no state. Plain integer math with no tables or
+//branches, so loops over several generators vectorize.
+class Random
+{
+public:
+	explicit Random(uint32_t state) : _state(state) {}
+
+	static Random ForPixel(uint32_t pixelIndex, uint32_t frameIndex, uint32_t seed) {
+		return Random(Hash(pixelIndex ^ Hash(frameIndex ^ Hash(seed))));
+	}
+
+	//PCG-RXS-M-XS permutation, also a good stateless hash
+	static uint32_t Hash(uint32_t input) {
+		uint32_t state = input * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	uint32_t UInt() {
+		_state = Hash(_state);
+		return _state;
+	}
+
+	//Uniform in [0, 1)
+	float Float() {
+		return (float)(UInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	glm::vec3 Vec3(float min, float max) {
+		float x = Float(), y = Float(), z = Float();
+		return glm::vec3(x, y, z) * (max - min) + min;
+	}
+
+	//Uniform direction on the unit sphere
+	glm::vec3 UnitVector() {
+		float z = Float() * 2.0f - 1.0f;
+		float phi = Float() * 6.28318530718f;
+		float r = glm::sqrt(glm::max(0.0f, 1.0f - z * z));
+		return glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+	}
+
+	//Cosine-weighted direction in the hemisphere around normal
+	glm::vec3 CosineHemisphere(const glm::vec3& normal) {
+		glm::vec3 direction = normal + UnitVector();
+		float length2 = glm::dot(direction, direction);
+		return length2 > 1e-8f ? direction / glm::sqrt(length2) : normal;
+	}
+
+	uint32_t GetState() const { return _state; }
+
+private:
+	uint32_t _state;
+};
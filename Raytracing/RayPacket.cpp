@@ -0,0 +1,200 @@
+#include "RayPacket.h"
+
+#include "BVH.h"
+#include "PackedSpheres.h"
+
+#include <cfloat>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define RT_X64 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#define RT_TARGET_AVX2
+	#else
+		#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#else
+	#define RT_X64 0
+#endif
+
+namespace PacketKernels {
+
+	static void TracePacketScalar(const BVH& bvh, const PackedSpheres& spheres, RayPacket& packet)
+	{
+		SphereKernels::IntersectFn intersect = SphereKernels::Select();
+
+		for (uint32_t lane = 0; lane < RayPacket::Size; lane++) {
+			packet.closestT[lane] = FLT_MAX;
+			packet.closestLane[lane] = -1;
+
+			if (!(packet.activeMask & (1u << lane))) continue;
+
+			Ray ray;
+			ray.origin = packet.origin;
+			ray.direction = glm::vec3(packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane]);
+
+			float& closestT = packet.closestT[lane];
+			int& closestLane = packet.closestLane[lane];
+			bvh.Traverse(ray, closestT, [&](uint32_t first, uint32_t count) {
+				intersect(spheres, ray, first, count, closestT, closestLane);
+			});
+		}
+	}
+
+#if RT_X64
+	//Tests every lane against one node. Returns the lanes that enter it and the nearest entry distance among them.
+	RT_TARGET_AVX2 static inline int IntersectNode(const BVHNode& node, const glm::vec3& origin, __m256 invX, __m256 invY, __m256 invZ, __m256 closestT, int activeMask, float& nearestEntry)
+	{
+		__m256 tx0 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMin.x - origin.x), invX);
+		__m256 tx1 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMax.x - origin.x), invX);
+		__m256 ty0 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMin.y - origin.y), invY);
+		__m256 ty1 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMax.y - origin.y), invY);
+		__m256 tz0 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMin.z - origin.z), invZ);
+		__m256 tz1 = _mm256_mul_ps(_mm256_set1_ps(node.boundsMax.z - origin.z), invZ);
+
+		__m256 tEnter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_min_ps(tz0, tz1));
+		__m256 tExit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(tExit, tEnter, _CMP_GE_OQ), _mm256_cmp_ps(tEnter, closestT, _CMP_LT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(tExit, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+		int mask = _mm256_movemask_ps(hit) & activeMask;
+		if (mask == 0) return 0;
+
+		alignas(32) float entries[RayPacket::Size];
+		_mm256_store_ps(entries, tEnter);
+
+		nearestEntry = FLT_MAX;
+		for (uint32_t lane = 0; lane < RayPacket::Size; lane++) {
+			if ((mask & (1 << lane)) && entries[lane] < nearestEntry) nearestEntry = entries[lane];
+		}
+
+		return mask;
+	}
+
+	//One sphere against all eight rays. The origin is shared, so everything but the dot with the direction is scalar.
+	RT_TARGET_AVX2 static inline void IntersectSphere(const PackedSpheres& spheres, uint32_t i, const glm::vec3& origin, __m256 dx, __m256 dy, __m256 dz, __m256 a, __m256& closestT, __m256i& closestLane, int activeMask)
+	{
+		float ox = origin.x - spheres.x[i];
+		float oy = origin.y - spheres.y[i];
+		float oz = origin.z - spheres.z[i];
+		float c = (ox * ox + oy * oy + oz * oz) - spheres.radius2[i];
+
+		__m256 halfB = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ox), dx), _mm256_mul_ps(_mm256_set1_ps(oy), dy)), _mm256_mul_ps(_mm256_set1_ps(oz), dz));
+		__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(halfB, halfB), _mm256_mul_ps(a, _mm256_set1_ps(c)));
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 hitMask = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+		if ((_mm256_movemask_ps(hitMask) & activeMask) == 0) return;
+
+		__m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, halfB), _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero))), a);
+		hitMask = _mm256_and_ps(hitMask, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, closestT, _CMP_LT_OQ)));
+
+		closestT = _mm256_blendv_ps(closestT, t, hitMask);
+		closestLane = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(closestLane), _mm256_castsi256_ps(_mm256_set1_epi32((int)i)), hitMask));
+	}
+
+	//The packet can skip a node only once every lane has a hit nearer than the node's entry
+	RT_TARGET_AVX2 static inline float FarthestClosest(__m256 closestT, int activeMask)
+	{
+		alignas(32) float values[RayPacket::Size];
+		_mm256_store_ps(values, closestT);
+
+		float farthest = 0.0f;
+		for (uint32_t lane = 0; lane < RayPacket::Size; lane++) {
+			if ((activeMask & (1 << lane)) && values[lane] > farthest) farthest = values[lane];
+		}
+		return farthest;
+	}
+
+	RT_TARGET_AVX2 static void TracePacketAVX2(const BVH& bvh, const PackedSpheres& spheres, RayPacket& packet)
+	{
+		const std::vector<BVHNode>& nodes = bvh.GetNodes();
+		const int activeMask = (int)packet.activeMask;
+
+		__m256 dx = _mm256_load_ps(packet.directionX);
+		__m256 dy = _mm256_load_ps(packet.directionY);
+		__m256 dz = _mm256_load_ps(packet.directionZ);
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 invX = _mm256_div_ps(one, dx);
+		__m256 invY = _mm256_div_ps(one, dy);
+		__m256 invZ = _mm256_div_ps(one, dz);
+		__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+		__m256 closestT = _mm256_set1_ps(FLT_MAX);
+		__m256i closestLane = _mm256_set1_epi32(-1);
+
+		uint32_t stack[BVH::MaxDepth];
+		float stackT[BVH::MaxDepth];
+		uint32_t stackSize = 0;
+
+		float entry;
+		if (!nodes.empty() && IntersectNode(nodes[0], packet.origin, invX, invY, invZ, closestT, activeMask, entry)) {
+			const BVHNode* node = &nodes[0];
+
+			while (true) {
+				if (node->IsLeaf()) {
+					for (uint32_t i = node->leftFirst; i < node->leftFirst + node->count; i++) {
+						IntersectSphere(spheres, i, packet.origin, dx, dy, dz, a, closestT, closestLane, activeMask);
+					}
+				}
+				else {
+					uint32_t nearIndex = node->leftFirst;
+					uint32_t farIndex = node->leftFirst + 1;
+
+					float nearT = FLT_MAX, farT = FLT_MAX;
+					int nearMask = IntersectNode(nodes[nearIndex], packet.origin, invX, invY, invZ, closestT, activeMask, nearT);
+					int farMask = IntersectNode(nodes[farIndex], packet.origin, invX, invY, invZ, closestT, activeMask, farT);
+
+					if (!nearMask) nearT = FLT_MAX;
+					if (!farMask) farT = FLT_MAX;
+
+					if (nearT > farT) {
+						std::swap(nearT, farT);
+						std::swap(nearIndex, farIndex);
+					}
+
+					if (nearT != FLT_MAX) {
+						if (farT != FLT_MAX) {
+							stack[stackSize] = farIndex;
+							stackT[stackSize] = farT;
+							stackSize++;
+						}
+
+						node = &nodes[nearIndex];
+						continue;
+					}
+				}
+
+				float farthest = FarthestClosest(closestT, activeMask);
+				bool popped = false;
+				while (stackSize > 0) {
+					stackSize--;
+					if (stackT[stackSize] < farthest) {
+						node = &nodes[stack[stackSize]];
+						popped = true;
+						break;
+					}
+				}
+
+				if (!popped) break;
+			}
+		}
+
+		_mm256_store_ps(packet.closestT, closestT);
+		_mm256_store_si256((__m256i*)packet.closestLane, closestLane);
+	}
+#endif
+
+	void TracePacket(const BVH& bvh, const PackedSpheres& spheres, RayPacket& packet)
+	{
+	#if RT_X64
+		if (SphereKernels::GetSelectedWidth() == 8) {
+			TracePacketAVX2(bvh, spheres, packet);
+			return;
+		}
+	#endif
+
+		TracePacketScalar(bvh, spheres, packet);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+class BVH;
+struct PackedSpheres;
+
+//Eight coherent rays from one origin, stored structure-of-arrays so one register holds a component of every ray.
+//Used for primary rays where every lane starts at the camera position.
+struct RayPacket {
+	static constexpr uint32_t Size = 8;
+
+	glm::vec3 origin{ 0.0f };
+
+	alignas(32) float directionX[Size];
+	alignas(32) float directionY[Size];
+	alignas(32) float directionZ[Size];
+
+	//Out: nearest hit distance, FLT_MAX on a miss
+	alignas(32) float closestT[Size];
+	//Out: PackedSpheres lane that was hit, -1 on a miss
+	alignas(32) int closestLane[Size];
+
+	//Bit per lane holding a real ray, packets at the image edge are partially filled
+	uint32_t activeMask = 0;
+};
+
+namespace PacketKernels {
+	//Traverses the BVH once for the whole packet. Falls back to tracing lanes one at a time without AVX2.
+	void TracePacket(const BVH& bvh, const PackedSpheres& spheres, RayPacket& packet);
+}
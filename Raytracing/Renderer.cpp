@@ -1,42 +1,154 @@
 #include "Renderer.h"
-#include <Walnut/Random.h>
 
+#include "BSDF.h"
 #include "Camera.h"
+#include "RayPacket.h"
 
 #include <glm/gtx/norm.hpp>
 
-#include <execution>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
 
 #include <iostream>
 
-//Before any changes 50ms
-
 namespace Utils {
-	static uint32_t ConvertToRGBA(const glm::vec4& color) {
-		uint8_t r = (uint8_t)(color.r * 255.0f);
-		uint8_t g = (uint8_t)(color.g * 255.0f);
-		uint8_t b = (uint8_t)(color.b * 255.0f);
-		uint8_t a = (uint8_t)(color.a * 255.0f);
+	static float Luminance(const glm::vec4& color) {
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
 
-		uint32_t result = (a << 24) | (b << 16) | (g << 8) | r;
+	//Solid angle of the cone a sphere covers seen from point, as 1 - cos of its half angle.
+	//Written through the squared sine so tiny distant spheres do not cancel to zero.
+	static float SphereConeWidth(const glm::vec3& point, const Sphere& sphere, float& distance2) {
+		glm::vec3 toCenter = sphere.pos - point;
+		distance2 = glm::dot(toCenter, toCenter);
 
-		return result;
+		float sin2 = sphere.radius * sphere.radius / distance2;
+		return sin2 / (1.0f + glm::sqrt(glm::max(0.0f, 1.0f - sin2)));
 	}
-}
 
-void Renderer::OnResize(uint32_t width, uint32_t height)
-{
-	if (!_finalImage) {
-		_finalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+	//Density of SampleSphereCone per unit solid angle, 0 from inside the sphere
+	static float SphereConePdf(const glm::vec3& point, const Sphere& sphere) {
+		float distance2;
+		float width = SphereConeWidth(point, sphere, distance2);
+		if (distance2 <= sphere.radius * sphere.radius) return 0.0f;
+
+		return 1.0f / (6.28318530718f * width);
 	}
-	else {
-		if (_finalImage->GetWidth() == width && _finalImage->GetHeight() == height) {
-			return;
+
+	//Uniform direction within the cone the sphere covers, false when point is inside it
+	static bool SampleSphereCone(const glm::vec3& point, const Sphere& sphere, Random& random, glm::vec3& direction, float& pdf) {
+		float distance2;
+		float width = SphereConeWidth(point, sphere, distance2);
+		if (distance2 <= sphere.radius * sphere.radius) return false;
+
+		float oneMinusCos = random.Float() * width;
+		float cosTheta = 1.0f - oneMinusCos;
+		float sinTheta = glm::sqrt(glm::max(0.0f, oneMinusCos * (2.0f - oneMinusCos)));
+		float phi = random.Float() * 6.28318530718f;
+
+		glm::vec3 axis = (sphere.pos - point) / glm::sqrt(distance2);
+		glm::vec3 tangent, bitangent;
+		BSDF::Basis(axis, tangent, bitangent);
+
+		direction = (tangent * glm::cos(phi) + bitangent * glm::sin(phi)) * sinTheta + axis * cosTheta;
+		pdf = 1.0f / (6.28318530718f * width);
+		return true;
+	}
+
+	//Radiance of every ray that leaves the scene
+	static glm::vec3 SkyColor() {
+		return glm::vec3(0.6f, 0.7f, 0.9f);
+	}
+
+	//Multiple importance sampling weight of the technique with density pdf against the other one
+	static float PowerHeuristic(float pdf, float otherPdf) {
+		float a = pdf * pdf, b = otherPdf * otherPdf;
+		return a > 0.0f ? a / (a + b) : 0.0f;
+	}
+
+	//Spreads the low 16 bits of v out to the even bits, for Morton order
+	static uint64_t InterleaveBits(uint32_t v) {
+		uint64_t x = v & 0xffff;
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	//Returns the nearest intersection distance, negative when the ray misses
+	static float IntersectSphere(const Ray& ray, const Sphere& sphere) {
+		//Raytrace equation
+		// A = ray origin
+		// B = ray direction
+		// R = sphere radius
+		// T = hit distance
+		//(bx^2 + by^2 + bz^2)t^2 + (2(axbx + ayby + azbz))t + (ax^2 + ay^2  + az^2- r^2) = 0
+
+		//quadratic variables
+		glm::vec3 origin = ray.origin - sphere.pos;
+
+		float a = glm::length2(ray.direction);
+		float half_b = glm::dot(origin, ray.direction);
+		float c = glm::length2(origin) - sphere.radius * sphere.radius;
+		float discriminant = half_b * half_b - a * c;
+
+		//less than zero is a miss
+		if (discriminant < 0.0f) {
+			return -1.0f;
 		}
 
-		_finalImage->Resize(width, height);
+		//Gets the t which will always be closest to the camera
+		return (-half_b - glm::sqrt(discriminant)) / a;
+	}
+
+	//Start of a SaveState buffer, followed by the whole image as ReadRegion lays it out and then the tile states
+	struct StateHeader {
+		char Magic[4];
+		uint32_t Version;
+		uint32_t Width, Height;
+		uint32_t FrameIndex;
+		uint32_t Seed;
+		uint32_t ReprojectionCount;
+		uint32_t TileSize;
+		uint32_t TileOrdering;
+		uint32_t TileCount;
+		glm::mat4 View;
+		glm::mat4 Projection;
+		glm::vec3 CameraPosition;
+
+		//What decides the value of every sample, a state only loads where the same samples would be drawn
+		uint64_t SceneHash;
+		uint32_t Bounces;
+		uint32_t PathIntegrator;
+		uint32_t RussianRoulette;
+		uint32_t RussianRouletteDepth;
+		uint32_t AdaptiveSampling;
+		float NoiseThreshold;
+		uint32_t AdaptiveMinSamples;
+		uint32_t AdaptiveMaxSamplesPerFrame;
+		glm::vec3 LightDirection;
+		glm::vec3 LightIrradiance;
+	};
+
+	static constexpr char StateMagic[4] = { 'R', 'T', 'S', 'T' };
+	//Version 2 added the scene hash and sample settings
+	static constexpr uint32_t StateVersion = 2;
+
+	//Tile states are stored as converged flag and error
+	static constexpr size_t StateTileSize = sizeof(uint32_t) + sizeof(float);
+}
+
+void Renderer::OnResize(uint32_t width, uint32_t height)
+{
+	if (_imageData && _width == width && _height == height) {
+		return;
 	}
 
+	_width = width;
+	_height = height;
 
 	delete[] _imageData;
 	_imageData = new uint32_t[width * height];
@@ -44,66 +156,217 @@ void Renderer::OnResize(uint32_t width, uint32_t height)
 	delete[] _accumulationData;
 	_accumulationData = new glm::vec4[width * height];
 
-	_imageHorizontalIterator.resize(width);
-	_imageVerticalIterator.resize(height);
+	delete[] _sampleCountData;
+	_sampleCountData = new uint32_t[width * height];
 
-	for (uint32_t i = 0; i < width; ++i) {
-		_imageHorizontalIterator[i] = i;
-	}
+	delete[] _luminanceSquaredData;
+	_luminanceSquaredData = new float[width * height];
 
-	for (uint32_t i = 0; i < height; ++i) {
-		_imageVerticalIterator[i] = i;
-	}
+	delete[] _albedoData;
+	_albedoData = new glm::vec3[width * height];
+
+	delete[] _normalData;
+	_normalData = new glm::vec3[width * height];
+
+	delete[] _depthData;
+	_depthData = new float[width * height];
+
+	delete[] _denoisedData;
+	_denoisedData = new glm::vec4[width * height];
+
+	DeleteHistory();
+
+	_frameIndex = 1;
+
+	RebuildTiles();
+}
+
+Renderer::~Renderer()
+{
+	delete[] _imageData;
+	delete[] _accumulationData;
+	delete[] _sampleCountData;
+	delete[] _luminanceSquaredData;
+	delete[] _albedoData;
+	delete[] _normalData;
+	delete[] _depthData;
+	delete[] _denoisedData;
+
+	DeleteHistory();
 }
 
 void Renderer::Render(const Scene& scene, const Camera& camera)
 {
+	auto frameStart = std::chrono::steady_clock::now();
+
 	_activeScene = &scene;
 	_activeCamera = &camera;
 
-	const glm::vec3& rayOrigin = camera.GetPosition();
+	_threadPool.SetThreadCount(_settings.ThreadCount);
+	_hitBuffers.resize(_threadPool.GetThreadCount());
 
-	if (_frameIndex == 1) {
-		memset(_accumulationData, 0, _finalImage->GetWidth() * _finalImage->GetHeight() * sizeof(glm::vec4));
+	const Tile& region = _settings.Region;
+	if (_settings.TileSize != _tileSize || _settings.TileOrdering != _tileOrder
+		|| region.minX != _tileRegion.minX || region.minY != _tileRegion.minY || region.maxX != _tileRegion.maxX || region.maxY != _tileRegion.maxY) {
+		RebuildTiles();
 	}
 
-#define MT 1
+	//Only the edits of the one generation since the last frame are known, anything else starts over
+	bool sceneChanged = &scene != _renderedScene || scene.generation != _sceneGeneration;
+	bool incremental = &scene == _renderedScene && scene.generation == _sceneGeneration + 1 && !scene.committedChanges.everything;
 
-#if MT
-	std::for_each(std::execution::par, _imageVerticalIterator.begin(), _imageVerticalIterator.end(), [this](uint32_t y)
-		{
-			std::for_each(std::execution::par, _imageHorizontalIterator.begin(), _imageHorizontalIterator.end(), [this, y](uint32_t x)
+	if (sceneChanged && !incremental) {
+		ResetFrameIndex();
+	}
+
+	//History is carried into the new view first, so regions invalidated below are found in the view they are rendered in
+	bool cameraMoved = camera.GetView() != _renderedView || camera.GetProjection() != _renderedProjection;
+	_stats.ReprojectMs = 0.0f;
+
+	if (cameraMoved) {
+		//A moving camera reprojects every frame, when that does not fit the budget the preview takes over instead.
+		//Without history to carry over the accumulation, or the preview's scale, no longer applies either.
+		bool withinBudget = !_settings.ProgressivePreview || _fullFrameMs + _reprojectMs <= _settings.FrameBudgetMs;
+
+		if (_settings.TemporalReprojection && _frameIndex > 1 && withinBudget) {
+			auto reprojectStart = std::chrono::steady_clock::now();
+			ReprojectHistory();
+
+			_stats.ReprojectMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - reprojectStart).count();
+			_reprojectMs = _reprojectMs == 0.0f ? _stats.ReprojectMs : glm::mix(_reprojectMs, _stats.ReprojectMs, 0.25f);
+		}
+		else {
+			ResetFrameIndex();
+		}
+	}
+
+	_renderedView = camera.GetView();
+	_renderedProjection = camera.GetProjection();
+	_renderedCameraPosition = camera.GetPosition();
+
+	if (sceneChanged) {
+		if (incremental && _frameIndex > 1) {
+			InvalidateRegions(scene.committedChanges.regions);
+		}
+
+		_renderedScene = &scene;
+		_sceneGeneration = scene.generation;
+	}
+
+	if (_settings.ProgressivePreview && _frameIndex == 1 && _refineScale != 1) {
+		uint32_t scale = _refineScale == 0 ? ChoosePreviewScale() : _refineScale;
+
+		if (scale > 1) {
+			_rayCount = 0;
+
+			_threadPool.ParallelFor((uint32_t)_tiles.size(), [this, scale](uint32_t tileIndex, uint32_t)
 				{
-					glm::vec4 color = PerPixel(x, y);
-					_accumulationData[x + y * _finalImage->GetWidth()] += color;
+					uint32_t rayCount = 0;
+					RenderPreviewTile(_tiles[tileIndex], scale, rayCount);
+					_rayCount.fetch_add(rayCount, std::memory_order_relaxed);
+				}
+			);
+
+			//Accumulation has not started, the next frame refines unless the camera moves again
+			_refineScale = scale / 2;
+
+			_stats.ResolveMs = 0.0f;
+			if (_settings.Resolve) {
+				ResolveImage();
+			}
+
+			_stats.RayCount = _rayCount;
+			_stats.TileCount = (uint32_t)_tiles.size();
+			_stats.ConvergedTiles = 0;
+			_stats.PreviewScale = scale;
+			_stats.FrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+			return;
+		}
 
-					glm::vec4 accumulatedColor = _accumulationData[x + y * _finalImage->GetWidth()];
-					accumulatedColor /= (float)_frameIndex;
+		_refineScale = 1;
+	}
 
-					accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-					_imageData[x + y * _finalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
-				});
+	if (_frameIndex == 1) {
+		//Row by row, a small region of a large image should not pay for clearing all of it
+		Tile clear = GetRegion();
+		uint32_t rowWidth = clear.maxX - clear.minX;
+
+		for (uint32_t y = clear.minY; y < clear.maxY; y++) {
+			uint32_t first = clear.minX + y * _width;
+			memset(_accumulationData + first, 0, rowWidth * sizeof(glm::vec4));
+			memset(_sampleCountData + first, 0, rowWidth * sizeof(uint32_t));
+			memset(_luminanceSquaredData + first, 0, rowWidth * sizeof(float));
+			memset(_albedoData + first, 0, rowWidth * sizeof(glm::vec3));
+			memset(_normalData + first, 0, rowWidth * sizeof(glm::vec3));
+			memset(_depthData + first, 0, rowWidth * sizeof(float));
 		}
-	);
 
-#else
-	//Render every pixel
-	for (uint32_t y = 0; y < _finalImage->GetHeight(); y++) {
-		for (uint32_t x = 0; x < _finalImage->GetWidth(); x++) {
-			glm::vec4 color = PerPixel(x,y);
-			_accumulationData[x + y * _finalImage->GetWidth()] += color;
+		for (TileState& state : _tileStates) {
+			state = TileState();
+		}
+	}
 
-			glm::vec4 accumulatedColor = _accumulationData[x + y * _finalImage->GetWidth()];
-			accumulatedColor /= (float)_frameIndex;
+	const BVH& bvh = scene.sphereBVH;
+	bool packets = _settings.PacketTracing
+		&& bvh.GetPrimitiveCount() == scene.spheres.size() && scene.packedSpheres.count == scene.spheres.size();
+
+	//Converged tiles free up budget, so the remaining ones take more samples per frame at roughly the same frame cost
+	bool adaptive = _settings.AdaptiveSampling && _settings.Accumulate;
+	uint32_t samples = 1;
+	if (adaptive) {
+		uint32_t activeTiles = 0;
+		for (const TileState& state : _tileStates) {
+			activeTiles += state.Converged ? 0 : 1;
+		}
 
-			accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-			_imageData[x + y * _finalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
+		if (activeTiles > 0) {
+			samples = std::clamp((uint32_t)_tiles.size() / activeTiles, 1u, std::max(1u, _settings.AdaptiveMaxSamplesPerFrame));
 		}
 	}
 
-#endif
+	_rayCount = 0;
 
-	_finalImage->SetData(_imageData);
+	if (_settings.PathIntegrator == Integrator::Wavefront) {
+		RenderWavefront(adaptive, samples);
+	}
+	else {
+		_threadPool.ParallelFor((uint32_t)_tiles.size(), [this, packets, adaptive, samples](uint32_t tileIndex, uint32_t threadIndex)
+			{
+				TileState& state = _tileStates[tileIndex];
+				if (adaptive && state.Converged) return;
+
+				RenderTile(tileIndex, threadIndex, packets, samples);
+
+				if (adaptive) {
+					state.Error = EstimateTileError(_tiles[tileIndex]);
+					state.Converged = state.Error < _settings.NoiseThreshold;
+				}
+			}
+		);
+	}
+
+	_stats.RayCount = _rayCount;
+	_stats.TileCount = (uint32_t)_tiles.size();
+	_stats.ConvergedTiles = 0;
+	if (adaptive) {
+		for (const TileState& state : _tileStates) {
+			_stats.ConvergedTiles += state.Converged ? 1 : 0;
+		}
+	}
+
+	_stats.ResolveMs = 0.0f;
+	if (_settings.Resolve) {
+		ResolveImage();
+	}
+
+	_stats.PreviewScale = 1;
+	_stats.FrameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+
+	//Only frames that traced every tile once say anything about the full resolution cost, reprojection is tracked on its own
+	if (!adaptive || _stats.ConvergedTiles == 0) {
+		float frameMs = _stats.FrameMs - _stats.ReprojectMs;
+		_fullFrameMs = _fullFrameMs == 0.0f ? frameMs : glm::mix(_fullFrameMs, frameMs, 0.25f);
+	}
 
 	if (_settings.Accumulate) {
 		_frameIndex++;
@@ -113,25 +376,86 @@ void Renderer::Render(const Scene& scene, const Camera& camera)
 	}
 }
 
-HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex)
+HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex, int instanceIndex)
 {
-	const Sphere& closestSphere = _activeScene->spheres[objectIndex];
-
-
 	HitPayload payload;
 	payload.HitDistance = hitDistance;
 	payload.ObjectIndex = objectIndex;
+	payload.InstanceIndex = instanceIndex;
+
+	if (instanceIndex >= 0) {
+		const Instance& instance = _activeScene->instances[instanceIndex];
+		const Sphere& sphere = _activeScene->groups[instance.groupIndex].spheres[objectIndex];
+
+		//Normal in the group's space, then back to world space with the inverse transpose so scaling stays correct
+		payload.WorldPosition = ray.origin + ray.direction * hitDistance;
+		glm::vec3 localPosition = glm::vec3(instance.inverseTransform * glm::vec4(payload.WorldPosition, 1.0f));
+		glm::vec3 localNormal = localPosition - sphere.pos;
+		payload.WorldNormal = glm::normalize(glm::transpose(glm::mat3(instance.inverseTransform)) * localNormal);
+		payload.MaterialIndex = sphere.materialIndex;
+
+		return payload;
+	}
+
+	const Sphere& closestSphere = _activeScene->spheres[objectIndex];
+
 	glm::vec3 origin = ray.origin - closestSphere.pos;
 	payload.WorldPosition = origin + ray.direction * hitDistance;
 	payload.WorldNormal = glm::normalize(payload.WorldPosition);
 
 	payload.WorldPosition += closestSphere.pos;
+	payload.MaterialIndex = closestSphere.materialIndex;
 
 	//return glm::vec4(spherecolor);
 
 	return payload;
 }
 
+void Renderer::TraceInstances(const Ray& ray, float& closestT, int& objectIndex, int& instanceIndex)
+{
+	const std::vector<Instance>& instances = _activeScene->instances;
+	const BVH& instanceBVH = _activeScene->instanceBVH;
+
+	auto intersectInstance = [&](uint32_t index) {
+		const Instance& instance = instances[index];
+		if (instance.groupIndex >= _activeScene->groups.size()) return;
+
+		const SphereGroup& group = _activeScene->groups[instance.groupIndex];
+		if (!group.IsBuilt()) return;
+
+		//The direction is not renormalised, so distances along the local ray equal distances along the world ray
+		Ray localRay;
+		localRay.origin = glm::vec3(instance.inverseTransform * glm::vec4(ray.origin, 1.0f));
+		localRay.direction = glm::vec3(instance.inverseTransform * glm::vec4(ray.direction, 0.0f));
+
+		int closestLane = -1;
+		group.bvh.Traverse(localRay, closestT, [&](uint32_t first, uint32_t count) {
+			_intersectSpheres(group.packedSpheres, localRay, first, count, closestT, closestLane);
+		});
+
+		if (closestLane >= 0) {
+			objectIndex = (int)group.packedSpheres.sphereIndex[closestLane];
+			instanceIndex = (int)index;
+		}
+	};
+
+	if (instanceBVH.GetPrimitiveCount() == instances.size()) {
+		const std::vector<uint32_t>& order = instanceBVH.GetPrimitiveIndices();
+
+		instanceBVH.Traverse(ray, closestT, [&](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; i++) {
+				intersectInstance(order[i]);
+			}
+		});
+	}
+	else {
+		//Top level structure is stale, test every instance
+		for (uint32_t i = 0; i < instances.size(); i++) {
+			intersectInstance(i);
+		}
+	}
+}
+
 HitPayload Renderer::MissHit(const Ray& ray)
 {
 	HitPayload payload;
@@ -140,93 +464,1108 @@ HitPayload Renderer::MissHit(const Ray& ray)
 	return payload;
 }
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+void Renderer::AccumulatePixel(uint32_t x, uint32_t y, const glm::vec4& color, const PixelFeatures& features)
+{
+	uint32_t index = x + y * _width;
+
+	_accumulationData[index] += color;
+	_albedoData[index] += features.Albedo;
+	_normalData[index] += features.Normal;
+	_depthData[index] += features.Depth;
+
+	float luminance = Utils::Luminance(color);
+	_luminanceSquaredData[index] += luminance * luminance;
+	_sampleCountData[index]++;
+}
+
+void Renderer::ResolveImage()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	const glm::vec4* source = _accumulationData;
+	_stats.DenoiseMs = 0.0f;
+
+	if (_settings.Denoise) {
+		Denoiser::Input input;
+		input.Width = _width;
+		input.Height = _height;
+		input.Accumulation = _accumulationData;
+		input.SampleCounts = _sampleCountData;
+		input.LuminanceSquared = _luminanceSquaredData;
+		input.Albedo = _albedoData;
+		input.Normal = _normalData;
+		input.Depth = _depthData;
+
+		_denoiser.Denoise(input, _settings.DenoiseIterations, _settings.DenoiseLuminanceSigma, _settings.DenoiseDepthSigma, _denoisedData, _threadPool);
+		source = _denoisedData;
+
+		_stats.DenoiseMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//Bands of whole rows, so every job converts one contiguous run of pixels
+	const uint32_t bandHeight = 16;
+	uint32_t bandCount = (_height + bandHeight - 1) / bandHeight;
+
+	_threadPool.ParallelFor(bandCount, [this, bandHeight, source](uint32_t band, uint32_t)
+		{
+			uint32_t first = band * bandHeight * _width;
+			uint32_t count = (std::min(_height, (band + 1) * bandHeight) - band * bandHeight) * _width;
+
+			_resolve(source + first, _sampleCountData + first, _imageData + first, count, _settings.ToneMapping, _settings.SRGBEncode);
+		}
+	);
+
+	_stats.ResolveMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Renderer::RenderTile(uint32_t tileIndex, uint32_t threadIndex, bool packets, uint32_t samples)
+{
+	const Tile& tile = _tiles[tileIndex];
+	HitBuffer& buffer = _hitBuffers[threadIndex];
+	uint32_t rayCount = 0;
+
+	for (uint32_t sample = 0; sample < samples; sample++) {
+		IntersectTile(tile, packets, buffer);
+		ShadeTile(buffer, rayCount);
+	}
+
+	_rayCount.fetch_add(rayCount, std::memory_order_relaxed);
+}
+
+void Renderer::IntersectTile(const Tile& tile, bool packets, HitBuffer& buffer)
+{
+	buffer.Hits.clear();
+	buffer.Pixels.clear();
+	buffer.Directions.clear();
+
+	if (packets) {
+		uint32_t packetWidth = _settings.PacketLayout == PacketShape::Row8x1 ? 8 : 4;
+		uint32_t packetHeight = RayPacket::Size / packetWidth;
+
+		for (uint32_t y = tile.minY; y < tile.maxY; y += packetHeight) {
+			for (uint32_t x = tile.minX; x < tile.maxX; x += packetWidth) {
+				IntersectPacket(x, y, packetWidth, tile, buffer);
+			}
+		}
+		return;
+	}
+
+	Ray ray;
+	ray.origin = _activeCamera->GetPosition();
+
+	for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+		for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+			ray.direction = _activeCamera->GetRayDirection(x, y);
+
+			buffer.Hits.push_back(IntersectRay(ray));
+			buffer.Pixels.push_back(x + y * _width);
+			buffer.Directions.push_back(ray.direction);
+		}
+	}
+}
+
+void Renderer::ShadeTile(HitBuffer& buffer, uint32_t& rayCount)
 {
+	//Stable counting sort by material so hits sharing a material are shaded together, misses go in bucket 0
+	uint32_t hitCount = (uint32_t)buffer.Hits.size();
+	uint32_t materialCount = (uint32_t)_activeScene->materials.size();
+	buffer.MaterialOffsets.assign(materialCount + 2, 0);
+	buffer.Buckets.resize(hitCount);
+
+	for (uint32_t i = 0; i < hitCount; i++) {
+		const HitRecord& hit = buffer.Hits[i];
+		uint32_t bucket = hit.Type == HitRecord::Miss ? 0 : std::min((uint32_t)GetMaterialIndex(hit), materialCount) + 1;
+		buffer.Buckets[i] = bucket;
+		buffer.MaterialOffsets[bucket + 1]++;
+	}
+	for (uint32_t i = 1; i < buffer.MaterialOffsets.size(); i++) {
+		buffer.MaterialOffsets[i] += buffer.MaterialOffsets[i - 1];
+	}
+
+	buffer.Order.resize(hitCount);
+	for (uint32_t i = 0; i < hitCount; i++) {
+		buffer.Order[buffer.MaterialOffsets[buffer.Buckets[i]]++] = i;
+	}
+
 	Ray ray;
 	ray.origin = _activeCamera->GetPosition();
-	ray.direction = _activeCamera->GetRayDirections()[x + y * _finalImage->GetWidth()];
 
+	for (uint32_t i : buffer.Order) {
+		uint32_t pixel = buffer.Pixels[i];
+		uint32_t x = pixel % _width;
+		uint32_t y = pixel / _width;
+
+		ray.direction = buffer.Directions[i];
+		Random random = Random::ForPixel(pixel, _sampleCountData[pixel] + 1, GetSampleSeed());
+
+		rayCount++;
+		PixelFeatures features;
+		glm::vec4 color = TracePath(ray, buffer.Hits[i], random, features, rayCount);
+		AccumulatePixel(x, y, color, features);
+	}
+}
+
+void Renderer::RenderPreviewTile(const Tile& tile, uint32_t scale, uint32_t& rayCount)
+{
+	//Blocks are aligned to the image, so each belongs to exactly one tile even when scale exceeds the tile size
+	uint32_t startX = (tile.minX + scale - 1) / scale * scale;
+	uint32_t startY = (tile.minY + scale - 1) / scale * scale;
+
+	for (uint32_t y = startY; y < tile.maxY; y += scale) {
+		for (uint32_t x = startX; x < tile.maxX; x += scale) {
+			uint32_t sampleX = std::min(x + scale / 2, _width - 1);
+			uint32_t sampleY = std::min(y + scale / 2, _height - 1);
+
+			Ray ray;
+			ray.origin = _activeCamera->GetPosition();
+			ray.direction = _activeCamera->GetRayDirection(sampleX, sampleY);
+
+			Random random = Random::ForPixel(sampleX + sampleY * _width, 1, GetSampleSeed());
+			rayCount++;
+			PixelFeatures features;
+			glm::vec4 color = TracePath(ray, IntersectRay(ray), random, features, rayCount);
+
+			//Accumulation restarts on the first full resolution frame, so the preview can borrow the buffers
+			uint32_t endX = std::min(x + scale, _width);
+			uint32_t endY = std::min(y + scale, _height);
+			for (uint32_t by = y; by < endY; by++) {
+				for (uint32_t bx = x; bx < endX; bx++) {
+					uint32_t index = bx + by * _width;
+					_accumulationData[index] = color;
+					_sampleCountData[index] = 1;
+					_albedoData[index] = features.Albedo;
+					_normalData[index] = features.Normal;
+					_depthData[index] = features.Depth;
+				}
+			}
+		}
+	}
+}
+
+uint32_t Renderer::ChoosePreviewScale() const
+{
+	uint32_t maxScale = std::max(1u, _settings.PreviewMaxScale);
+	if (_fullFrameMs <= 0.0f) return maxScale;
+
+	//Cost scales with the number of traced pixels
+	uint32_t scale = 1;
+	while (scale < maxScale && _fullFrameMs / (float)(scale * scale) > _settings.FrameBudgetMs) {
+		scale *= 2;
+	}
+
+	return std::min(scale, maxScale);
+}
+
+float Renderer::EstimateTileError(const Tile& tile) const
+{
+	float maxError = 0.0f;
+
+	for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+		for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+			uint32_t index = x + y * _width;
+			uint32_t n = _sampleCountData[index];
+
+			//Too few samples for the variance estimate to mean anything
+			if (n < std::max(2u, _settings.AdaptiveMinSamples)) return FLT_MAX;
+
+			float mean = Utils::Luminance(_accumulationData[index]) / n;
+			float meanSquared = _luminanceSquaredData[index] / n;
+			float variance = glm::max(meanSquared - mean * mean, 0.0f) * n / (n - 1);
+
+			//Standard error of the mean, relative to brightness, with a floor so black pixels can converge
+			float error = glm::sqrt(variance / n) / (mean + 0.01f);
+			maxError = glm::max(maxError, error);
+		}
+	}
+
+	return maxError;
+}
+
+void Renderer::InvalidateRegions(const std::vector<AABB>& regions)
+{
+	glm::mat4 viewProjection = _activeCamera->GetProjection() * _activeCamera->GetView();
 
-	glm::vec3 color(0.0f);
+	std::vector<uint8_t> invalid(_width * _height, 0);
 
-	float multiplier = 1.0f;
+	for (const AABB& region : regions) {
+		if (region.min.x > region.max.x) continue;
 
-	int bounces = 5;
-	for (int i = 0; i < bounces; i++) {
-		HitPayload payload = TraceRay(ray);
-		if (payload.HitDistance < 0.0f) {
-			glm::vec3 skyColor = glm::vec3(0.6f, 0.7f, 0.9f);
-			color += skyColor * multiplier;
-			break;
+		//Screen rectangle around the eight projected corners, the whole screen when a corner is behind the camera
+		glm::vec2 minPixel(FLT_MAX), maxPixel(-FLT_MAX);
+		for (uint32_t corner = 0; corner < 8; corner++) {
+			glm::vec3 p(corner & 1 ? region.max.x : region.min.x, corner & 2 ? region.max.y : region.min.y, corner & 4 ? region.max.z : region.min.z);
+			glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+
+			if (clip.w <= 0.0f) {
+				minPixel = glm::vec2(0.0f);
+				maxPixel = glm::vec2((float)_width, (float)_height);
+				break;
+			}
+
+			glm::vec2 pixel = (glm::vec2(clip.x, clip.y) / clip.w * 0.5f + 0.5f) * glm::vec2((float)_width, (float)_height);
+			minPixel = glm::min(minPixel, pixel);
+			maxPixel = glm::max(maxPixel, pixel);
 		}
 
-		glm::vec3 lightDir = _lightDir;
+		//One pixel of margin for rays that pass between pixel centers
+		uint32_t minX = (uint32_t)glm::clamp(minPixel.x - 1.0f, 0.0f, (float)_width);
+		uint32_t minY = (uint32_t)glm::clamp(minPixel.y - 1.0f, 0.0f, (float)_height);
+		uint32_t maxX = (uint32_t)glm::clamp(maxPixel.x + 2.0f, 0.0f, (float)_width);
+		uint32_t maxY = (uint32_t)glm::clamp(maxPixel.y + 2.0f, 0.0f, (float)_height);
+
+		for (uint32_t y = minY; y < maxY; y++) {
+			memset(invalid.data() + y * _width + minX, 1, maxX - minX);
+		}
+	}
 
-		float d = glm::max(glm::dot(payload.WorldNormal, -lightDir), 0.0f); // == cos(angle)
+	uint32_t historyLimit = _settings.EditHistoryLimit;
 
-		const Sphere& sphere = _activeScene->spheres[payload.ObjectIndex];
+	_threadPool.ParallelFor((uint32_t)_tiles.size(), [&](uint32_t tileIndex, uint32_t)
+		{
+			const Tile& tile = _tiles[tileIndex];
+			bool touched = false;
+
+			for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+				for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+					uint32_t index = x + y * _width;
+
+					if (invalid[index]) {
+						_accumulationData[index] = glm::vec4(0.0f);
+						_sampleCountData[index] = 0;
+						_luminanceSquaredData[index] = 0.0f;
+						_albedoData[index] = glm::vec3(0.0f);
+						_normalData[index] = glm::vec3(0.0f);
+						_depthData[index] = 0.0f;
+						touched = true;
+					}
+					else if (historyLimit > 0 && _sampleCountData[index] > historyLimit) {
+						//Keeps the pixel's mean and its noise estimate, only their weight against new samples drops
+						float scale = (float)historyLimit / (float)_sampleCountData[index];
+						_accumulationData[index] *= scale;
+						_luminanceSquaredData[index] *= scale;
+						_albedoData[index] *= scale;
+						_normalData[index] *= scale;
+						_depthData[index] *= scale;
+						_sampleCountData[index] = historyLimit;
+						touched = true;
+					}
+				}
+			}
+
+			if (touched) {
+				_tileStates[tileIndex] = TileState();
+			}
+		}
+	);
+}
 
-		const Material& mat = _activeScene->materials[sphere.materialIndex];
+Renderer::PixelFeatures Renderer::GetFeatures(const Ray& ray, const HitPayload& payload) const
+{
+	PixelFeatures features;
 
-		glm::vec3 spherecolor = mat.albedo;
-		spherecolor *= d;
-		color += spherecolor * multiplier;
+	if (payload.HitDistance < 0.0f) {
+		features.Albedo = Utils::SkyColor();
+		return features;
+	}
 
-		multiplier *= 0.5f;
+	features.Albedo = _activeScene->materials[payload.MaterialIndex].albedo;
+	features.Normal = glm::dot(payload.WorldNormal, ray.direction) > 0.0f ? -payload.WorldNormal : payload.WorldNormal;
+	features.Depth = payload.HitDistance;
+	return features;
+}
 
-		ray.origin = payload.WorldPosition + payload.WorldNormal * 0.1f;
-		ray.direction = glm::reflect(ray.direction, 
-			payload.WorldNormal + mat.roughness * Walnut::Random::PseudoVec3(-0.5f,0.5f));
+void Renderer::ReprojectHistory()
+{
+	uint32_t pixelCount = _width * _height;
+
+	if (!_historyAccumulationData) {
+		_historyAccumulationData = new glm::vec4[pixelCount];
+		_historySampleCountData = new uint32_t[pixelCount];
+		_historyLuminanceSquaredData = new float[pixelCount];
+		_historyNormalData = new glm::vec3[pixelCount];
+		_historyDepthData = new float[pixelCount];
 	}
 
+	//The buffers of the previous view become the history, the current ones are written from scratch
+	std::swap(_accumulationData, _historyAccumulationData);
+	std::swap(_sampleCountData, _historySampleCountData);
+	std::swap(_luminanceSquaredData, _historyLuminanceSquaredData);
+	std::swap(_normalData, _historyNormalData);
+	std::swap(_depthData, _historyDepthData);
+
+	glm::mat4 previousViewProjection = _renderedProjection * _renderedView;
+	glm::mat4 previousInverseViewProjection = glm::inverse(previousViewProjection);
+	glm::vec3 previousPosition = _renderedCameraPosition;
+	uint32_t historyLimit = std::max(1u, _settings.TemporalHistoryLimit);
 
+	_threadPool.ParallelFor((uint32_t)_tiles.size(), [&](uint32_t tileIndex, uint32_t)
+		{
+			const Tile& tile = _tiles[tileIndex];
+
+			Ray ray;
+			ray.origin = _activeCamera->GetPosition();
+
+			for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+				for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+					uint32_t index = x + y * _width;
+
+					ray.direction = _activeCamera->GetRayDirection(x, y);
+					HitPayload payload = ReconstructHit(ray, IntersectRay(ray));
+					PixelFeatures features = GetFeatures(ray, payload);
+					bool sky = payload.HitDistance < 0.0f;
+
+					//Where the previous camera saw this pixel's primary hit, the sky only depends on the direction
+					glm::vec4 clip = previousViewProjection * (sky ? glm::vec4(ray.direction, 0.0f) : glm::vec4(payload.WorldPosition, 1.0f));
+					float distance = sky ? 0.0f : glm::distance(payload.WorldPosition, previousPosition);
+
+					glm::vec4 color(0.0f);
+					float luminanceSquared = 0.0f, count = 0.0f, weightSum = 0.0f;
+
+					if (clip.w > 0.0f) {
+						//Pixel x, y looks through x, y of this space, see Camera::RecalculateRayDirections
+						glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+						glm::vec2 position = (ndc * 0.5f + 0.5f) * glm::vec2((float)_width, (float)_height);
+						glm::vec2 corner = glm::floor(position);
+						glm::vec2 fraction = position - corner;
+
+						//Bilinear over the neighbouring history pixels that saw the same surface
+						for (uint32_t tap = 0; tap < 4; tap++) {
+							int32_t tapX = (int32_t)corner.x + (int32_t)(tap & 1);
+							int32_t tapY = (int32_t)corner.y + (int32_t)(tap >> 1);
+							if (tapX < 0 || tapY < 0 || tapX >= (int32_t)_width || tapY >= (int32_t)_height) continue;
+
+							uint32_t source = (uint32_t)tapX + (uint32_t)tapY * _width;
+							uint32_t n = _historySampleCountData[source];
+							if (n == 0) continue;
+
+							glm::vec3 historyNormal = _historyNormalData[source] / (float)n;
+
+							//Disocclusions and silhouettes: the history pixel saw a different surface, or sky where there is one now
+							if (sky != (historyNormal == glm::vec3(0.0f))) continue;
+
+							if (!sky) {
+								if (glm::dot(historyNormal, features.Normal) < 0.9f * glm::length(historyNormal)) continue;
+
+								//Distance from the surface's plane rather than along the ray, so grazing surfaces are not rejected
+								glm::vec4 far = previousInverseViewProjection * glm::vec4((float)tapX / _width * 2.0f - 1.0f, (float)tapY / _height * 2.0f - 1.0f, 1.0f, 1.0f);
+								glm::vec3 direction = glm::normalize(glm::vec3(far) / far.w - previousPosition);
+								glm::vec3 historyPosition = previousPosition + direction * (_historyDepthData[source] / (float)n);
+
+								if (glm::abs(glm::dot(historyPosition - payload.WorldPosition, features.Normal)) > 0.01f * distance) continue;
+							}
+
+							float weight = (tap & 1 ? fraction.x : 1.0f - fraction.x) * (tap & 2 ? fraction.y : 1.0f - fraction.y);
+							color += _historyAccumulationData[source] * (weight / (float)n);
+							luminanceSquared += _historyLuminanceSquaredData[source] * (weight / (float)n);
+							count += weight * (float)n;
+							weightSum += weight;
+						}
+					}
+
+					//Little weight only comes from taps at the far side of the footprint, too far off to trust
+					if (weightSum < 0.01f) {
+						_accumulationData[index] = glm::vec4(0.0f);
+						_sampleCountData[index] = 0;
+						_luminanceSquaredData[index] = 0.0f;
+						_albedoData[index] = glm::vec3(0.0f);
+						_normalData[index] = glm::vec3(0.0f);
+						_depthData[index] = 0.0f;
+						continue;
+					}
+
+					//Means of the history, weighted like historyLimit samples at most so new samples take over quickly
+					uint32_t n = std::clamp((uint32_t)(count / weightSum + 0.5f), 1u, historyLimit);
+					float scale = (float)n / weightSum;
+
+					_accumulationData[index] = color * scale;
+					_sampleCountData[index] = n;
+					_luminanceSquaredData[index] = luminanceSquared * scale;
+					_albedoData[index] = features.Albedo * (float)n;
+					_normalData[index] = features.Normal * (float)n;
+					_depthData[index] = features.Depth * (float)n;
+				}
+			}
+
+			_tileStates[tileIndex] = TileState();
+		}
+	);
 
-	return glm::vec4(color, 1.0f);
+	_reprojectionCount++;
 }
 
-HitPayload Renderer::TraceRay(const Ray& ray)
+void Renderer::DeleteHistory()
 {
-	//Raytrace equation
-	// A = ray origin
-	// B = ray direction
-	// R = sphere radius
-	// T = hit distance
-	//(bx^2 + by^2 + bz^2)t^2 + (2(axbx + ayby + azbz))t + (ax^2 + ay^2  + az^2- r^2) = 0
+	delete[] _historyAccumulationData;
+	delete[] _historySampleCountData;
+	delete[] _historyLuminanceSquaredData;
+	delete[] _historyNormalData;
+	delete[] _historyDepthData;
+
+	_historyAccumulationData = nullptr;
+	_historySampleCountData = nullptr;
+	_historyLuminanceSquaredData = nullptr;
+	_historyNormalData = nullptr;
+	_historyDepthData = nullptr;
+}
 
-	float lowestTDistance = std::numeric_limits<float>::max();
-	int closestIndex = -1;
+Renderer::Tile Renderer::GetRegion() const
+{
+	const Tile& region = _settings.Region;
+	if (region.maxX <= region.minX || region.maxY <= region.minY) {
+		return { 0, 0, _width, _height };
+	}
 
-	for (uint32_t i = 0; i < _activeScene->spheres.size(); i++) {
-		const Sphere& sphere = _activeScene->spheres[i];
+	return { std::min(region.minX, _width), std::min(region.minY, _height), std::min(region.maxX, _width), std::min(region.maxY, _height) };
+}
 
-		//quadratic variables
-		glm::vec3 origin = ray.origin - sphere.pos;
+void Renderer::ReadRegion(const Tile& region, std::vector<uint8_t>& data) const
+{
+	data.resize(GetRegionSize(region));
+	ReadRegion(region, data.data());
+}
 
-		float a = glm::length2(ray.direction);
-		float half_b = glm::dot(origin, ray.direction);
-		float c = glm::length2(origin) - sphere.radius * sphere.radius;
-		float discriminant = half_b * half_b - a * c;
+size_t Renderer::GetRegionSize(const Tile& region)
+{
+	size_t pixelSize = sizeof(glm::vec4) + sizeof(uint32_t) + sizeof(float) + 2 * sizeof(glm::vec3) + sizeof(float);
+	return (size_t)(region.maxX - region.minX) * (region.maxY - region.minY) * pixelSize;
+}
 
+void Renderer::ReadRegion(const Tile& region, uint8_t* out) const
+{
+	uint32_t rowWidth = region.maxX - region.minX;
 
-		//less than zero is black
-		if (discriminant < 0.0f) {
-			continue;
+	//Buffer after buffer, each one row by row
+	auto read = [&](const void* buffer, size_t elementSize) {
+		for (uint32_t y = region.minY; y < region.maxY; y++) {
+			memcpy(out, (const uint8_t*)buffer + (region.minX + (size_t)y * _width) * elementSize, rowWidth * elementSize);
+			out += rowWidth * elementSize;
 		}
+	};
+
+	read(_accumulationData, sizeof(glm::vec4));
+	read(_sampleCountData, sizeof(uint32_t));
+	read(_luminanceSquaredData, sizeof(float));
+	read(_albedoData, sizeof(glm::vec3));
+	read(_normalData, sizeof(glm::vec3));
+	read(_depthData, sizeof(float));
+}
 
-		//Gets the t which will always be closest to the camera
-		float closestT = (-half_b - glm::sqrt(discriminant)) / a;
+bool Renderer::WriteRegion(const Tile& region, const uint8_t* data, size_t size)
+{
+	if (region.maxX > _width || region.maxY > _height || region.minX > region.maxX || region.minY > region.maxY) return false;
 
-		if (closestT > 0.0f && closestT < lowestTDistance) {
-			lowestTDistance = closestT;
-			closestIndex = i;
+	uint32_t rowWidth = region.maxX - region.minX;
+	if (size != GetRegionSize(region)) return false;
+
+	auto write = [&](void* buffer, size_t elementSize) {
+		for (uint32_t y = region.minY; y < region.maxY; y++) {
+			memcpy((uint8_t*)buffer + (region.minX + (size_t)y * _width) * elementSize, data, rowWidth * elementSize);
+			data += rowWidth * elementSize;
+		}
+	};
+
+	write(_accumulationData, sizeof(glm::vec4));
+	write(_sampleCountData, sizeof(uint32_t));
+	write(_luminanceSquaredData, sizeof(float));
+	write(_albedoData, sizeof(glm::vec3));
+	write(_normalData, sizeof(glm::vec3));
+	write(_depthData, sizeof(float));
+	return true;
+}
+
+void Renderer::SaveState(uint64_t sceneHash, std::vector<uint8_t>& data) const
+{
+	Utils::StateHeader header = {};
+	memcpy(header.Magic, Utils::StateMagic, sizeof(header.Magic));
+	header.Version = Utils::StateVersion;
+	header.Width = _width;
+	header.Height = _height;
+	header.FrameIndex = _frameIndex;
+	header.Seed = _settings.Seed;
+	header.ReprojectionCount = _reprojectionCount;
+	header.TileSize = _tileSize;
+	header.TileOrdering = (uint32_t)_tileOrder;
+	header.TileCount = (uint32_t)_tileStates.size();
+	header.View = _renderedView;
+	header.Projection = _renderedProjection;
+	header.CameraPosition = _renderedCameraPosition;
+
+	header.SceneHash = sceneHash;
+	header.Bounces = _settings.Bounces;
+	header.PathIntegrator = (uint32_t)_settings.PathIntegrator;
+	header.RussianRoulette = _settings.RussianRoulette ? 1 : 0;
+	header.RussianRouletteDepth = _settings.RussianRouletteDepth;
+	header.AdaptiveSampling = _settings.AdaptiveSampling ? 1 : 0;
+	header.NoiseThreshold = _settings.NoiseThreshold;
+	header.AdaptiveMinSamples = _settings.AdaptiveMinSamples;
+	header.AdaptiveMaxSamplesPerFrame = _settings.AdaptiveMaxSamplesPerFrame;
+	header.LightDirection = _lightDir;
+	header.LightIrradiance = _lightIrradiance;
+
+	Tile image = { 0, 0, _width, _height };
+	size_t pixelsSize = GetRegionSize(image);
+
+	data.resize(sizeof(header) + pixelsSize + _tileStates.size() * Utils::StateTileSize);
+	uint8_t* out = data.data();
+
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	ReadRegion(image, out);
+	out += pixelsSize;
+
+	for (const TileState& state : _tileStates) {
+		uint32_t converged = state.Converged ? 1 : 0;
+		memcpy(out, &converged, sizeof(converged));
+		memcpy(out + sizeof(converged), &state.Error, sizeof(state.Error));
+		out += Utils::StateTileSize;
+	}
+}
+
+bool Renderer::LoadState(const uint8_t* data, size_t size, const Scene& scene, uint64_t sceneHash, const Camera& camera, std::string& error)
+{
+	Utils::StateHeader header;
+	if (size < 8 || memcmp(data, Utils::StateMagic, sizeof(Utils::StateMagic)) != 0) {
+		error = "not a render state";
+		return false;
+	}
+
+	uint32_t version;
+	memcpy(&version, data + sizeof(Utils::StateMagic), sizeof(version));
+	if (version != Utils::StateVersion) {
+		error = "unsupported render state version " + std::to_string(version);
+		return false;
+	}
+
+	if (size < sizeof(header)) {
+		error = "render state is truncated";
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	//Everything that differs is listed, so one attempt tells what to change
+	std::string differences;
+	auto compare = [&differences](bool same, const std::string& what) {
+		if (same) return;
+		differences += differences.empty() ? what : ", " + what;
+	};
+
+	compare(header.Width == _width && header.Height == _height,
+		"size (" + std::to_string(header.Width) + "x" + std::to_string(header.Height) + ")");
+	compare(header.SceneHash == sceneHash, "scene");
+	compare(header.View == camera.GetView() && header.Projection == camera.GetProjection(), "camera");
+	compare(header.Seed == _settings.Seed, "seed (" + std::to_string(header.Seed) + ")");
+	compare(header.Bounces == _settings.Bounces, "bounces (" + std::to_string(header.Bounces) + ")");
+	compare(header.PathIntegrator == (uint32_t)_settings.PathIntegrator, "integrator");
+	compare((header.RussianRoulette != 0) == _settings.RussianRoulette && header.RussianRouletteDepth == _settings.RussianRouletteDepth, "Russian roulette");
+	compare((header.AdaptiveSampling != 0) == _settings.AdaptiveSampling && header.NoiseThreshold == _settings.NoiseThreshold
+		&& header.AdaptiveMinSamples == _settings.AdaptiveMinSamples && header.AdaptiveMaxSamplesPerFrame == _settings.AdaptiveMaxSamplesPerFrame, "adaptive sampling");
+	compare(header.LightDirection == _lightDir && header.LightIrradiance == _lightIrradiance, "light");
+
+	if (!differences.empty()) {
+		error = "render state was saved with a different " + differences;
+		return false;
+	}
+
+	size_t pixelsSize = GetRegionSize({ 0, 0, _width, _height });
+	if (size != sizeof(header) + pixelsSize + (size_t)header.TileCount * Utils::StateTileSize) {
+		error = "render state is truncated";
+		return false;
+	}
+	WriteRegion({ 0, 0, _width, _height }, data + sizeof(header), pixelsSize);
+
+	//Tile states only mean something for the same tiles, other ones converge again from the restored pixels
+	RebuildTiles();
+	if (header.TileCount == _tileStates.size() && header.TileSize == _tileSize && header.TileOrdering == (uint32_t)_tileOrder) {
+		const uint8_t* in = data + sizeof(header) + pixelsSize;
+		for (TileState& state : _tileStates) {
+			uint32_t converged;
+			memcpy(&converged, in, sizeof(converged));
+			memcpy(&state.Error, in + sizeof(converged), sizeof(state.Error));
+			state.Converged = converged != 0;
+			in += Utils::StateTileSize;
 		}
 	}
 
-	//const Sphere& sphere = scene.spheres[0];
+	_frameIndex = header.FrameIndex;
+	_refineScale = _frameIndex > 1 ? 1 : 0;
+	_reprojectionCount = header.ReprojectionCount;
+
+	_renderedView = header.View;
+	_renderedProjection = header.Projection;
+	_renderedCameraPosition = header.CameraPosition;
+
+	_renderedScene = &scene;
+	_sceneGeneration = scene.generation;
+	return true;
+}
+
+void Renderer::RebuildTiles()
+{
+	_tileSize = std::max(1u, _settings.TileSize);
+	_tileOrder = _settings.TileOrdering;
+	_tileRegion = _settings.Region;
+
+	//Tiles stay on the image's grid, the ones crossing the region's edge are clipped to it
+	Tile region = GetRegion();
+	uint32_t tilesX = (_width + _tileSize - 1) / _tileSize;
+	uint32_t tilesY = (_height + _tileSize - 1) / _tileSize;
+
+	_tiles.clear();
+	_tiles.reserve(tilesX * tilesY);
+
+	std::vector<uint64_t> keys;
+	keys.reserve(tilesX * tilesY);
+
+	for (uint32_t ty = 0; ty < tilesY; ty++) {
+		for (uint32_t tx = 0; tx < tilesX; tx++) {
+			Tile tile;
+			tile.minX = std::max(tx * _tileSize, region.minX);
+			tile.minY = std::max(ty * _tileSize, region.minY);
+			tile.maxX = std::min(std::min(tx * _tileSize + _tileSize, _width), region.maxX);
+			tile.maxY = std::min(std::min(ty * _tileSize + _tileSize, _height), region.maxY);
+
+			if (tile.minX >= tile.maxX || tile.minY >= tile.maxY) continue;
+
+			uint64_t key = 0;
+			switch (_tileOrder) {
+			case TileOrder::Scanline:
+				key = (uint64_t)ty * tilesX + tx;
+				break;
+			case TileOrder::Morton:
+				key = Utils::InterleaveBits(tx) | (Utils::InterleaveBits(ty) << 1);
+				break;
+			case TileOrder::CenterOut: {
+				int64_t dx = 2 * (int64_t)tx + 1 - (int64_t)tilesX;
+				int64_t dy = 2 * (int64_t)ty + 1 - (int64_t)tilesY;
+				key = (uint64_t)(dx * dx + dy * dy);
+				break;
+			}
+			}
+
+			//Low bits keep the sort stable for equal keys
+			keys.push_back((key << 32) | (uint64_t)_tiles.size());
+			_tiles.push_back(tile);
+		}
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Tile> ordered(_tiles.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		ordered[i] = _tiles[keys[i] & 0xffffffff];
+	}
+	_tiles = std::move(ordered);
+
+	_tileStates.assign(_tiles.size(), TileState());
+}
+
+void Renderer::IntersectPacket(uint32_t x, uint32_t y, uint32_t packetWidth, const Tile& tile, HitBuffer& buffer)
+{
+	RayPacket packet;
+	packet.origin = _activeCamera->GetPosition();
+	packet.activeMask = 0;
+
+	for (uint32_t lane = 0; lane < RayPacket::Size; lane++) {
+		uint32_t px = x + lane % packetWidth;
+		uint32_t py = y + lane / packetWidth;
+
+		//Lanes outside the tile repeat pixel (x, y) so they never produce NaNs, their results are ignored
+		bool inside = px < tile.maxX && py < tile.maxY;
+		glm::vec3 direction = inside ? _activeCamera->GetRayDirection(px, py) : _activeCamera->GetRayDirection(x, y);
+		packet.directionX[lane] = direction.x;
+		packet.directionY[lane] = direction.y;
+		packet.directionZ[lane] = direction.z;
+
+		if (inside) packet.activeMask |= 1u << lane;
+	}
+
+	PacketKernels::TracePacket(_activeScene->sphereBVH, _activeScene->packedSpheres, packet);
+
+	for (uint32_t lane = 0; lane < RayPacket::Size; lane++) {
+		if (!(packet.activeMask & (1u << lane))) continue;
+
+		Ray ray;
+		ray.origin = packet.origin;
+		ray.direction = glm::vec3(packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane]);
+
+		int closestLane = packet.closestLane[lane];
+		int objectIndex = closestLane < 0 ? -1 : (int)_activeScene->packedSpheres.sphereIndex[closestLane];
+
+		//Instances and other primitives are traced per lane, the packet only covers spheres placed directly in the scene
+		buffer.Hits.push_back(CompleteHit(ray, packet.closestT[lane], objectIndex));
+		buffer.Pixels.push_back(x + lane % packetWidth + (y + lane / packetWidth) * _width);
+		buffer.Directions.push_back(ray.direction);
+	}
+}
+
+glm::vec4 Renderer::TracePath(const Ray& ray, HitRecord hit, Random random, PixelFeatures& features, uint32_t& rayCount)
+{
+	PathState path;
+	path.NextRay = ray;
+	path.Rng = random;
+
+	for (uint32_t i = 0; i < _settings.Bounces; i++) {
+		if (i > 0) {
+			hit = IntersectRay(path.NextRay);
+			rayCount++;
+		}
+
+		bool continues = ShadeBounce(hit, ReconstructHit(path.NextRay, hit), path, rayCount);
+		path.Depth++;
 
-	if (closestIndex < 0) {
+		if (!continues) break;
+	}
+
+	features = path.Features;
+	return glm::vec4(path.Color, 1.0f);
+}
+
+bool Renderer::ShadeBounce(const HitRecord& hit, const HitPayload& payload, PathState& path, uint32_t& rayCount)
+{
+	if (path.Depth == 0) {
+		path.Features = GetFeatures(path.NextRay, payload);
+	}
+
+	if (payload.HitDistance < 0.0f) {
+		path.Color += Utils::SkyColor() * path.Throughput;
+		return false;
+	}
+
+	const Scene& scene = *_activeScene;
+	const Material& mat = scene.materials[payload.MaterialIndex];
+
+	glm::vec3 emission = mat.GetEmission();
+	if (emission != glm::vec3(0.0f)) {
+		//Spheres in the light table could also have been reached by light sampling at the previous hit
+		float weight = 1.0f;
+		if (path.BSDFPdf > 0.0f && hit.Type == HitRecord::Sphere) {
+			const Sphere& sphere = scene.spheres[hit.Object];
+			float lightPdf = scene.lights.GetProbability(sphere, mat) * Utils::SphereConePdf(path.NextRay.origin, sphere);
+			weight = Utils::PowerHeuristic(path.BSDFPdf, lightPdf);
+		}
+
+		path.Color += emission * path.Throughput * weight;
+	}
+
+	glm::vec3 toViewer = -path.NextRay.direction;
+	glm::vec3 normal = glm::dot(payload.WorldNormal, toViewer) < 0.0f ? -payload.WorldNormal : payload.WorldNormal;
+	BSDF bsdf(mat, normal, toViewer);
+
+	//Far enough to clear the surface itself but close enough that contact shadows between touching objects survive
+	glm::vec3 origin = payload.WorldPosition + normal * (1e-4f * glm::max(1.0f, payload.HitDistance));
+
+	Ray shadowRay;
+	shadowRay.origin = origin;
+
+	//Next event estimation: the directional light can only be reached by aiming at it
+	glm::vec3 toLight = -glm::normalize(_lightDir);
+	float bsdfPdf;
+	glm::vec3 bsdfValue = bsdf.Evaluate(toLight, bsdfPdf);
+	if (bsdfPdf > 0.0f) {
+		shadowRay.direction = toLight;
+		rayCount++;
+
+		if (IntersectRay(shadowRay).Type == HitRecord::Miss) {
+			path.Color += bsdfValue * _lightIrradiance * path.Throughput;
+		}
+	}
+
+	//One emissive sphere picked by power, then a direction inside the cone it covers
+	if (!scene.lights.Empty()) {
+		uint32_t lightIndex = scene.lights.Sample(path.Rng);
+		const Sphere& light = scene.spheres[lightIndex];
+		const Material& lightMaterial = scene.materials[light.materialIndex];
+
+		float conePdf;
+		if (Utils::SampleSphereCone(origin, light, path.Rng, shadowRay.direction, conePdf)) {
+			bsdfValue = bsdf.Evaluate(shadowRay.direction, bsdfPdf);
+
+			if (bsdfPdf > 0.0f) {
+				rayCount++;
+
+				//Only the light itself may be hit first
+				HitRecord shadowHit = IntersectRay(shadowRay);
+				if (shadowHit.Type == HitRecord::Sphere && shadowHit.Object == lightIndex) {
+					float lightPdf = scene.lights.GetProbability(light, lightMaterial) * conePdf;
+					float weight = Utils::PowerHeuristic(lightPdf, bsdfPdf);
+					path.Color += bsdfValue * lightMaterial.GetEmission() * path.Throughput * (weight / lightPdf);
+				}
+			}
+		}
+	}
+
+	glm::vec3 direction, weight;
+	if (!bsdf.Sample(path.Rng, direction, weight, path.BSDFPdf)) return false;
+
+	path.Throughput *= weight;
+
+	path.NextRay.origin = origin;
+	path.NextRay.direction = direction;
+
+	return true;
+}
+
+void Renderer::RenderWavefront(bool adaptive, uint32_t samples)
+{
+	std::vector<uint32_t> activeTiles;
+	for (uint32_t i = 0; i < (uint32_t)_tiles.size(); i++) {
+		if (!(adaptive && _tileStates[i].Converged)) activeTiles.push_back(i);
+	}
+
+	//Tiles are taken in batches so the path buffers stay bounded at high resolutions
+	std::vector<uint32_t> batchTiles, batchFirstPath;
+
+	for (size_t next = 0; next < activeTiles.size();) {
+		batchTiles.clear();
+		batchFirstPath.clear();
+		uint32_t pathCount = 0;
+
+		while (next < activeTiles.size()) {
+			const Tile& tile = _tiles[activeTiles[next]];
+			uint32_t tilePaths = (tile.maxX - tile.minX) * (tile.maxY - tile.minY) * samples;
+			if (pathCount > 0 && pathCount + tilePaths > WavefrontMaxPaths) break;
+
+			batchTiles.push_back(activeTiles[next++]);
+			batchFirstPath.push_back(pathCount);
+			pathCount += tilePaths;
+		}
+
+		//Generate: one path per sample of every pixel, seeded exactly like the megakernel's samples
+		_paths.resize(pathCount);
+		_threadPool.ParallelFor((uint32_t)batchTiles.size(), [&](uint32_t batchIndex, uint32_t)
+			{
+				const Tile& tile = _tiles[batchTiles[batchIndex]];
+				PathState* path = _paths.data() + batchFirstPath[batchIndex];
+
+				for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+					for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+						uint32_t pixel = x + y * _width;
+
+						for (uint32_t sample = 0; sample < samples; sample++, path++) {
+							path->NextRay.origin = _activeCamera->GetPosition();
+							path->NextRay.direction = _activeCamera->GetRayDirection(x, y);
+							path->Color = glm::vec3(0.0f);
+							path->Throughput = glm::vec3(1.0f);
+							path->BSDFPdf = 0.0f;
+							path->Rng = Random::ForPixel(pixel, _sampleCountData[pixel] + 1 + sample, GetSampleSeed());
+							path->Pixel = pixel;
+							path->Depth = 0;
+							path->Features = PixelFeatures();
+						}
+					}
+				}
+			}
+		);
+
+		_pathQueue.resize(pathCount);
+		for (uint32_t i = 0; i < pathCount; i++) {
+			_pathQueue[i] = i;
+		}
+
+		//Without Russian roulette there is nothing to trace, matching the megakernel's empty bounce loop
+		if (!_settings.RussianRoulette && _settings.Bounces == 0) {
+			_pathQueue.clear();
+		}
+
+		while (!_pathQueue.empty()) {
+			uint32_t queueSize = (uint32_t)_pathQueue.size();
+			uint32_t chunkCount = (queueSize + WavefrontChunkSize - 1) / WavefrontChunkSize;
+
+			_queueHits.resize(queueSize);
+			_queueAlive.resize(queueSize);
+			_chunkCounts.assign(chunkCount, 0);
+
+			//Intersect: nearest hit of every live path, nothing is shaded yet
+			_threadPool.ParallelFor(chunkCount, [this, queueSize](uint32_t chunk, uint32_t)
+				{
+					uint32_t end = std::min(queueSize, (chunk + 1) * WavefrontChunkSize);
+					for (uint32_t i = chunk * WavefrontChunkSize; i < end; i++) {
+						_queueHits[i] = IntersectRay(_paths[_pathQueue[i]].NextRay);
+					}
+				}
+			);
+			_rayCount.fetch_add(queueSize, std::memory_order_relaxed);
+
+			//Shade: add each hit's contribution, set up the next segment and decide whether the path goes on
+			_threadPool.ParallelFor(chunkCount, [this, queueSize](uint32_t chunk, uint32_t)
+				{
+					uint32_t end = std::min(queueSize, (chunk + 1) * WavefrontChunkSize);
+					uint32_t alive = 0;
+					uint32_t shadowRays = 0;
+
+					for (uint32_t i = chunk * WavefrontChunkSize; i < end; i++) {
+						PathState& path = _paths[_pathQueue[i]];
+						const HitRecord& hit = _queueHits[i];
+
+						bool continues = ShadeBounce(hit, ReconstructHit(path.NextRay, hit), path, shadowRays);
+						path.Depth++;
+
+						if (continues && _settings.RussianRoulette && path.Depth >= _settings.RussianRouletteDepth) {
+							//Dividing the survivors by their probability keeps the estimate unbiased
+							glm::vec3 throughput = path.Throughput;
+							float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 1.0f);
+							continues = path.Rng.Float() < survival;
+							if (continues) path.Throughput /= survival;
+						}
+						else if (continues && !_settings.RussianRoulette) {
+							continues = path.Depth < _settings.Bounces;
+						}
+
+						_queueAlive[i] = continues ? 1 : 0;
+						alive += continues ? 1 : 0;
+					}
+
+					_chunkCounts[chunk] = alive;
+					_rayCount.fetch_add(shadowRays, std::memory_order_relaxed);
+				}
+			);
+
+			//Compact: survivors keep their order, each chunk writes to its own range of the next queue
+			uint32_t survivors = 0;
+			for (uint32_t& count : _chunkCounts) {
+				uint32_t chunkSurvivors = count;
+				count = survivors;
+				survivors += chunkSurvivors;
+			}
+
+			_nextPathQueue.resize(survivors);
+			_threadPool.ParallelFor(chunkCount, [this, queueSize](uint32_t chunk, uint32_t)
+				{
+					uint32_t end = std::min(queueSize, (chunk + 1) * WavefrontChunkSize);
+					uint32_t output = _chunkCounts[chunk];
+
+					for (uint32_t i = chunk * WavefrontChunkSize; i < end; i++) {
+						if (_queueAlive[i]) _nextPathQueue[output++] = _pathQueue[i];
+					}
+				}
+			);
+
+			std::swap(_pathQueue, _nextPathQueue);
+		}
+
+		//Accumulate the finished paths tile by tile, in the same sample order as the megakernel
+		_threadPool.ParallelFor((uint32_t)batchTiles.size(), [&](uint32_t batchIndex, uint32_t)
+			{
+				uint32_t tileIndex = batchTiles[batchIndex];
+				const Tile& tile = _tiles[tileIndex];
+				const PathState* path = _paths.data() + batchFirstPath[batchIndex];
+
+				for (uint32_t y = tile.minY; y < tile.maxY; y++) {
+					for (uint32_t x = tile.minX; x < tile.maxX; x++) {
+						for (uint32_t sample = 0; sample < samples; sample++, path++) {
+							AccumulatePixel(x, y, glm::vec4(path->Color, 1.0f), path->Features);
+						}
+					}
+				}
+
+				if (adaptive) {
+					TileState& state = _tileStates[tileIndex];
+					state.Error = EstimateTileError(tile);
+					state.Converged = state.Error < _settings.NoiseThreshold;
+				}
+			}
+		);
+	}
+}
+
+HitRecord Renderer::IntersectRay(const Ray& ray)
+{
+	float lowestTDistance = std::numeric_limits<float>::max();
+	int closestIndex = -1;
+
+	const std::vector<Sphere>& spheres = _activeScene->spheres;
+	const BVH& bvh = _activeScene->sphereBVH;
+	const PackedSpheres& packed = _activeScene->packedSpheres;
+
+	if (bvh.GetPrimitiveCount() == spheres.size() && packed.count == spheres.size()) {
+		int closestLane = -1;
+
+		bvh.Traverse(ray, lowestTDistance, [&](uint32_t first, uint32_t count) {
+			_intersectSpheres(packed, ray, first, count, lowestTDistance, closestLane);
+		});
+
+		if (closestLane >= 0) {
+			closestIndex = (int)packed.sphereIndex[closestLane];
+		}
+	}
+	else {
+		//Acceleration structure is stale, fall back to testing every sphere
+		for (uint32_t i = 0; i < spheres.size(); i++) {
+			float closestT = Utils::IntersectSphere(ray, spheres[i]);
+
+			if (closestT > 0.0f && closestT < lowestTDistance) {
+				lowestTDistance = closestT;
+				closestIndex = i;
+			}
+		}
+	}
+
+	return CompleteHit(ray, lowestTDistance, closestIndex);
+}
+
+HitRecord Renderer::CompleteHit(const Ray& ray, float closestT, int objectIndex)
+{
+	int instanceIndex = -1;
+	if (!_activeScene->instances.empty()) {
+		TraceInstances(ray, closestT, objectIndex, instanceIndex);
+	}
+
+	HitRecord hit;
+
+	PrimitiveHit primitiveHit;
+	ScenePrimitives::Intersect(*_activeScene, ray, 0.0f, closestT, primitiveHit);
+
+	if (primitiveHit.type >= 0) {
+		hit.Type = HitRecord::Primitive + primitiveHit.type;
+		hit.Object = primitiveHit.index;
+		hit.Detail = primitiveHit.part;
+	}
+	else if (instanceIndex >= 0) {
+		hit.Type = HitRecord::InstancedSphere;
+		hit.Object = (uint32_t)objectIndex;
+		hit.Detail = (uint32_t)instanceIndex;
+	}
+	else if (objectIndex >= 0) {
+		hit.Type = HitRecord::Sphere;
+		hit.Object = (uint32_t)objectIndex;
+	}
+	else {
+		return hit;
+	}
+
+	hit.T = closestT;
+	return hit;
+}
+
+HitPayload Renderer::ReconstructHit(const Ray& ray, const HitRecord& hit)
+{
+	switch (hit.Type) {
+	case HitRecord::Miss:
 		return MissHit(ray);
+	case HitRecord::Sphere:
+		return ClosestHit(ray, hit.T, (int)hit.Object);
+	case HitRecord::InstancedSphere:
+		return ClosestHit(ray, hit.T, (int)hit.Object, (int)hit.Detail);
+	default: {
+		HitPayload payload;
+		ScenePrimitives::FillPayload(*_activeScene, ray, hit.T, { hit.Type - HitRecord::Primitive, hit.Object, hit.Detail }, payload);
+		return payload;
 	}
+	}
+}
 
-	return ClosestHit(ray, lowestTDistance, closestIndex);
+int Renderer::GetMaterialIndex(const HitRecord& hit) const
+{
+	switch (hit.Type) {
+	case HitRecord::Miss:
+		return -1;
+	case HitRecord::Sphere:
+		return _activeScene->spheres[hit.Object].materialIndex;
+	case HitRecord::InstancedSphere: {
+		const Instance& instance = _activeScene->instances[hit.Detail];
+		return _activeScene->groups[instance.groupIndex].spheres[hit.Object].materialIndex;
+	}
+	default:
+		return ScenePrimitives::GetMaterialIndex(*_activeScene, { hit.Type - HitRecord::Primitive, hit.Object, hit.Detail });
+	}
 }
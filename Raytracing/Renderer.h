@@ -1,24 +1,126 @@
 #pragma once
 
-#include "Walnut/Image.h"
 #include "glm/glm.hpp"
 #include <memory>
+#include <atomic>
 
 #include "Scene.h"
 
 #include "Ray.h"
 
+#include "Denoiser.h"
 #include "Hittable.h"
+#include "PackedSpheres.h"
+#include "Resolve.h"
+#include "ThreadPool.h"
+#include "Random.h"
 
 class Renderer
 {
 public:
+	enum class PacketShape {
+		Row8x1, Block4x2
+	};
+
+	enum class TileOrder {
+		Scanline,
+		Morton,		//Z-order, neighbouring tiles are scheduled close together
+		CenterOut	//Middle of the image finishes first
+	};
+
+	enum class Integrator {
+		Megakernel,	//Each path is traced to the end by one thread, tile by tile
+		Wavefront	//Frame-wide queues of live paths, every bounce runs intersect, shade and compact stages
+	};
+
+	struct Tile {
+		uint32_t minX, minY;
+		uint32_t maxX, maxY; //exclusive
+	};
+
 	struct Settings {
 		bool Accumulate = true;
+
+		//Trace primary rays eight at a time through the BVH
+		bool PacketTracing = true;
+		PacketShape PacketLayout = PacketShape::Block4x2;
+
+		//0 uses every hardware thread
+		uint32_t ThreadCount = 0;
+		uint32_t TileSize = 32;
+		TileOrder TileOrdering = TileOrder::Morton;
+
+		//Only the part of the image inside Region is rendered, all of it while Region is empty. Keep its corners on
+		//multiples of TileSize and its tiles, and so every pixel, come out exactly as in a full frame.
+		Tile Region = { 0, 0, 0, 0 };
+
+		//Together with pixel, sample index and the scene's generation fully determines every random number, so renders are reproducible
+		uint32_t Seed = 0;
+
+		uint32_t Bounces = 5;
+
+		Integrator PathIntegrator = Integrator::Megakernel;
+		//Wavefront paths survive each bounce from RussianRouletteDepth on with a probability that follows their
+		//throughput, instead of stopping at Bounces. Without it they stop at Bounces and match the megakernel exactly.
+		bool RussianRoulette = true;
+		uint32_t RussianRouletteDepth = 3;
+
+		//Stop sampling tiles whose relative standard error is below NoiseThreshold, and spend up to
+		//AdaptiveMaxSamplesPerFrame samples per frame on the tiles that are still noisy
+		bool AdaptiveSampling = false;
+		float NoiseThreshold = 0.01f;
+		uint32_t AdaptiveMinSamples = 16;
+		uint32_t AdaptiveMaxSamplesPerFrame = 4;
+
+		//After a reset, trace one pixel per PreviewScale x PreviewScale block, with the scale picked so the frame fits
+		//FrameBudgetMs, then halve the scale each frame until full resolution accumulation starts.
+		//Also keeps camera moves within the budget while TemporalReprojection is on, see there.
+		bool ProgressivePreview = false;
+		uint32_t PreviewMaxScale = 8;
+		float FrameBudgetMs = 33.0f;
+
+		//Scene edits restart accumulation only for the pixels whose primary hits they can touch (see SceneChanges).
+		//The rest of the image is cut down to at most EditHistoryLimit samples, so shadows and reflections of the
+		//edit, which fall outside those pixels, catch up within a few frames. 0 keeps every sample.
+		uint32_t EditHistoryLimit = 16;
+
+		//Camera moves carry the accumulation over to the new view instead of needing ResetFrameIndex: each pixel's
+		//primary hit is looked up where the previous camera saw it, and that history is kept when it belongs to the
+		//same surface. Kept history counts as at most TemporalHistoryLimit samples, so new ones soon outweigh it.
+		//Reprojecting costs a primary ray per pixel on top of the full resolution frame. With ProgressivePreview on,
+		//moves whose reprojection and frame together would exceed FrameBudgetMs reset to the preview instead.
+		bool TemporalReprojection = true;
+		uint32_t TemporalHistoryLimit = 16;
+
+		//Converts the HDR accumulation into the RGBA8 image after every frame.
+		//Turn off when only the HDR result is used, then call ResolveImage when the image is needed.
+		bool Resolve = true;
+		ToneMapper ToneMapping = ToneMapper::Clamp;
+		bool SRGBEncode = true;
+
+		//Filters the accumulation with the first hit albedo, normal and depth as guides before resolving, so a
+		//few samples per pixel give a clean image. Higher sigmas blur more across lighting and depth changes.
+		bool Denoise = false;
+		uint32_t DenoiseIterations = 5;
+		float DenoiseLuminanceSigma = 4.0f;
+		float DenoiseDepthSigma = 1.0f;
+	};
+
+	//Counters for the most recent Render call
+	struct Stats {
+		uint64_t RayCount = 0;
+		uint32_t TileCount = 0;
+		uint32_t ConvergedTiles = 0;
+		uint32_t PreviewScale = 1; //1 when the frame was full resolution
+		float FrameMs = 0.0f;
+		float ResolveMs = 0.0f; //included in FrameMs
+		float ReprojectMs = 0.0f; //included in FrameMs, 0 unless the camera moved
+		float DenoiseMs = 0.0f; //included in ResolveMs
 	};
 
 
 	Renderer() = default;
+	~Renderer();
 
 	void OnResize(uint32_t width, uint32_t height);
 	void Render(const Scene& scene, const class Camera& camera);
@@ -28,39 +130,250 @@ public:
 	glm::vec3 GetLightDir() { return _lightDir; }
 	void SetLightDir(glm::vec3 newDir) { _lightDir = newDir; }
 
-	std::shared_ptr<Walnut::Image> GetFinalImage() const { return _finalImage; }
+	//Irradiance the directional light delivers to a surface facing it
+	glm::vec3 GetLightIrradiance() { return _lightIrradiance; }
+	void SetLightIrradiance(glm::vec3 irradiance) { _lightIrradiance = irradiance; }
+
+	//RGBA8 image of the last resolve, bottom row first
+	const uint32_t* GetImageData() const { return _imageData; }
+
+	//HDR sum of every sample per pixel, divide by the pixel's sample count for the mean
+	const glm::vec4* GetAccumulationData() const { return _accumulationData; }
+	const uint32_t* GetSampleCountData() const { return _sampleCountData; }
+
+	//First hit albedo, normal and depth summed over the same samples. Misses have the sky as albedo and zero normal
+	//and depth.
+	const glm::vec3* GetAlbedoData() const { return _albedoData; }
+	const glm::vec3* GetNormalData() const { return _normalData; }
+	const float* GetDepthData() const { return _depthData; }
+
+	//Sums of the last ResolveImage with Settings::Denoise on, divided by the same sample counts
+	const glm::vec4* GetDenoisedData() const { return _denoisedData; }
 
-	void ResetFrameIndex() { _frameIndex = 1; }
+	//Accumulation and AOVs of the pixels in region, for moving partial renders between renderers.
+	//WriteRegion takes what ReadRegion produced for the same region and returns false when the size does not match.
+	void ReadRegion(const Tile& region, std::vector<uint8_t>& data) const;
+	bool WriteRegion(const Tile& region, const uint8_t* data, size_t size);
+	//Bytes ReadRegion produces for region
+	static size_t GetRegionSize(const Tile& region);
+
+	//Everything the accumulation depends on, so a render can be stopped and continued later: the per pixel buffers,
+	//frame index, tile states and the camera they were rendered from, along with sceneHash and the settings that
+	//decide what each sample adds. Random numbers are derived from sample counts and the seed instead of being kept
+	//in generators, so a continued render matches one that never stopped bit for bit. Call between frames.
+	void SaveState(uint64_t sceneHash, std::vector<uint8_t>& data) const;
+	//Takes what SaveState produced, refusing it with error naming what differs unless the size, sceneHash, camera,
+	//seed, light and sample settings all match the saved ones
+	bool LoadState(const uint8_t* data, size_t size, const Scene& scene, uint64_t sceneHash, const class Camera& camera, std::string& error);
+
+	//Tonemaps and packs the accumulation into the image, denoised first when Settings::Denoise is on.
+	//Render does this itself unless Settings::Resolve is off.
+	void ResolveImage();
+	uint32_t GetWidth() const { return _width; }
+	uint32_t GetHeight() const { return _height; }
+
+	void ResetFrameIndex() { _frameIndex = 1; _refineScale = 0; }
+	uint32_t GetFrameIndex() const { return _frameIndex; }
+
+	const Stats& GetStats() const { return _stats; }
 
 private:
 
 
-	HitPayload TraceRay(const Ray& ray);
+	//Nearest hit over every kind of geometry, without computing anything needed only for shading
+	HitRecord IntersectRay(const Ray& ray);
 
-	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);
+	//Adds instances and ScenePrimitives to the nearest top level sphere (objectIndex -1 for none) at closestT
+	HitRecord CompleteHit(const Ray& ray, float closestT, int objectIndex);
+
+	//Position, normal and material of a hit found by IntersectRay or CompleteHit
+	HitPayload ReconstructHit(const Ray& ray, const HitRecord& hit);
+	int GetMaterialIndex(const HitRecord& hit) const;
+
+	//objectIndex is into Scene::spheres, or into the group's spheres when instanceIndex is not -1
+	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex, int instanceIndex = -1);
+
+	//Shrinks closestT and sets objectIndex/instanceIndex when a sphere inside an instance is nearer
+	void TraceInstances(const Ray& ray, float& closestT, int& objectIndex, int& instanceIndex);
 
 	HitPayload MissHit(const Ray& ray);
 
-	//Invoked for every pixel we are rendering
-	glm::vec4 PerPixel(uint32_t x, uint32_t y);
+	//What the denoiser is guided by, taken from the primary hit of every sample
+	struct PixelFeatures {
+		glm::vec3 Albedo = glm::vec3(0.0f);
+		glm::vec3 Normal = glm::vec3(0.0f);
+		float Depth = 0.0f;
+	};
+
+	//Everything a path carries from one bounce to the next. The wavefront integrator keeps one per sample of every
+	//pixel in the current batch of tiles.
+	struct PathState {
+		Ray NextRay;
+		glm::vec3 Color = glm::vec3(0.0f);
+		glm::vec3 Throughput = glm::vec3(1.0f);
+		//Density the BSDF chose NextRay with, 0 for camera rays, which no light sample could have found
+		float BSDFPdf = 0.0f;
+		Random Rng{ 0 };
+		uint32_t Pixel = 0;
+		uint32_t Depth = 0;
+		//Set by the first bounce
+		PixelFeatures Features;
+	};
+
+	//Shades a path whose first hit has already been traced
+	//rayCount is incremented for every extension and shadow ray traced
+	glm::vec4 TracePath(const Ray& ray, HitRecord hit, Random random, PixelFeatures& features, uint32_t& rayCount);
+
+	//One bounce of shading shared by both integrators: adds what the hit emits and the light reaching it
+	//directly to the path's color, then samples the BSDF to turn NextRay into the next segment of the path.
+	//Emissive spheres are sampled from the scene's light table and weighted against BSDF sampling with
+	//multiple importance sampling. Returns false when the path ended (it left the scene or the sample went
+	//below the surface). rayCount is incremented for the shadow rays.
+	bool ShadeBounce(const HitRecord& hit, const HitPayload& payload, PathState& path, uint32_t& rayCount);
+
+	//Renders every tile that still needs samples with the wavefront integrator
+	void RenderWavefront(bool adaptive, uint32_t samples);
+
+	//Primary hits of one tile, filled by the intersection stage and consumed by the shading stage
+	struct HitBuffer {
+		std::vector<HitRecord> Hits;
+		//Pixel index and primary ray direction of each hit
+		std::vector<uint32_t> Pixels;
+		std::vector<glm::vec3> Directions;
+		//Sort key of each hit, 0 for misses and materialIndex + 1 otherwise
+		std::vector<uint32_t> Buckets;
+		//Hits grouped by material, misses first
+		std::vector<uint32_t> Order;
+		std::vector<uint32_t> MaterialOffsets;
+	};
+
+	void RenderTile(uint32_t tileIndex, uint32_t threadIndex, bool packets, uint32_t samples);
+
+	//Writes the nearest hit of every primary ray in the tile into buffer, nothing is shaded
+	void IntersectTile(const Tile& tile, bool packets, HitBuffer& buffer);
+
+	//Shades the buffered primary hits in material order and accumulates the finished paths
+	void ShadeTile(HitBuffer& buffer, uint32_t& rayCount);
+
+	//Traces one pixel per scale x scale block whose corner lies in the tile and fills the block's accumulation with it
+	void RenderPreviewTile(const Tile& tile, uint32_t scale, uint32_t& rayCount);
+	uint32_t ChoosePreviewScale() const;
+
+	//Largest relative standard error of the mean luminance over the tile's pixels
+	float EstimateTileError(const Tile& tile) const;
+
+	//Intersects the primary rays of a packetWidth wide block of RayPacket::Size pixels together, clipped to the tile
+	void IntersectPacket(uint32_t x, uint32_t y, uint32_t packetWidth, const Tile& tile, HitBuffer& buffer);
+
+	void RebuildTiles();
+
+	void ReadRegion(const Tile& region, uint8_t* out) const;
+
+	//Settings::Region clipped to the image, the whole image when it is empty
+	Tile GetRegion() const;
+
+	//Settings::Seed, changed by every scene edit and camera move so pixels whose sample count was trimmed by
+	//InvalidateRegions or ReprojectHistory do not draw the random numbers of their earlier samples again
+	uint32_t GetSampleSeed() const { return _settings.Seed + (uint32_t)_sceneGeneration * 0x9E3779B9u + _reprojectionCount * 0x85EBCA6Bu; }
+
+	//Restarts accumulation in the pixels the world space regions cover on screen, and trims the rest of the image
+	//to Settings::EditHistoryLimit samples
+	void InvalidateRegions(const std::vector<AABB>& regions);
+
+	//Replaces the accumulation of the previous camera with its reprojection into the active one, see Settings::TemporalReprojection
+	void ReprojectHistory();
+	void DeleteHistory();
+
+	PixelFeatures GetFeatures(const Ray& ray, const HitPayload& payload) const;
+
+	void AccumulatePixel(uint32_t x, uint32_t y, const glm::vec4& color, const PixelFeatures& features);
 
 private:
 	uint32_t* _imageData = nullptr;
-	std::shared_ptr<Walnut::Image> _finalImage;
+	uint32_t _width = 0, _height = 0;
+
+	struct TileState {
+		bool Converged = false;
+		float Error = 0.0f;
+	};
+
+	std::vector<Tile> _tiles;
+	std::vector<TileState> _tileStates;
+	//One per pool thread
+	std::vector<HitBuffer> _hitBuffers;
+
+	//Wavefront integrator state
+	//Queues are processed in chunks of this many paths per job, batches of tiles are capped at WavefrontMaxPaths
+	static constexpr uint32_t WavefrontChunkSize = 1024;
+	static constexpr uint32_t WavefrontMaxPaths = 1 << 20;
+
+	std::vector<PathState> _paths;
+	//Live paths of the current bounce and the survivors for the next one
+	std::vector<uint32_t> _pathQueue, _nextPathQueue;
+	std::vector<HitRecord> _queueHits;
+	std::vector<uint8_t> _queueAlive;
+	std::vector<uint32_t> _chunkCounts;
+	uint32_t _tileSize = 0;
+	TileOrder _tileOrder = TileOrder::Scanline;
+	Tile _tileRegion = { 0, 0, 0, 0 };
 
-	std::vector<uint32_t> _imageHorizontalIterator, _imageVerticalIterator;
+	ThreadPool _threadPool;
 
 	Settings _settings;
+	Stats _stats;
+	std::atomic<uint64_t> _rayCount{ 0 };
 
-	const Scene* _activeScene;
-	const Camera* _activeCamera;
+	const Scene* _activeScene = nullptr;
+	const Camera* _activeCamera = nullptr;
+
+	//Scene and Scene::generation the accumulation belongs to
+	const Scene* _renderedScene = nullptr;
+	uint64_t _sceneGeneration = 0;
 
 
 	glm::vec3 _lightDir = glm::vec3(-1.0f);
+	//Pi makes a white Lambert surface facing the light exactly white
+	glm::vec3 _lightIrradiance = glm::vec3(3.14159265f);
+
+
+	glm::vec4* _accumulationData = nullptr;
+
+	//Per pixel sample count and sum of squared luminance, for variance estimates
+	uint32_t* _sampleCountData = nullptr;
+	float* _luminanceSquaredData = nullptr;
 
+	//Sums of PixelFeatures over the same samples
+	glm::vec3* _albedoData = nullptr;
+	glm::vec3* _normalData = nullptr;
+	float* _depthData = nullptr;
 
-	glm::vec4* _accumulationData;
+	//Camera the accumulation was rendered from
+	glm::mat4 _renderedView{ 1.0f };
+	glm::mat4 _renderedProjection{ 1.0f };
+	glm::vec3 _renderedCameraPosition{ 0.0f };
+	uint32_t _reprojectionCount = 0;
+
+	//Accumulation of the previous view while ReprojectHistory reads it, allocated on the first camera move
+	glm::vec4* _historyAccumulationData = nullptr;
+	uint32_t* _historySampleCountData = nullptr;
+	float* _historyLuminanceSquaredData = nullptr;
+	glm::vec3* _historyNormalData = nullptr;
+	float* _historyDepthData = nullptr;
+
+	Denoiser _denoiser;
+	//Denoised sums, resolved instead of the accumulation
+	glm::vec4* _denoisedData = nullptr;
 
 	uint32_t _frameIndex = 1;
+
+	//Preview scale for the next frame: 0 picks one from the frame budget, 1 means full resolution
+	uint32_t _refineScale = 0;
+	//Smoothed cost of a full resolution frame and of reprojecting the history, for choosing preview scales and
+	//deciding whether camera moves can be reprojected within the frame budget
+	float _fullFrameMs = 0.0f;
+	float _reprojectMs = 0.0f;
+
+	SphereKernels::IntersectFn _intersectSpheres = SphereKernels::Select();
+	ResolveKernels::ResolveFn _resolve = ResolveKernels::Select();
 };
 
@@ -0,0 +1,151 @@
+#include "Resolve.h"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define RT_X64 1
+	#include <immintrin.h>
+#else
+	#define RT_X64 0
+#endif
+
+namespace ResolveKernels {
+	//Channels in [0, 1] are quantised to LUTSize entries before encoding to 8 bits
+	static constexpr uint32_t LUTSize = 4096;
+
+	struct EncodeTables {
+		uint8_t linear[LUTSize];
+		uint8_t srgb[LUTSize];
+
+		EncodeTables() {
+			for (uint32_t i = 0; i < LUTSize; i++) {
+				float v = (float)i / (float)(LUTSize - 1);
+				float encoded = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+
+				linear[i] = (uint8_t)(v * 255.0f + 0.5f);
+				srgb[i] = (uint8_t)(encoded * 255.0f + 0.5f);
+			}
+		}
+	};
+
+	static const EncodeTables& GetTables() {
+		static const EncodeTables tables;
+		return tables;
+	}
+
+	static float ToneMap(float c, ToneMapper toneMapper) {
+		switch (toneMapper) {
+		case ToneMapper::Reinhard:
+			return c / (1.0f + c);
+		case ToneMapper::ACES:
+			return (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+		default:
+			return c;
+		}
+	}
+
+	//Written as max/min so NaN ends up as zero, the same way _mm_max_ps/_mm_min_ps treat it
+	static uint32_t Quantise(float c) {
+		c = c > 0.0f ? c : 0.0f;
+		c = c < 1.0f ? c : 1.0f;
+		return (uint32_t)(c * (float)(LUTSize - 1) + 0.5f);
+	}
+
+	void ResolveScalar(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb)
+	{
+		const EncodeTables& tables = GetTables();
+		const uint8_t* colorLUT = srgb ? tables.srgb : tables.linear;
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t n = sampleCounts[i];
+			float reciprocal = n > 0 ? 1.0f / (float)n : 0.0f;
+			glm::vec4 color = accumulation[i] * reciprocal;
+
+			uint32_t r = colorLUT[Quantise(ToneMap(color.r, toneMapper))];
+			uint32_t g = colorLUT[Quantise(ToneMap(color.g, toneMapper))];
+			uint32_t b = colorLUT[Quantise(ToneMap(color.b, toneMapper))];
+			uint32_t a = tables.linear[Quantise(color.a)];
+
+			image[i] = (a << 24) | (b << 16) | (g << 8) | r;
+		}
+	}
+
+#if RT_X64
+	static __m128 ToneMapSSE(__m128 c, ToneMapper toneMapper) {
+		const __m128 one = _mm_set1_ps(1.0f);
+
+		switch (toneMapper) {
+		case ToneMapper::Reinhard:
+			return _mm_div_ps(c, _mm_add_ps(one, c));
+		case ToneMapper::ACES: {
+			__m128 numerator = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), c), _mm_set1_ps(0.03f)));
+			__m128 denominator = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), c), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+			return _mm_div_ps(numerator, denominator);
+		}
+		default:
+			return c;
+		}
+	}
+
+	//Four pixels per iteration: reciprocals of four sample counts at once, one pixel per register for the
+	//colour math, then the quantised channels of all four go through the tables as 16 bytes
+	void ResolveSSE(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb)
+	{
+		static_assert(sizeof(glm::vec4) == 4 * sizeof(float), "glm::vec4 must be four packed floats");
+
+		const EncodeTables& tables = GetTables();
+		const uint8_t* colorLUT = srgb ? tables.srgb : tables.linear;
+		const uint8_t* channelLUT[4] = { colorLUT, colorLUT, colorLUT, tables.linear };
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps((float)(LUTSize - 1));
+		const __m128 half = _mm_set1_ps(0.5f);
+		//Alpha is averaged but never tonemapped
+		const __m128 colorMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+		uint32_t vectorCount = count & ~3u;
+		for (uint32_t i = 0; i < vectorCount; i += 4) {
+			__m128 n = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sampleCounts + i)));
+			alignas(16) float reciprocals[4];
+			_mm_store_ps(reciprocals, _mm_and_ps(_mm_div_ps(one, n), _mm_cmpgt_ps(n, zero)));
+
+			alignas(16) int32_t indices[16];
+			for (uint32_t p = 0; p < 4; p++) {
+				__m128 color = _mm_mul_ps(_mm_loadu_ps((const float*)(accumulation + i + p)), _mm_set1_ps(reciprocals[p]));
+				__m128 mapped = ToneMapSSE(color, toneMapper);
+				color = _mm_or_ps(_mm_and_ps(colorMask, mapped), _mm_andnot_ps(colorMask, color));
+
+				color = _mm_min_ps(_mm_max_ps(color, zero), one);
+				__m128i quantised = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(color, scale), half));
+				_mm_store_si128((__m128i*)(indices + p * 4), quantised);
+			}
+
+			alignas(16) uint8_t bytes[16];
+			for (uint32_t k = 0; k < 16; k++) {
+				bytes[k] = channelLUT[k & 3][indices[k]];
+			}
+
+			//RGBA byte order is the little-endian layout of the packed pixels
+			_mm_storeu_si128((__m128i*)(image + i), _mm_load_si128((const __m128i*)bytes));
+		}
+
+		ResolveScalar(accumulation + vectorCount, sampleCounts + vectorCount, image + vectorCount, count - vectorCount, toneMapper, srgb);
+	}
+#else
+	void ResolveSSE(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb)
+	{
+		ResolveScalar(accumulation, sampleCounts, image, count, toneMapper, srgb);
+	}
+#endif
+
+	ResolveFn Select()
+	{
+	#if RT_X64
+		//SSE2 is part of the x64 baseline
+		return ResolveSSE;
+	#else
+		return ResolveScalar;
+	#endif
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+
+enum class ToneMapper {
+	Clamp,		//Values above one saturate
+	Reinhard,	//c / (1 + c)
+	ACES		//Narkowicz's fit of the ACES filmic curve
+};
+
+namespace ResolveKernels {
+	//Turns count accumulated HDR pixels into display RGBA8: average over the per-pixel sample count,
+	//tonemap the colour channels, optionally sRGB encode them, and pack. Pixels without samples come out black.
+	//Both kernels produce identical bytes.
+	using ResolveFn = void(*)(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb);
+
+	void ResolveScalar(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb);
+	void ResolveSSE(const glm::vec4* accumulation, const uint32_t* sampleCounts, uint32_t* image, uint32_t count, ToneMapper toneMapper, bool srgb);
+
+	ResolveFn Select();
+}
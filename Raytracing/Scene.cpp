@@ -1,5 +1,209 @@
 #include "Scene.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+
+namespace Utils {
+	static std::vector<AABB> GetSphereBounds(const std::vector<Sphere>& spheres) {
+		std::vector<AABB> bounds(spheres.size());
+		for (size_t i = 0; i < spheres.size(); i++) {
+			bounds[i] = spheres[i].GetBounds();
+		}
+		return bounds;
+	}
+}
+
+void SphereGroup::BuildAccelerationStructure()
+{
+	bvh.Build(Utils::GetSphereBounds(spheres), SphereKernels::GetSelectedWidth());
+	packedSpheres.Build(spheres, bvh.GetPrimitiveIndices());
+}
+
+void Instance::UpdateTransform()
+{
+	transform = glm::translate(glm::mat4(1.0f), position)
+		* glm::rotate(glm::mat4(1.0f), glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f))
+		* glm::rotate(glm::mat4(1.0f), glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f))
+		* glm::rotate(glm::mat4(1.0f), glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f))
+		* glm::scale(glm::mat4(1.0f), scale);
+	inverseTransform = glm::inverse(transform);
+}
+
+void Scene::BuildAccelerationStructures()
+{
+	sphereBVH.Build(Utils::GetSphereBounds(spheres), SphereKernels::GetSelectedWidth());
+	packedSpheres.Build(spheres, sphereBVH.GetPrimitiveIndices());
+
+	for (SphereGroup& group : groups) {
+		group.BuildAccelerationStructure();
+	}
+
+	BuildInstanceBVH();
+
+	for (Mesh& mesh : meshes) {
+		mesh.BuildAccelerationStructure();
+	}
+
+	BuildLights();
+}
+
+void Scene::RefitAccelerationStructures()
+{
+	if (sphereBVH.GetPrimitiveCount() != spheres.size()) {
+		BuildAccelerationStructures();
+		return;
+	}
+
+	for (const SphereGroup& group : groups) {
+		if (!group.IsBuilt()) {
+			BuildAccelerationStructures();
+			return;
+		}
+	}
+
+	sphereBVH.Refit(Utils::GetSphereBounds(spheres));
+	packedSpheres.Update(spheres);
+
+	BuildInstanceBVH();
+
+	for (Mesh& mesh : meshes) {
+		if (!mesh.IsBuilt()) mesh.BuildAccelerationStructure();
+	}
+
+	//Light power follows the radius
+	BuildLights();
+}
+
+void Scene::BuildLights()
+{
+	lights.Build(spheres, materials);
+}
+
+bool Scene::IsEmissive(int materialIndex) const
+{
+	return materialIndex >= 0 && materialIndex < (int)materials.size() && materials[materialIndex].GetEmission() != glm::vec3(0.0f);
+}
+
+void Scene::MarkSphereChanged(uint32_t index, const AABB& previousBounds)
+{
+	pendingChanges.spheres.push_back(index);
+	pendingChanges.regions.push_back(previousBounds);
+	pendingChanges.regions.push_back(spheres[index].GetBounds());
+
+	//The packed copy still holds the material from before the edit
+	int previousMaterial = spheres[index].materialIndex;
+	if (index < sphereBVH.GetPrimitiveCount() && packedSpheres.count == sphereBVH.GetPrimitiveCount()) {
+		previousMaterial = packedSpheres.materialIndex[sphereBVH.GetPrimitiveSlot(index)];
+	}
+
+	//Moving a light, or turning a sphere into one or out of one, changes the lighting everywhere
+	if (IsEmissive(previousMaterial) || IsEmissive(spheres[index].materialIndex)) {
+		pendingChanges.everything = true;
+	}
+}
+
+void Scene::MarkMaterialChanged(uint32_t index)
+{
+	bool wasEmissive = false;
+	for (const SphereLights::Entry& entry : lights.entries) {
+		wasEmissive |= spheres[entry.sphere].materialIndex == (int)index;
+	}
+
+	if (wasEmissive || IsEmissive(index)) {
+		pendingChanges.everything = true;
+		return;
+	}
+
+	for (const Sphere& sphere : spheres) {
+		if (sphere.materialIndex == (int)index) pendingChanges.regions.push_back(sphere.GetBounds());
+	}
+
+	for (const Box& box : boxes) {
+		if (box.materialIndex != (int)index) continue;
+
+		AABB bounds;
+		bounds.min = box.min;
+		bounds.max = box.max;
+		pendingChanges.regions.push_back(bounds);
+	}
+
+	for (const Mesh& mesh : meshes) {
+		if (mesh.materialIndex == (int)index) pendingChanges.regions.push_back(mesh.bvh.GetBounds());
+	}
+
+	//Planes are unbounded, and instanced spheres would need the bounds of every instance of their group
+	for (const Plane& plane : planes) {
+		pendingChanges.everything |= plane.materialIndex == (int)index;
+	}
+
+	for (const SphereGroup& group : groups) {
+		for (const Sphere& sphere : group.spheres) {
+			pendingChanges.everything |= sphere.materialIndex == (int)index;
+		}
+	}
+}
+
+void Scene::MarkAllChanged()
+{
+	pendingChanges.everything = true;
+}
+
+void Scene::CommitChanges()
+{
+	if (pendingChanges.IsEmpty()) return;
+
+	if (pendingChanges.everything) {
+		RefitAccelerationStructures();
+	}
+	else if (!pendingChanges.spheres.empty()) {
+		std::vector<uint32_t>& changed = pendingChanges.spheres;
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+		if (sphereBVH.GetPrimitiveCount() != spheres.size()) {
+			BuildAccelerationStructures();
+		}
+		else {
+			sphereBVH.RefitPrimitives(changed, [this](uint32_t sphere) { return spheres[sphere].GetBounds(); });
+
+			std::vector<uint32_t> lanes(changed.size());
+			for (size_t i = 0; i < changed.size(); i++) {
+				lanes[i] = sphereBVH.GetPrimitiveSlot(changed[i]);
+			}
+			packedSpheres.Update(spheres, lanes);
+		}
+	}
+
+	//Lights only change with edits marked as everything, which rebuilt them above
+
+	committedChanges = std::move(pendingChanges);
+	pendingChanges = SceneChanges();
+	generation++;
+}
+
+void Scene::BuildInstanceBVH()
+{
+	std::vector<AABB> bounds(instances.size());
+
+	for (size_t i = 0; i < instances.size(); i++) {
+		Instance& instance = instances[i];
+		instance.UpdateTransform();
+
+		//Instances of missing or empty groups keep an empty box and are never entered
+		if (instance.groupIndex >= groups.size() || groups[instance.groupIndex].spheres.empty()) continue;
+
+		//World box around the eight transformed corners of the group's local box
+		AABB local = groups[instance.groupIndex].bvh.GetBounds();
+		for (uint32_t corner = 0; corner < 8; corner++) {
+			glm::vec3 p(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z);
+			bounds[i].Grow(glm::vec3(instance.transform * glm::vec4(p, 1.0f)));
+		}
+	}
+
+	instanceBVH.Build(bounds);
+}
+
 //bool Sphere::Hit(const Ray& r, float tMin, float tMax, HitPayload& rec) const
 //{
 //
@@ -3,7 +3,11 @@
 #include<glm/glm.hpp>
 #include<vector>
 
-#include "Hittable.h"
+#include "BVH.h"
+#include "PackedSpheres.h"
+#include "Primitives.h"
+#include "Mesh.h"
+#include "Lights.h"
 
 #include "Ray.h"
 #include <string>
@@ -12,6 +16,12 @@ struct Material {
 	glm::vec3 albedo = glm::vec3(1.0f);
 	float roughness = 1.0f;
 	float metallic = 0.0f;
+
+	//Emitted radiance is emissionColor * emissionPower
+	glm::vec3 emissionColor = glm::vec3(1.0f);
+	float emissionPower = 0.0f;
+
+	glm::vec3 GetEmission() const { return emissionColor * emissionPower; }
 };
 
 struct Sphere {
@@ -21,16 +31,112 @@ public:
 
 	int materialIndex = 0;
 
+	AABB GetBounds() const {
+		AABB bounds;
+		bounds.min = pos - glm::vec3(radius);
+		bounds.max = pos + glm::vec3(radius);
+		return bounds;
+	}
+};
+
+
+//Spheres in their own local space, stored and built once however many instances place them in the scene
+struct SphereGroup {
+	std::string name;
+	std::vector<Sphere> spheres;
+
+	BVH bvh;
+	PackedSpheres packedSpheres;
+
+	void BuildAccelerationStructure();
+	bool IsBuilt() const { return bvh.GetPrimitiveCount() == spheres.size() && packedSpheres.count == spheres.size(); }
+};
+
+//Places a SphereGroup in the scene with a scale, then rotation (Euler angles in degrees, applied X, Y, Z), then translation
+struct Instance {
+	uint32_t groupIndex = 0;
 
-	// Inherited via Hittable
-	//virtual bool Hit(const Ray& r, float tMin, float tMax, HitPayload& rec) const override;
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::vec3 rotation = glm::vec3(0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
 
+	//Local to world and back, derived from position/rotation/scale by UpdateTransform
+	glm::mat4 transform = glm::mat4(1.0f);
+	glm::mat4 inverseTransform = glm::mat4(1.0f);
+
+	void UpdateTransform();
 };
 
+//Edits recorded with the Scene::Mark functions
+struct SceneChanges {
+	//Top level spheres that moved, resized or changed material
+	std::vector<uint32_t> spheres;
+	//World space boxes the edits touched, before and after. Pixels whose primary hits may lie in them change.
+	std::vector<AABB> regions;
+	//Too broad to localize, the whole image changes
+	bool everything = false;
+
+	bool IsEmpty() const { return spheres.empty() && regions.empty() && !everything; }
+};
 
 struct Scene {
 	std::string name;
 
 	std::vector<Sphere> spheres;
 	std::vector<Material> materials;
+
+	std::vector<SphereGroup> groups;
+	std::vector<Instance> instances;
+
+	//Primitives without a scene-wide acceleration structure, traced through ScenePrimitives.
+	//Each mesh carries its own BVH.
+	std::vector<Plane> planes;
+	std::vector<Box> boxes;
+	std::vector<Mesh> meshes;
+
+	//Acceleration structure over spheres, must be rebuilt after spheres are added or removed
+	BVH sphereBVH;
+	PackedSpheres packedSpheres;
+
+	//Top level structure over the world bounds of every instance
+	BVH instanceBVH;
+
+	//Emissive top level spheres, sampled directly by the renderer. Emissive surfaces of other kinds still light
+	//the scene but are only found by paths that happen to hit them.
+	SphereLights lights;
+
+	//Also rebuilds the lights
+	void BuildAccelerationStructures();
+
+	//Cheaper than a rebuild when spheres only moved or changed radius.
+	//Instances may move freely, the top level structure is rebuilt since it only holds one box per instance.
+	//Meshes are only built when they are new, their vertices are not expected to change.
+	void RefitAccelerationStructures();
+
+	//Enough after materials changed, the acceleration structures do not depend on them
+	void BuildLights();
+
+	//Edits are marked as they are made and applied together by CommitChanges, which does only the work they need
+	//and increments generation. Renderers compare generation with the one they last rendered and use
+	//committedChanges to decide which pixels to render again.
+	uint64_t generation = 0;
+	SceneChanges pendingChanges;
+	SceneChanges committedChanges;
+
+	//Call after changing a top level sphere's position, radius or material, with its bounds from before the edit
+	void MarkSphereChanged(uint32_t index, const AABB& previousBounds);
+	//Call after changing any field of a material
+	void MarkMaterialChanged(uint32_t index);
+	//Anything else: added or removed objects, instances, planes, boxes and meshes
+	void MarkAllChanged();
+
+	void CommitChanges();
+
+private:
+	void BuildInstanceBVH();
+
+	bool IsEmissive(int materialIndex) const;
 };
+
+//Every array listed here is intersected by IntersectRay, add new primitive types to Scene and to this list
+using ScenePrimitives = PrimitiveRegistry<Scene, &Scene::planes, &Scene::boxes, &Scene::meshes>;
@@ -0,0 +1,1087 @@
+#include "SceneSerializer.h"
+#include "MappedFile.h"
+
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <charconv>
+#include <string_view>
+#include <filesystem>
+
+namespace Utils {
+	//Index of the first element whose materialIndex is outside [0, materialCount), -1 when all are valid
+	template<typename T>
+	static int64_t FindMissingMaterial(const std::vector<T>& elements, size_t materialCount) {
+		for (size_t i = 0; i < elements.size(); i++) {
+			if (elements[i].materialIndex < 0 || (size_t)elements[i].materialIndex >= materialCount) return (int64_t)i;
+		}
+		return -1;
+	}
+
+	//The renderer indexes materials unchecked, so both loaders refuse scenes with an element whose material is
+	//missing, including the default index 0 of elements that do not give one. Empty when every index is valid.
+	static std::string DescribeMissingMaterial(const Scene& scene) {
+		size_t materialCount = scene.materials.size();
+		auto describe = [](const std::string& element, int materialIndex) {
+			return element + " refers to missing material " + std::to_string(materialIndex);
+		};
+
+		int64_t missing;
+		if ((missing = FindMissingMaterial(scene.spheres, materialCount)) >= 0) {
+			return describe("sphere " + std::to_string(missing), scene.spheres[missing].materialIndex);
+		}
+		for (size_t i = 0; i < scene.groups.size(); i++) {
+			const std::vector<Sphere>& spheres = scene.groups[i].spheres;
+			if ((missing = FindMissingMaterial(spheres, materialCount)) >= 0) {
+				return describe("sphere " + std::to_string(missing) + " of group " + std::to_string(i), spheres[missing].materialIndex);
+			}
+		}
+		if ((missing = FindMissingMaterial(scene.meshes, materialCount)) >= 0) {
+			return describe("mesh " + std::to_string(missing), scene.meshes[missing].materialIndex);
+		}
+		if ((missing = FindMissingMaterial(scene.planes, materialCount)) >= 0) {
+			return describe("plane " + std::to_string(missing), scene.planes[missing].materialIndex);
+		}
+		if ((missing = FindMissingMaterial(scene.boxes, materialCount)) >= 0) {
+			return describe("box " + std::to_string(missing), scene.boxes[missing].materialIndex);
+		}
+
+		return {};
+	}
+}
+
+namespace BinaryScene {
+	//Little-endian, every section starts on a 16-byte boundary.
+	//Bump Version whenever a record layout changes and keep reading the old ones.
+	static const char Magic[4] = { 'R', 'T', 'S', 'B' };
+	//Version 2 added groups and instances after the version 1 header, version 3 meshes after those
+	//and version 4 planes and boxes after the meshes. Version 5 added material emission.
+	static const uint32_t Version = 5;
+	static const size_t Alignment = 16;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t nameLength;
+		uint32_t sphereCount;
+		uint32_t materialCount;
+		uint32_t reserved;
+		uint64_t nameOffset;
+		uint64_t sphereOffset;
+		uint64_t materialOffset;
+	};
+
+	//Follows Header from version 2
+	struct InstancingHeader {
+		uint32_t groupCount;
+		uint32_t groupSphereCount;
+		uint32_t instanceCount;
+		uint32_t groupNamesLength;
+		uint64_t groupOffset;
+		uint64_t groupSphereOffset;
+		uint64_t instanceOffset;
+		uint64_t groupNamesOffset;
+	};
+
+	//Follows InstancingHeader from version 3
+	struct MeshingHeader {
+		uint32_t meshCount;
+		uint32_t vertexCount;
+		uint32_t normalCount;
+		uint32_t indexCount;
+		uint32_t pathsLength;
+		uint32_t reserved;
+		uint64_t meshOffset;
+		uint64_t vertexOffset;
+		uint64_t normalOffset;
+		uint64_t indexOffset;
+		uint64_t pathsOffset;
+	};
+
+	//Follows MeshingHeader from version 4
+	struct ShapesHeader {
+		uint32_t planeCount;
+		uint32_t boxCount;
+		uint64_t planeOffset;
+		uint64_t boxOffset;
+		uint64_t reserved;
+	};
+
+	//Follows ShapesHeader from version 5, there is one EmissionRecord per material
+	struct LightingHeader {
+		uint64_t emissionOffset;
+		uint64_t reserved;
+	};
+
+	//Spheres of a group are a run of the group sphere array, names a run of the group names block
+	struct GroupRecord {
+		uint32_t firstSphere;
+		uint32_t sphereCount;
+		uint32_t nameStart;
+		uint32_t nameLength;
+	};
+
+	struct InstanceRecord {
+		uint32_t groupIndex;
+		float position[3];
+		float rotation[3];
+		float scale[3];
+	};
+
+	//Geometry is stored in the file, the path only records where the mesh was loaded from.
+	//normalCount is either 0 or vertexCount.
+	struct MeshRecord {
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		uint32_t firstNormal;
+		uint32_t normalCount;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t pathStart;
+		uint32_t pathLength;
+		int32_t materialIndex;
+		uint32_t reserved;
+	};
+
+	struct PlaneRecord {
+		float normal[3];
+		float offset;
+		int32_t materialIndex;
+	};
+
+	struct BoxRecord {
+		float min[3];
+		float max[3];
+		int32_t materialIndex;
+	};
+
+	struct SphereRecord {
+		float position[3];
+		float radius;
+		int32_t materialIndex;
+	};
+
+	struct MaterialRecord {
+		float albedo[3];
+		float roughness;
+		float metallic;
+	};
+
+	struct EmissionRecord {
+		float color[3];
+		float power;
+	};
+
+	static_assert(sizeof(Header) == 48, "BinaryScene::Header layout changed");
+	static_assert(sizeof(SphereRecord) == 20, "BinaryScene::SphereRecord layout changed");
+	static_assert(sizeof(MaterialRecord) == 20, "BinaryScene::MaterialRecord layout changed");
+	static_assert(sizeof(InstancingHeader) == 48, "BinaryScene::InstancingHeader layout changed");
+	static_assert(sizeof(GroupRecord) == 16, "BinaryScene::GroupRecord layout changed");
+	static_assert(sizeof(InstanceRecord) == 40, "BinaryScene::InstanceRecord layout changed");
+	static_assert(sizeof(MeshingHeader) == 64, "BinaryScene::MeshingHeader layout changed");
+	static_assert(sizeof(MeshRecord) == 40, "BinaryScene::MeshRecord layout changed");
+	static_assert(sizeof(ShapesHeader) == 32, "BinaryScene::ShapesHeader layout changed");
+	static_assert(sizeof(PlaneRecord) == 20, "BinaryScene::PlaneRecord layout changed");
+	static_assert(sizeof(BoxRecord) == 28, "BinaryScene::BoxRecord layout changed");
+	static_assert(sizeof(LightingHeader) == 16, "BinaryScene::LightingHeader layout changed");
+	static_assert(sizeof(EmissionRecord) == 16, "BinaryScene::EmissionRecord layout changed");
+
+	static uint64_t Align(uint64_t offset) {
+		return (offset + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+	}
+
+	static bool InBounds(uint64_t offset, uint64_t count, uint64_t stride, size_t size) {
+		if (offset > size) return false;
+		return count <= (size - offset) / stride;
+	}
+
+	static void WriteSpheres(const std::vector<Sphere>& spheres, uint8_t* destination) {
+		SphereRecord* records = (SphereRecord*)destination;
+		for (size_t i = 0; i < spheres.size(); i++) {
+			const Sphere& sphere = spheres[i];
+			records[i] = { { sphere.pos.x, sphere.pos.y, sphere.pos.z }, sphere.radius, sphere.materialIndex };
+		}
+	}
+
+	static void WriteVectors(const std::vector<glm::vec3>& vectors, uint8_t* destination) {
+		float* values = (float*)destination;
+		for (size_t i = 0; i < vectors.size(); i++) {
+			values[i * 3 + 0] = vectors[i].x;
+			values[i * 3 + 1] = vectors[i].y;
+			values[i * 3 + 2] = vectors[i].z;
+		}
+	}
+
+	static void ReadVectors(const uint8_t* source, uint32_t count, std::vector<glm::vec3>& vectors) {
+		vectors.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			float values[3];
+			memcpy(values, source + i * sizeof(values), sizeof(values));
+			vectors[i] = { values[0], values[1], values[2] };
+		}
+	}
+
+	//Records are copied straight out of the mapping, nothing is parsed
+	static void ReadSpheres(const uint8_t* source, uint32_t count, std::vector<Sphere>& spheres) {
+		spheres.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			SphereRecord record;
+			memcpy(&record, source + i * sizeof(SphereRecord), sizeof(SphereRecord));
+
+			Sphere& sphere = spheres[i];
+			sphere.pos = { record.position[0], record.position[1], record.position[2] };
+			sphere.radius = record.radius;
+			sphere.materialIndex = record.materialIndex;
+		}
+	}
+}
+
+namespace TextScene {
+	static const size_t ChunkSize = 1 << 20;
+
+	static bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static std::string_view Trim(std::string_view text) {
+		while (!text.empty() && IsSpace(text.front())) text.remove_prefix(1);
+		while (!text.empty() && IsSpace(text.back())) text.remove_suffix(1);
+		return text;
+	}
+
+	static bool EqualsIgnoreCase(std::string_view text, std::string_view lower) {
+		if (text.size() != lower.size()) return false;
+		for (size_t i = 0; i < text.size(); i++) {
+			char c = text[i];
+			if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+			if (c != lower[i]) return false;
+		}
+		return true;
+	}
+
+	//Exact for decimals with a mantissa below 2^24 and a small exponent: both operands are exact floats,
+	//so the single multiply/divide is correctly rounded (Clinger's fast path). Anything else goes to from_chars.
+	static std::from_chars_result ParseNumber(const char* first, const char* last, float& value) {
+		static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+		const char* it = first;
+		bool negative = it < last && *it == '-';
+		if (negative) it++;
+
+		uint32_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; it < last && *it >= '0' && *it <= '9'; it++, digits++) mantissa = mantissa * 10 + (*it - '0');
+		if (it < last && *it == '.') {
+			for (it++; it < last && *it >= '0' && *it <= '9'; it++, digits++, exponent--) mantissa = mantissa * 10 + (*it - '0');
+		}
+
+		bool simple = digits > 0 && digits <= 7 && (it == last || (*it != 'e' && *it != 'E'));
+		if (!simple || exponent < -10) return std::from_chars(first, last, value);
+
+		float result = (float)mantissa / powers[-exponent];
+		value = negative ? -result : result;
+		return { it, std::errc() };
+	}
+
+	template<typename T>
+	static std::from_chars_result ParseNumber(const char* first, const char* last, T& value) {
+		return std::from_chars(first, last, value);
+	}
+
+	//Floats are written as the shortest text that reads back as the same value, so converting a scene loses nothing
+	struct Exact {
+		float value;
+	};
+
+	struct ExactVec3 {
+		const glm::vec3& value;
+	};
+
+	static std::ostream& operator<<(std::ostream& out, Exact number) {
+		char text[32];
+		std::to_chars_result result = std::to_chars(text, text + sizeof(text), number.value);
+		return out.write(text, result.ptr - text);
+	}
+
+	static std::ostream& operator<<(std::ostream& out, ExactVec3 vector) {
+		return out << Exact{ vector.value.x } << ", " << Exact{ vector.value.y } << ", " << Exact{ vector.value.z };
+	}
+
+	//Comma-separated values, whitespace around each value is ignored
+	template<typename T>
+	static bool ParseValues(std::string_view text, T* values, int count) {
+		const char* it = text.data();
+		const char* end = it + text.size();
+
+		for (int i = 0; i < count; i++) {
+			while (it < end && IsSpace(*it)) it++;
+
+			std::from_chars_result result = ParseNumber(it, end, values[i]);
+			if (result.ec != std::errc()) return false;
+
+			it = result.ptr;
+			while (it < end && IsSpace(*it)) it++;
+
+			if (i + 1 < count) {
+				if (it == end || *it != ',') return false;
+				it++;
+			}
+		}
+
+		return it == end;
+	}
+
+	//Line-at-a-time parser, appends straight into the scene and never allocates per line
+	class Parser
+	{
+	public:
+		//Relative mesh paths are resolved against directory, normally the one holding the scene file
+		Parser(Scene& scene, const std::filesystem::path& directory)
+			: _scene(scene), _directory(directory)
+		{
+		}
+
+		bool ParseLine(std::string_view line) {
+			_line++;
+
+			line = Trim(line);
+			if (line.empty()) return true;
+
+			if (_node == Node::None) {
+				if (line.back() != '(') return Error("expected a node such as \"sphere (\", got \"" + std::string(line) + "\"");
+
+				std::string_view name = Trim(line.substr(0, line.size() - 1));
+				if (EqualsIgnoreCase(name, "scene")) _node = Node::Scene;
+				else if (EqualsIgnoreCase(name, "sphere")) {
+					_node = Node::Sphere;
+					_sphere = &_scene.spheres.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "group")) {
+					_node = Node::Group;
+					_scene.groups.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "instance")) {
+					_node = Node::Instance;
+					_scene.instances.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "plane")) {
+					_node = Node::Plane;
+					_scene.planes.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "box")) {
+					_node = Node::Box;
+					_scene.boxes.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "mesh")) {
+					_node = Node::Mesh;
+					_scene.meshes.emplace_back();
+				}
+				else if (EqualsIgnoreCase(name, "material")) {
+					_node = Node::Material;
+					_scene.materials.emplace_back();
+				}
+				else {
+					//Nodes from newer writers are skipped
+					_node = Node::Unknown;
+				}
+
+				_nodeLine = _line;
+				return true;
+			}
+
+			if (line.front() == ')') {
+				if (line.size() != 1) return Error("unexpected text after \")\"");
+
+				Node node = _node;
+				_node = Node::None;
+				return node == Node::Mesh ? LoadMesh() : true;
+			}
+
+			if (_node == Node::Unknown) return true;
+
+			size_t colon = line.find(':');
+			if (colon == std::string_view::npos) return Error("expected \"key: value\", got \"" + std::string(line) + "\"");
+
+			return ParseAttribute(Trim(line.substr(0, colon)), Trim(line.substr(colon + 1)));
+		}
+
+		bool Finish() {
+			if (_node != Node::None) {
+				_line = _nodeLine;
+				return Error("node is missing its closing \")\"");
+			}
+
+			//Materials may come after the nodes using them, so indices can only be checked once all are read
+			if (_maxMaterialIndex >= 0 && (size_t)_maxMaterialIndex >= _scene.materials.size()) {
+				_line = _maxMaterialLine;
+				return Error("materialIndex " + std::to_string(_maxMaterialIndex) + " refers to a missing material, the scene has "
+					+ std::to_string(_scene.materials.size()) + " materials");
+			}
+
+			//Elements without a materialIndex use material 0, which has to exist as well
+			std::string missingMaterial = Utils::DescribeMissingMaterial(_scene);
+			if (!missingMaterial.empty()) {
+				_error = missingMaterial;
+				return false;
+			}
+
+			return true;
+		}
+
+		const std::string& GetError() const { return _error; }
+
+	private:
+		bool ParseAttribute(std::string_view key, std::string_view value) {
+			bool valid = true;
+			float v[3];
+
+			if (_node == Node::Scene) {
+				if (key == "scenename") _scene.name.assign(value);
+			}
+			else if (_node == Node::Sphere) {
+				Sphere& sphere = *_sphere;
+
+				if (key == "groupIndex") {
+					uint32_t groupIndex = 0;
+					if (!ParseValues(value, &groupIndex, 1)) return Error("invalid value for groupIndex: \"" + std::string(value) + "\"");
+					if (groupIndex >= _scene.groups.size()) return Error("groupIndex " + std::to_string(groupIndex) + " refers to a group that is not declared before it");
+
+					if (_scene.spheres.empty() || _sphere != &_scene.spheres.back()) return Error("groupIndex given twice");
+
+					//Spheres start out in the scene, move this one into its group
+					std::vector<Sphere>& groupSpheres = _scene.groups[groupIndex].spheres;
+					groupSpheres.push_back(sphere);
+					_scene.spheres.pop_back();
+
+					_sphere = &groupSpheres.back();
+				}
+				else if (key == "position") {
+					valid = ParseValues(value, v, 3);
+					sphere.pos = { v[0], v[1], v[2] };
+				}
+				else if (key == "radius") valid = ParseValues(value, &sphere.radius, 1);
+				else if (key == "materialIndex") valid = ParseMaterialIndex(value, sphere.materialIndex);
+			}
+			else if (_node == Node::Material) {
+				Material& mat = _scene.materials.back();
+
+				if (key == "albedo") {
+					valid = ParseValues(value, v, 3);
+					mat.albedo = { v[0], v[1], v[2] };
+				}
+				else if (key == "roughness") valid = ParseValues(value, &mat.roughness, 1);
+				else if (key == "metallic") valid = ParseValues(value, &mat.metallic, 1);
+				else if (key == "emissionColor") {
+					valid = ParseValues(value, v, 3);
+					mat.emissionColor = { v[0], v[1], v[2] };
+				}
+				else if (key == "emissionPower") valid = ParseValues(value, &mat.emissionPower, 1);
+			}
+			else if (_node == Node::Group) {
+				if (key == "name") _scene.groups.back().name.assign(value);
+			}
+			else if (_node == Node::Plane) {
+				Plane& plane = _scene.planes.back();
+
+				if (key == "normal") {
+					valid = ParseValues(value, v, 3);
+					plane.normal = { v[0], v[1], v[2] };
+				}
+				else if (key == "offset") valid = ParseValues(value, &plane.offset, 1);
+				else if (key == "materialIndex") valid = ParseMaterialIndex(value, plane.materialIndex);
+			}
+			else if (_node == Node::Box) {
+				Box& box = _scene.boxes.back();
+
+				if (key == "min") {
+					valid = ParseValues(value, v, 3);
+					box.min = { v[0], v[1], v[2] };
+				}
+				else if (key == "max") {
+					valid = ParseValues(value, v, 3);
+					box.max = { v[0], v[1], v[2] };
+				}
+				else if (key == "materialIndex") valid = ParseMaterialIndex(value, box.materialIndex);
+			}
+			else if (_node == Node::Mesh) {
+				Mesh& mesh = _scene.meshes.back();
+
+				if (key == "path") mesh.path.assign(value);
+				else if (key == "materialIndex") valid = ParseMaterialIndex(value, mesh.materialIndex);
+			}
+			else if (_node == Node::Instance) {
+				Instance& instance = _scene.instances.back();
+
+				if (key == "groupIndex") {
+					valid = ParseValues(value, &instance.groupIndex, 1);
+					if (valid && instance.groupIndex >= _scene.groups.size()) return Error("groupIndex " + std::to_string(instance.groupIndex) + " refers to a group that is not declared before it");
+				}
+				else if (key == "position") {
+					valid = ParseValues(value, v, 3);
+					instance.position = { v[0], v[1], v[2] };
+				}
+				else if (key == "rotation") {
+					valid = ParseValues(value, v, 3);
+					instance.rotation = { v[0], v[1], v[2] };
+				}
+				else if (key == "scale") {
+					valid = ParseValues(value, v, 3);
+					instance.scale = { v[0], v[1], v[2] };
+				}
+			}
+
+			if (!valid) return Error("invalid value for " + std::string(key) + ": \"" + std::string(value) + "\"");
+			return true;
+		}
+
+		//Remembers the largest index and where it was given, for Finish to check
+		bool ParseMaterialIndex(std::string_view value, int& materialIndex) {
+			if (!ParseValues(value, &materialIndex, 1) || materialIndex < 0) return false;
+
+			if (materialIndex > _maxMaterialIndex) {
+				_maxMaterialIndex = materialIndex;
+				_maxMaterialLine = _line;
+			}
+			return true;
+		}
+
+		//Meshes are read once their node closes, errors point at the node's first line
+		bool LoadMesh() {
+			Mesh& mesh = _scene.meshes.back();
+			if (mesh.path.empty()) {
+				_line = _nodeLine;
+				return Error("mesh has no path");
+			}
+
+			std::filesystem::path path = std::filesystem::u8path(mesh.path);
+			if (path.is_relative()) path = _directory / path;
+
+			std::string written = mesh.path, error;
+			if (!mesh.LoadOBJ(path.u8string(), error)) {
+				_line = _nodeLine;
+				return Error(error);
+			}
+
+			//Keep the path as written so saving the scene again does not make it absolute
+			mesh.path = written;
+			return true;
+		}
+
+		bool Error(const std::string& message) {
+			_error = "line " + std::to_string(_line) + ": " + message;
+			return false;
+		}
+
+	private:
+		enum class Node { None, Scene, Sphere, Material, Group, Instance, Plane, Box, Mesh, Unknown };
+
+		Scene& _scene;
+		std::filesystem::path _directory;
+		Node _node = Node::None;
+		//Sphere being parsed, in Scene::spheres or in a group once its groupIndex is read
+		Sphere* _sphere = nullptr;
+		uint64_t _line = 0;
+		uint64_t _nodeLine = 0;
+		int _maxMaterialIndex = -1;
+		uint64_t _maxMaterialLine = 0;
+		std::string _error;
+	};
+}
+
+SceneSerializer::SceneSerializer(Scene& scene)
+	: _scene(scene)
+{
+}
+
+bool SceneSerializer::IsBinaryPath(const std::string& filepath)
+{
+	static const std::string extension = ".bscene";
+	return filepath.size() >= extension.size() &&
+		filepath.compare(filepath.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool SceneSerializer::Serialize(const std::string& filepath)
+{
+	if (IsBinaryPath(filepath)) return SerializeBinary(filepath);
+	return SerializeText(filepath);
+}
+
+bool SceneSerializer::Deserialize(const std::string& filepath)
+{
+	if (IsBinaryPath(filepath)) return DeserializeBinary(filepath);
+	return DeserializeText(filepath);
+}
+
+void SceneSerializer::SerializeBinary(std::vector<uint8_t>& buffer)
+{
+	using namespace BinaryScene;
+
+	InstancingHeader instancing = {};
+	instancing.groupCount = (uint32_t)_scene.groups.size();
+	instancing.instanceCount = (uint32_t)_scene.instances.size();
+	for (const SphereGroup& group : _scene.groups) {
+		instancing.groupSphereCount += (uint32_t)group.spheres.size();
+		instancing.groupNamesLength += (uint32_t)group.name.size();
+	}
+
+	MeshingHeader meshing = {};
+	meshing.meshCount = (uint32_t)_scene.meshes.size();
+	for (const Mesh& mesh : _scene.meshes) {
+		meshing.vertexCount += (uint32_t)mesh.positions.size();
+		meshing.normalCount += (uint32_t)mesh.normals.size();
+		meshing.indexCount += (uint32_t)mesh.indices.size();
+		meshing.pathsLength += (uint32_t)mesh.path.size();
+	}
+
+	ShapesHeader shapes = {};
+	shapes.planeCount = (uint32_t)_scene.planes.size();
+	shapes.boxCount = (uint32_t)_scene.boxes.size();
+
+	LightingHeader lighting = {};
+
+	Header header = {};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.nameLength = (uint32_t)_scene.name.size();
+	header.sphereCount = (uint32_t)_scene.spheres.size();
+	header.materialCount = (uint32_t)_scene.materials.size();
+	header.nameOffset = Align(sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader) + sizeof(ShapesHeader) + sizeof(LightingHeader));
+	header.sphereOffset = Align(header.nameOffset + header.nameLength);
+	header.materialOffset = Align(header.sphereOffset + header.sphereCount * sizeof(SphereRecord));
+
+	instancing.groupOffset = Align(header.materialOffset + header.materialCount * sizeof(MaterialRecord));
+	instancing.groupSphereOffset = Align(instancing.groupOffset + instancing.groupCount * sizeof(GroupRecord));
+	instancing.instanceOffset = Align(instancing.groupSphereOffset + instancing.groupSphereCount * sizeof(SphereRecord));
+	instancing.groupNamesOffset = Align(instancing.instanceOffset + instancing.instanceCount * sizeof(InstanceRecord));
+
+	meshing.meshOffset = Align(instancing.groupNamesOffset + instancing.groupNamesLength);
+	meshing.vertexOffset = Align(meshing.meshOffset + meshing.meshCount * sizeof(MeshRecord));
+	meshing.normalOffset = Align(meshing.vertexOffset + meshing.vertexCount * sizeof(glm::vec3));
+	meshing.indexOffset = Align(meshing.normalOffset + meshing.normalCount * sizeof(glm::vec3));
+	meshing.pathsOffset = Align(meshing.indexOffset + meshing.indexCount * sizeof(uint32_t));
+
+	shapes.planeOffset = Align(meshing.pathsOffset + meshing.pathsLength);
+	shapes.boxOffset = Align(shapes.planeOffset + shapes.planeCount * sizeof(PlaneRecord));
+
+	lighting.emissionOffset = Align(shapes.boxOffset + shapes.boxCount * sizeof(BoxRecord));
+
+	buffer.assign(lighting.emissionOffset + header.materialCount * sizeof(EmissionRecord), 0);
+	memcpy(buffer.data(), &header, sizeof(Header));
+	memcpy(buffer.data() + sizeof(Header), &instancing, sizeof(InstancingHeader));
+	memcpy(buffer.data() + sizeof(Header) + sizeof(InstancingHeader), &meshing, sizeof(MeshingHeader));
+	memcpy(buffer.data() + sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader), &shapes, sizeof(ShapesHeader));
+	memcpy(buffer.data() + sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader) + sizeof(ShapesHeader), &lighting, sizeof(LightingHeader));
+	memcpy(buffer.data() + header.nameOffset, _scene.name.data(), header.nameLength);
+
+	WriteSpheres(_scene.spheres, buffer.data() + header.sphereOffset);
+
+	MaterialRecord* materials = (MaterialRecord*)(buffer.data() + header.materialOffset);
+	EmissionRecord* emissions = (EmissionRecord*)(buffer.data() + lighting.emissionOffset);
+	for (uint32_t i = 0; i < header.materialCount; i++) {
+		const Material& mat = _scene.materials[i];
+		materials[i] = { { mat.albedo.x, mat.albedo.y, mat.albedo.z }, mat.roughness, mat.metallic };
+		emissions[i] = { { mat.emissionColor.x, mat.emissionColor.y, mat.emissionColor.z }, mat.emissionPower };
+	}
+
+	GroupRecord* groups = (GroupRecord*)(buffer.data() + instancing.groupOffset);
+	uint32_t firstSphere = 0, nameStart = 0;
+	for (uint32_t i = 0; i < instancing.groupCount; i++) {
+		const SphereGroup& group = _scene.groups[i];
+		groups[i] = { firstSphere, (uint32_t)group.spheres.size(), nameStart, (uint32_t)group.name.size() };
+
+		WriteSpheres(group.spheres, buffer.data() + instancing.groupSphereOffset + firstSphere * sizeof(SphereRecord));
+		memcpy(buffer.data() + instancing.groupNamesOffset + nameStart, group.name.data(), group.name.size());
+
+		firstSphere += (uint32_t)group.spheres.size();
+		nameStart += (uint32_t)group.name.size();
+	}
+
+	InstanceRecord* instances = (InstanceRecord*)(buffer.data() + instancing.instanceOffset);
+	for (uint32_t i = 0; i < instancing.instanceCount; i++) {
+		const Instance& instance = _scene.instances[i];
+		instances[i] = {
+			instance.groupIndex,
+			{ instance.position.x, instance.position.y, instance.position.z },
+			{ instance.rotation.x, instance.rotation.y, instance.rotation.z },
+			{ instance.scale.x, instance.scale.y, instance.scale.z }
+		};
+	}
+
+	MeshRecord* meshes = (MeshRecord*)(buffer.data() + meshing.meshOffset);
+	uint32_t firstVertex = 0, firstNormal = 0, firstIndex = 0, pathStart = 0;
+	for (uint32_t i = 0; i < meshing.meshCount; i++) {
+		const Mesh& mesh = _scene.meshes[i];
+		meshes[i] = {
+			firstVertex, (uint32_t)mesh.positions.size(),
+			firstNormal, (uint32_t)mesh.normals.size(),
+			firstIndex, (uint32_t)mesh.indices.size(),
+			pathStart, (uint32_t)mesh.path.size(),
+			mesh.materialIndex, 0
+		};
+
+		WriteVectors(mesh.positions, buffer.data() + meshing.vertexOffset + firstVertex * sizeof(glm::vec3));
+		WriteVectors(mesh.normals, buffer.data() + meshing.normalOffset + firstNormal * sizeof(glm::vec3));
+		memcpy(buffer.data() + meshing.indexOffset + firstIndex * sizeof(uint32_t), mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		memcpy(buffer.data() + meshing.pathsOffset + pathStart, mesh.path.data(), mesh.path.size());
+
+		firstVertex += (uint32_t)mesh.positions.size();
+		firstNormal += (uint32_t)mesh.normals.size();
+		firstIndex += (uint32_t)mesh.indices.size();
+		pathStart += (uint32_t)mesh.path.size();
+	}
+
+	PlaneRecord* planes = (PlaneRecord*)(buffer.data() + shapes.planeOffset);
+	for (uint32_t i = 0; i < shapes.planeCount; i++) {
+		const Plane& plane = _scene.planes[i];
+		planes[i] = { { plane.normal.x, plane.normal.y, plane.normal.z }, plane.offset, plane.materialIndex };
+	}
+
+	BoxRecord* boxes = (BoxRecord*)(buffer.data() + shapes.boxOffset);
+	for (uint32_t i = 0; i < shapes.boxCount; i++) {
+		const Box& box = _scene.boxes[i];
+		boxes[i] = { { box.min.x, box.min.y, box.min.z }, { box.max.x, box.max.y, box.max.z }, box.materialIndex };
+	}
+}
+
+bool SceneSerializer::DeserializeBinary(const uint8_t* data, size_t size)
+{
+	using namespace BinaryScene;
+
+	if (!data || size < sizeof(Header)) return SetError("file is too small for a binary scene header");
+
+	Header header;
+	memcpy(&header, data, sizeof(Header));
+
+	if (memcmp(header.magic, Magic, sizeof(Magic)) != 0) return SetError("not a binary scene");
+	if (header.version == 0 || header.version > Version) return SetError("unsupported binary scene version " + std::to_string(header.version));
+
+	InstancingHeader instancing = {};
+	if (header.version >= 2) {
+		if (size < sizeof(Header) + sizeof(InstancingHeader)) return SetError("binary scene is truncated");
+		memcpy(&instancing, data + sizeof(Header), sizeof(InstancingHeader));
+	}
+
+	MeshingHeader meshing = {};
+	if (header.version >= 3) {
+		if (size < sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader)) return SetError("binary scene is truncated");
+		memcpy(&meshing, data + sizeof(Header) + sizeof(InstancingHeader), sizeof(MeshingHeader));
+	}
+
+	ShapesHeader shapes = {};
+	if (header.version >= 4) {
+		if (size < sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader) + sizeof(ShapesHeader)) return SetError("binary scene is truncated");
+		memcpy(&shapes, data + sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader), sizeof(ShapesHeader));
+	}
+
+	LightingHeader lighting = {};
+	uint32_t emissionCount = 0;
+	if (header.version >= 5) {
+		if (size < sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader) + sizeof(ShapesHeader) + sizeof(LightingHeader)) return SetError("binary scene is truncated");
+		memcpy(&lighting, data + sizeof(Header) + sizeof(InstancingHeader) + sizeof(MeshingHeader) + sizeof(ShapesHeader), sizeof(LightingHeader));
+		emissionCount = header.materialCount;
+	}
+
+	if (!InBounds(header.nameOffset, header.nameLength, 1, size) ||
+		!InBounds(header.sphereOffset, header.sphereCount, sizeof(SphereRecord), size) ||
+		!InBounds(header.materialOffset, header.materialCount, sizeof(MaterialRecord), size) ||
+		!InBounds(instancing.groupOffset, instancing.groupCount, sizeof(GroupRecord), size) ||
+		!InBounds(instancing.groupSphereOffset, instancing.groupSphereCount, sizeof(SphereRecord), size) ||
+		!InBounds(instancing.instanceOffset, instancing.instanceCount, sizeof(InstanceRecord), size) ||
+		!InBounds(instancing.groupNamesOffset, instancing.groupNamesLength, 1, size) ||
+		!InBounds(meshing.meshOffset, meshing.meshCount, sizeof(MeshRecord), size) ||
+		!InBounds(meshing.vertexOffset, meshing.vertexCount, sizeof(glm::vec3), size) ||
+		!InBounds(meshing.normalOffset, meshing.normalCount, sizeof(glm::vec3), size) ||
+		!InBounds(meshing.indexOffset, meshing.indexCount, sizeof(uint32_t), size) ||
+		!InBounds(meshing.pathsOffset, meshing.pathsLength, 1, size) ||
+		!InBounds(shapes.planeOffset, shapes.planeCount, sizeof(PlaneRecord), size) ||
+		!InBounds(shapes.boxOffset, shapes.boxCount, sizeof(BoxRecord), size) ||
+		!InBounds(lighting.emissionOffset, emissionCount, sizeof(EmissionRecord), size)) {
+		return SetError("binary scene is truncated");
+	}
+
+	Scene ns;
+	ns.name.assign((const char*)data + header.nameOffset, header.nameLength);
+
+	ReadSpheres(data + header.sphereOffset, header.sphereCount, ns.spheres);
+
+	ns.materials.resize(header.materialCount);
+	const MaterialRecord* materials = (const MaterialRecord*)(data + header.materialOffset);
+	for (uint32_t i = 0; i < header.materialCount; i++) {
+		MaterialRecord record;
+		memcpy(&record, materials + i, sizeof(MaterialRecord));
+
+		Material& mat = ns.materials[i];
+		mat.albedo = { record.albedo[0], record.albedo[1], record.albedo[2] };
+		mat.roughness = record.roughness;
+		mat.metallic = record.metallic;
+
+		if (i < emissionCount) {
+			EmissionRecord emission;
+			memcpy(&emission, data + lighting.emissionOffset + i * sizeof(EmissionRecord), sizeof(EmissionRecord));
+
+			mat.emissionColor = { emission.color[0], emission.color[1], emission.color[2] };
+			mat.emissionPower = emission.power;
+		}
+	}
+
+	ns.groups.resize(instancing.groupCount);
+	for (uint32_t i = 0; i < instancing.groupCount; i++) {
+		GroupRecord record;
+		memcpy(&record, data + instancing.groupOffset + i * sizeof(GroupRecord), sizeof(GroupRecord));
+
+		if ((uint64_t)record.firstSphere + record.sphereCount > instancing.groupSphereCount ||
+			(uint64_t)record.nameStart + record.nameLength > instancing.groupNamesLength) {
+			return SetError("group " + std::to_string(i) + " lies outside the group data");
+		}
+
+		SphereGroup& group = ns.groups[i];
+		group.name.assign((const char*)data + instancing.groupNamesOffset + record.nameStart, record.nameLength);
+		ReadSpheres(data + instancing.groupSphereOffset + record.firstSphere * sizeof(SphereRecord), record.sphereCount, group.spheres);
+	}
+
+	ns.instances.resize(instancing.instanceCount);
+	for (uint32_t i = 0; i < instancing.instanceCount; i++) {
+		InstanceRecord record;
+		memcpy(&record, data + instancing.instanceOffset + i * sizeof(InstanceRecord), sizeof(InstanceRecord));
+
+		if (record.groupIndex >= instancing.groupCount) return SetError("instance " + std::to_string(i) + " refers to missing group " + std::to_string(record.groupIndex));
+
+		Instance& instance = ns.instances[i];
+		instance.groupIndex = record.groupIndex;
+		instance.position = { record.position[0], record.position[1], record.position[2] };
+		instance.rotation = { record.rotation[0], record.rotation[1], record.rotation[2] };
+		instance.scale = { record.scale[0], record.scale[1], record.scale[2] };
+	}
+
+	ns.meshes.resize(meshing.meshCount);
+	for (uint32_t i = 0; i < meshing.meshCount; i++) {
+		MeshRecord record;
+		memcpy(&record, data + meshing.meshOffset + i * sizeof(MeshRecord), sizeof(MeshRecord));
+
+		if ((uint64_t)record.firstVertex + record.vertexCount > meshing.vertexCount ||
+			(uint64_t)record.firstNormal + record.normalCount > meshing.normalCount ||
+			(uint64_t)record.firstIndex + record.indexCount > meshing.indexCount ||
+			(uint64_t)record.pathStart + record.pathLength > meshing.pathsLength ||
+			(record.normalCount != 0 && record.normalCount != record.vertexCount) || record.indexCount % 3 != 0) {
+			return SetError("mesh " + std::to_string(i) + " lies outside the mesh data");
+		}
+
+		Mesh& mesh = ns.meshes[i];
+		mesh.path.assign((const char*)data + meshing.pathsOffset + record.pathStart, record.pathLength);
+		mesh.materialIndex = record.materialIndex;
+		ReadVectors(data + meshing.vertexOffset + record.firstVertex * sizeof(glm::vec3), record.vertexCount, mesh.positions);
+		ReadVectors(data + meshing.normalOffset + record.firstNormal * sizeof(glm::vec3), record.normalCount, mesh.normals);
+
+		mesh.indices.resize(record.indexCount);
+		memcpy(mesh.indices.data(), data + meshing.indexOffset + record.firstIndex * sizeof(uint32_t), record.indexCount * sizeof(uint32_t));
+
+		for (uint32_t index : mesh.indices) {
+			if (index >= record.vertexCount) return SetError("mesh " + std::to_string(i) + " has an index past its vertices");
+		}
+	}
+
+	ns.planes.resize(shapes.planeCount);
+	for (uint32_t i = 0; i < shapes.planeCount; i++) {
+		PlaneRecord record;
+		memcpy(&record, data + shapes.planeOffset + i * sizeof(PlaneRecord), sizeof(PlaneRecord));
+
+		Plane& plane = ns.planes[i];
+		plane.normal = { record.normal[0], record.normal[1], record.normal[2] };
+		plane.offset = record.offset;
+		plane.materialIndex = record.materialIndex;
+	}
+
+	ns.boxes.resize(shapes.boxCount);
+	for (uint32_t i = 0; i < shapes.boxCount; i++) {
+		BoxRecord record;
+		memcpy(&record, data + shapes.boxOffset + i * sizeof(BoxRecord), sizeof(BoxRecord));
+
+		Box& box = ns.boxes[i];
+		box.min = { record.min[0], record.min[1], record.min[2] };
+		box.max = { record.max[0], record.max[1], record.max[2] };
+		box.materialIndex = record.materialIndex;
+	}
+
+	//Workers get this buffer straight from the network
+	std::string missingMaterial = Utils::DescribeMissingMaterial(ns);
+	if (!missingMaterial.empty()) return SetError(missingMaterial);
+
+	_scene = std::move(ns);
+	_error.clear();
+
+	return true;
+}
+
+bool SceneSerializer::SerializeBinary(const std::string& filepath)
+{
+	std::vector<uint8_t> buffer;
+	SerializeBinary(buffer);
+
+	std::ofstream file(filepath, std::ios::binary);
+	if (!file.good()) return SetError("cannot write " + filepath);
+
+	file.write((const char*)buffer.data(), buffer.size());
+	return file.good();
+}
+
+bool SceneSerializer::DeserializeBinary(const std::string& filepath)
+{
+	MappedFile file;
+	if (!file.Open(filepath)) return SetError("cannot open " + filepath);
+
+	return DeserializeBinary(file.GetData(), file.GetSize());
+}
+
+bool SceneSerializer::SerializeText(const std::string& filepath)
+{
+	std::stringstream ss;
+
+	ss << "Scene (\n";
+	ss << "\tscenename: " << _scene.name << "\n";
+	ss << ")\n";
+
+	for (size_t i = 0; i < _scene.spheres.size(); i++) {
+		const Sphere& sphere = _scene.spheres[i];
+
+		ss << "sphere (\n";
+		ss << "\tposition: " << TextScene::ExactVec3{ sphere.pos } << "\n";
+		ss << "\tradius: " << TextScene::Exact{ sphere.radius } << "\n";
+		ss << "\tmaterialIndex: " << sphere.materialIndex << "\n";
+		ss << ")\n";
+	}
+
+	//Groups come before their spheres and instances so the loader can check every groupIndex as it reads it
+	for (size_t i = 0; i < _scene.groups.size(); i++) {
+		ss << "group (\n";
+		ss << "\tname: " << _scene.groups[i].name << "\n";
+		ss << ")\n";
+	}
+
+	for (size_t i = 0; i < _scene.groups.size(); i++) {
+		for (const Sphere& sphere : _scene.groups[i].spheres) {
+			ss << "sphere (\n";
+			ss << "\tgroupIndex: " << i << "\n";
+			ss << "\tposition: " << TextScene::ExactVec3{ sphere.pos } << "\n";
+			ss << "\tradius: " << TextScene::Exact{ sphere.radius } << "\n";
+			ss << "\tmaterialIndex: " << sphere.materialIndex << "\n";
+			ss << ")\n";
+		}
+	}
+
+	for (size_t i = 0; i < _scene.instances.size(); i++) {
+		const Instance& instance = _scene.instances[i];
+
+		ss << "instance (\n";
+		ss << "\tgroupIndex: " << instance.groupIndex << "\n";
+		ss << "\tposition: " << TextScene::ExactVec3{ instance.position } << "\n";
+		ss << "\trotation: " << TextScene::ExactVec3{ instance.rotation } << "\n";
+		ss << "\tscale: " << TextScene::ExactVec3{ instance.scale } << "\n";
+		ss << ")\n";
+	}
+
+	for (size_t i = 0; i < _scene.planes.size(); i++) {
+		const Plane& plane = _scene.planes[i];
+
+		ss << "plane (\n";
+		ss << "\tnormal: " << TextScene::ExactVec3{ plane.normal } << "\n";
+		ss << "\toffset: " << TextScene::Exact{ plane.offset } << "\n";
+		ss << "\tmaterialIndex: " << plane.materialIndex << "\n";
+		ss << ")\n";
+	}
+
+	for (size_t i = 0; i < _scene.boxes.size(); i++) {
+		const Box& box = _scene.boxes[i];
+
+		ss << "box (\n";
+		ss << "\tmin: " << TextScene::ExactVec3{ box.min } << "\n";
+		ss << "\tmax: " << TextScene::ExactVec3{ box.max } << "\n";
+		ss << "\tmaterialIndex: " << box.materialIndex << "\n";
+		ss << ")\n";
+	}
+
+	//Only the path is written, the OBJ is read again on load
+	for (size_t i = 0; i < _scene.meshes.size(); i++) {
+		const Mesh& mesh = _scene.meshes[i];
+
+		ss << "mesh (\n";
+		ss << "\tpath: " << mesh.path << "\n";
+		ss << "\tmaterialIndex: " << mesh.materialIndex << "\n";
+		ss << ")\n";
+	}
+
+	for (size_t i = 0; i < _scene.materials.size(); i++) {
+		const Material& mat = _scene.materials[i];
+
+		ss << "material (\n";
+		ss << "\talbedo: " << TextScene::ExactVec3{ mat.albedo } << "\n";
+		ss << "\troughness: " << TextScene::Exact{ mat.roughness } << "\n";
+		ss << "\tmetallic: " << TextScene::Exact{ mat.metallic } << "\n";
+		ss << "\temissionColor: " << TextScene::ExactVec3{ mat.emissionColor } << "\n";
+		ss << "\temissionPower: " << TextScene::Exact{ mat.emissionPower } << "\n";
+		ss << ")\n";
+	}
+
+	std::ofstream file(filepath);
+	if (!file.good()) return SetError("cannot write " + filepath);
+
+	file.write(ss.str().c_str(), ss.str().length());
+	file.close();
+
+	return true;
+}
+
+bool SceneSerializer::DeserializeText(const std::string& filepath)
+{
+	std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+	if (!file.good()) return SetError("cannot open " + filepath);
+
+	uint64_t fileSize = (uint64_t)file.tellg();
+	file.seekg(0);
+
+	Scene ns;
+	TextScene::Parser parser(ns, std::filesystem::u8path(filepath).parent_path());
+
+	//The smallest sphere node the serializer writes is about 60 bytes, so this bounds the sphere count
+	ns.spheres.reserve((size_t)(fileSize / 56));
+
+	//Only whole lines are parsed, a partial line at the end of a chunk moves to the front of the next one
+	std::vector<char> buffer(TextScene::ChunkSize);
+	size_t carry = 0;
+
+	while (true) {
+		if (carry == buffer.size()) buffer.resize(buffer.size() * 2);
+
+		file.read(buffer.data() + carry, buffer.size() - carry);
+		size_t end = carry + (size_t)file.gcount();
+		bool eof = file.gcount() == 0;
+
+		if (eof) {
+			if (carry > 0 && !parser.ParseLine(std::string_view(buffer.data(), carry))) return SetError(parser.GetError());
+			break;
+		}
+
+		const char* data = buffer.data();
+		size_t lineStart = 0;
+		for (const char* newline; (newline = (const char*)memchr(data + lineStart, '\n', end - lineStart)) != nullptr;) {
+			size_t lineEnd = newline - data;
+			if (!parser.ParseLine(std::string_view(data + lineStart, lineEnd - lineStart))) return SetError(parser.GetError());
+			lineStart = lineEnd + 1;
+		}
+
+		carry = end - lineStart;
+		memmove(buffer.data(), data + lineStart, carry);
+	}
+
+	if (!parser.Finish()) return SetError(parser.GetError());
+
+	_scene = std::move(ns);
+	_error.clear();
+
+	return true;
+}
+
+bool SceneSerializer::SetError(const std::string& error)
+{
+	_error = error;
+	return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//Reads and writes scenes, the format is picked from the extension:
+//.bscene is the binary format, anything else the text .scene format
+class SceneSerializer
+{
+public:
+	SceneSerializer(Scene& scene);
+
+	bool Serialize(const std::string& filepath);
+	bool Deserialize(const std::string& filepath);
+
+	bool SerializeText(const std::string& filepath);
+	bool DeserializeText(const std::string& filepath);
+
+	bool SerializeBinary(const std::string& filepath);
+	bool DeserializeBinary(const std::string& filepath);
+
+	//In-memory binary scenes, the file format is exactly this buffer
+	void SerializeBinary(std::vector<uint8_t>& buffer);
+	bool DeserializeBinary(const uint8_t* data, size_t size);
+
+	static bool IsBinaryPath(const std::string& filepath);
+
+	//Reason the last Deserialize failed, with the line number for text scenes
+	const std::string& GetError() const { return _error; }
+
+private:
+	bool SetError(const std::string& error);
+
+private:
+	Scene& _scene;
+	std::string _error;
+};
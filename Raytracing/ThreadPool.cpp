@@ -0,0 +1,199 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	StartThreads(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	StopThreads();
+}
+
+void ThreadPool::SetThreadCount(uint32_t threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	if (threadCount == GetThreadCount()) return;
+
+	StopThreads();
+	StartThreads(threadCount);
+}
+
+void ThreadPool::StartThreads(uint32_t threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	_stopping = false;
+
+	_queues.clear();
+	for (uint32_t i = 0; i < threadCount; i++) {
+		_queues.emplace_back(std::make_unique<WorkQueue>());
+	}
+
+	//New workers only wake for jobs issued after they start, _generation keeps counting across restarts
+	uint64_t generation;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		generation = _generation;
+	}
+
+	//The thread calling ParallelFor acts as worker 0
+	for (uint32_t i = 1; i < threadCount; i++) {
+		_threads.emplace_back(&ThreadPool::WorkerLoop, this, i, generation);
+	}
+}
+
+void ThreadPool::StopThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeCondition.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+
+	_threads.clear();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIndex)>& job)
+{
+	if (count == 0) return;
+
+	uint32_t threadCount = GetThreadCount();
+	if (threadCount == 1 || count == 1) {
+		for (uint32_t i = 0; i < count; i++) {
+			job(i, 0);
+		}
+		return;
+	}
+
+	//Even initial split, contiguous so neighbouring tiles stay on one thread until stolen
+	for (uint32_t i = 0; i < threadCount; i++) {
+		WorkQueue& queue = *_queues[i];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.begin = (uint32_t)((uint64_t)count * i / threadCount);
+		queue.end = (uint32_t)((uint64_t)count * (i + 1) / threadCount);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_job = &job;
+		_remainingJobs = count;
+		_activeWorkers = threadCount - 1;
+		_generation++;
+	}
+	_wakeCondition.notify_all();
+
+	RunJobs(0);
+
+	//Wait for the other workers to leave the job before it goes out of scope
+	std::unique_lock<std::mutex> lock(_mutex);
+	_doneCondition.wait(lock, [this]() { return _activeWorkers == 0; });
+	_job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(uint32_t threadIndex, uint64_t seenGeneration)
+{
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeCondition.wait(lock, [&]() { return _stopping || _generation != seenGeneration; });
+
+			if (_stopping) return;
+			seenGeneration = _generation;
+		}
+
+		RunJobs(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_activeWorkers--;
+		}
+		_doneCondition.notify_one();
+	}
+}
+
+void ThreadPool::RunJobs(uint32_t threadIndex)
+{
+	if (!_job) return;
+	const std::function<void(uint32_t, uint32_t)>& job = *_job;
+
+	while (_remainingJobs.load(std::memory_order_acquire) > 0) {
+		uint32_t index;
+		if (PopJob(threadIndex, index)) {
+			job(index, threadIndex);
+			_remainingJobs.fetch_sub(1, std::memory_order_acq_rel);
+			continue;
+		}
+
+		if (!StealJobs(threadIndex)) {
+			//Everything left is already running on other threads
+			return;
+		}
+	}
+}
+
+bool ThreadPool::PopJob(uint32_t threadIndex, uint32_t& index)
+{
+	WorkQueue& queue = *_queues[threadIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.begin >= queue.end) return false;
+
+	index = queue.begin++;
+	return true;
+}
+
+bool ThreadPool::StealJobs(uint32_t threadIndex)
+{
+	uint32_t threadCount = GetThreadCount();
+
+	//Steal from the victim with the most work left
+	uint32_t victim = threadIndex;
+	uint32_t mostRemaining = 0;
+	for (uint32_t offset = 1; offset < threadCount; offset++) {
+		uint32_t i = (threadIndex + offset) % threadCount;
+		WorkQueue& queue = *_queues[i];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		uint32_t remaining = queue.end > queue.begin ? queue.end - queue.begin : 0;
+		if (remaining > mostRemaining) {
+			mostRemaining = remaining;
+			victim = i;
+		}
+	}
+
+	if (mostRemaining == 0) return false;
+
+	uint32_t stolenBegin, stolenEnd;
+	{
+		WorkQueue& queue = *_queues[victim];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		uint32_t remaining = queue.end > queue.begin ? queue.end - queue.begin : 0;
+		//The victim may have drained it since we looked, let the caller retry
+		if (remaining == 0) return true;
+
+		uint32_t stolen = (remaining + 1) / 2;
+		stolenEnd = queue.end;
+		stolenBegin = queue.end - stolen;
+		queue.end = stolenBegin;
+	}
+
+	WorkQueue& own = *_queues[threadIndex];
+	std::lock_guard<std::mutex> lock(own.mutex);
+	own.begin = stolenBegin;
+	own.end = stolenEnd;
+
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads running index-based parallel loops.
+//Each ParallelFor splits its index range evenly across the workers; a worker that runs out steals half of the
+//largest remaining range, so uneven jobs (sky tiles next to dense geometry) still finish together.
+class ThreadPool
+{
+public:
+	//threadCount 0 uses every hardware thread
+	ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void SetThreadCount(uint32_t threadCount);
+	uint32_t GetThreadCount() const { return (uint32_t)_queues.size(); }
+
+	//Calls job(index, threadIndex) for every index in [0, count) and returns when all have finished.
+	//threadIndex is in [0, GetThreadCount()) and is stable for the duration of one call, for per-thread scratch data.
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t threadIndex)>& job);
+
+private:
+	//Range of job indices owned by one worker, popped from the front by the owner and split from the back by thieves
+	struct WorkQueue {
+		std::mutex mutex;
+		uint32_t begin = 0;
+		uint32_t end = 0;
+	};
+
+	void StartThreads(uint32_t threadCount);
+	void StopThreads();
+
+	//seenGeneration is the _generation of the last job issued before the worker started
+	void WorkerLoop(uint32_t threadIndex, uint64_t seenGeneration);
+	void RunJobs(uint32_t threadIndex);
+	bool PopJob(uint32_t threadIndex, uint32_t& index);
+	bool StealJobs(uint32_t threadIndex);
+
+private:
+	std::vector<std::unique_ptr<WorkQueue>> _queues;
+	std::vector<std::thread> _threads;
+
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _doneCondition;
+
+	const std::function<void(uint32_t, uint32_t)>* _job = nullptr;
+	uint64_t _generation = 0;
+	uint32_t _activeWorkers = 0;
+	std::atomic<uint32_t> _remainingJobs{ 0 };
+	bool _stopping = false;
+};
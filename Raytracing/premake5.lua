@@ -5,7 +5,7 @@ project "Raytracing"
    targetdir "bin/%{cfg.buildcfg}"
    staticruntime "off"
 
-   files { "src/**.h", "src/**.cpp" }
+   files { "*.h", "*.cpp", "src/**.h", "src/**.cpp" }
 
    includedirs
    {
@@ -0,0 +1,92 @@
+#include "CameraController.h"
+
+#include "../Camera.h"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "Walnut/Input/Input.h"
+
+using namespace Walnut;
+
+bool CameraController::OnUpdate(Camera& camera, float ts)
+{
+	glm::vec2 mousePos = Input::GetMousePosition();
+	glm::vec2 delta = (mousePos - _lastMousePosition) * 0.002f;
+	_lastMousePosition = mousePos;
+
+	if (!Input::IsMouseButtonDown(MouseButton::Right))
+	{
+		Input::SetCursorMode(CursorMode::Normal);
+		return false;
+	}
+
+	Input::SetCursorMode(CursorMode::Locked);
+
+	bool moved = false;
+
+	glm::vec3 position = camera.GetPosition();
+	glm::vec3 forwardDirection = camera.GetDirection();
+
+	constexpr glm::vec3 upDirection(0.0f, 1.0f, 0.0f);
+	glm::vec3 rightDirection = glm::cross(forwardDirection, upDirection);
+
+	float speed = 5.0f;
+
+	// Movement
+	if (Input::IsKeyDown(KeyCode::W))
+	{
+		position += forwardDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::S))
+	{
+		position -= forwardDirection * speed * ts;
+		moved = true;
+	}
+	if (Input::IsKeyDown(KeyCode::A))
+	{
+		position -= rightDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::D))
+	{
+		position += rightDirection * speed * ts;
+		moved = true;
+	}
+	if (Input::IsKeyDown(KeyCode::Q))
+	{
+		position -= upDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::E))
+	{
+		position += upDirection * speed * ts;
+		moved = true;
+	}
+
+	// Rotation
+	if (delta.x != 0.0f || delta.y != 0.0f)
+	{
+		float pitchDelta = delta.y * GetRotationSpeed();
+		float yawDelta = delta.x * GetRotationSpeed();
+
+		glm::quat q = glm::normalize(glm::cross(glm::angleAxis(-pitchDelta, rightDirection),
+			glm::angleAxis(-yawDelta, glm::vec3(0.f, 1.0f, 0.0f))));
+		forwardDirection = glm::rotate(q, forwardDirection);
+
+		moved = true;
+	}
+
+	if (moved)
+	{
+		camera.SetView(position, forwardDirection);
+	}
+
+	return moved;
+}
+
+float CameraController::GetRotationSpeed()
+{
+	return 0.8f;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+class Camera;
+
+//Drives a Camera from Walnut mouse and keyboard input, kept out of Camera so the renderer can run headless
+class CameraController
+{
+public:
+	bool OnUpdate(Camera& camera, float ts);
+
+	float GetRotationSpeed();
+
+private:
+	glm::vec2 _lastMousePosition{ 0.0f };
+};
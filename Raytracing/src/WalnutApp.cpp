@@ -7,11 +7,13 @@
 
 #include "../Renderer.h"
 #include "../Camera.h"
+#include "../SceneSerializer.h"
+
+#include "CameraController.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <sstream>
-#include <fstream>
+#include <cfloat>
 
 using namespace Walnut;
 
@@ -19,12 +21,13 @@ class ExampleLayer : public Walnut::Layer
 {
 public:
 	ExampleLayer() : _camera(45.0f, 0.1f, 100.0f) {
-
-
+		_renderer.GetSettings().ProgressivePreview = true;
 	}
 
 	virtual void OnUpdate(float ts) override {
-		if (_camera.OnUpdate(ts)) {
+		//With temporal reprojection the renderer notices the move itself and keeps what still applies, or falls back
+		//to the progressive preview when reprojecting would not fit the frame budget
+		if (_cameraController.OnUpdate(_camera, ts) && !_renderer.GetSettings().TemporalReprojection) {
 			_renderer.ResetFrameIndex();
 		}
 	}
@@ -38,13 +41,83 @@ public:
 			Render();
 		}
 
-		ImGui::Checkbox("Accumulate", &_renderer.GetSettings().Accumulate);
+		Renderer::Settings& settings = _renderer.GetSettings();
+		ImGui::Checkbox("Accumulate", &settings.Accumulate);
+		ImGui::Checkbox("Packet Tracing", &settings.PacketTracing);
+
+		int threadCount = (int)settings.ThreadCount;
+		if (ImGui::DragInt("Threads (0 = all)", &threadCount, 1.0f, 0, 256)) {
+			settings.ThreadCount = (uint32_t)threadCount;
+		}
+
+		int tileSize = (int)settings.TileSize;
+		if (ImGui::DragInt("Tile Size", &tileSize, 1.0f, 4, 256)) {
+			settings.TileSize = (uint32_t)tileSize;
+		}
+
+		static const char* tileOrders[] = { "Scanline", "Morton", "Center Out" };
+		int tileOrder = (int)settings.TileOrdering;
+		if (ImGui::Combo("Tile Order", &tileOrder, tileOrders, IM_ARRAYSIZE(tileOrders))) {
+			settings.TileOrdering = (Renderer::TileOrder)tileOrder;
+		}
+
+		bool cacheRayDirections = _camera.GetRayDirectionMode() == Camera::RayDirectionMode::Cached;
+		if (ImGui::Checkbox("Cache Ray Directions", &cacheRayDirections)) {
+			_camera.SetRayDirectionMode(cacheRayDirections ? Camera::RayDirectionMode::Cached : Camera::RayDirectionMode::OnTheFly);
+		}
+
+		ImGui::Checkbox("Temporal Reprojection", &settings.TemporalReprojection);
+
+		ImGui::Checkbox("Progressive Preview", &settings.ProgressivePreview);
+		if (settings.ProgressivePreview) {
+			ImGui::DragFloat("Frame Budget (ms)", &settings.FrameBudgetMs, 1.0f, 1.0f, 1000.0f);
+		}
+
+		static const char* integrators[] = { "Megakernel", "Wavefront" };
+		int integrator = (int)settings.PathIntegrator;
+		if (ImGui::Combo("Integrator", &integrator, integrators, IM_ARRAYSIZE(integrators))) {
+			settings.PathIntegrator = (Renderer::Integrator)integrator;
+			_renderer.ResetFrameIndex();
+		}
+		if (settings.PathIntegrator == Renderer::Integrator::Wavefront) {
+			if (ImGui::Checkbox("Russian Roulette", &settings.RussianRoulette)) {
+				_renderer.ResetFrameIndex();
+			}
+		}
+
+		ImGui::Checkbox("Adaptive Sampling", &settings.AdaptiveSampling);
+		if (settings.AdaptiveSampling) {
+			ImGui::DragFloat("Noise Threshold", &settings.NoiseThreshold, 0.001f, 0.001f, 1.0f);
+
+			const Renderer::Stats& stats = _renderer.GetStats();
+			ImGui::Text("Converged tiles: %u/%u", stats.ConvergedTiles, stats.TileCount);
+		}
+
+		//Display conversion only, no reset needed
+		static const char* toneMappers[] = { "Clamp", "Reinhard", "ACES" };
+		int toneMapper = (int)settings.ToneMapping;
+		if (ImGui::Combo("Tone Mapping", &toneMapper, toneMappers, IM_ARRAYSIZE(toneMappers))) {
+			settings.ToneMapping = (ToneMapper)toneMapper;
+		}
+		ImGui::Checkbox("sRGB Output", &settings.SRGBEncode);
+
+		//Applied at resolve time to the whole accumulation, so it does not reset either
+		ImGui::Checkbox("Denoise", &settings.Denoise);
+		if (settings.Denoise) {
+			int iterations = (int)settings.DenoiseIterations;
+			if (ImGui::SliderInt("Denoise Iterations", &iterations, 1, 8)) {
+				settings.DenoiseIterations = (uint32_t)iterations;
+			}
+			ImGui::DragFloat("Luminance Sigma", &settings.DenoiseLuminanceSigma, 0.05f, 0.0f, 100.0f);
+			ImGui::DragFloat("Depth Sigma", &settings.DenoiseDepthSigma, 0.05f, 0.0f, 100.0f);
+		}
 
 		if (ImGui::Button("Reset")) {
 			_renderer.ResetFrameIndex();
 		}
 
-		ImGui::Text("Last render: %.3fms", _lastRenderTime);
+		ImGui::Text("Last render: %.3fms (resolve %.3fms, denoise %.3fms, reproject %.3fms)", _lastRenderTime,
+			_renderer.GetStats().ResolveMs, _renderer.GetStats().DenoiseMs, _renderer.GetStats().ReprojectMs);
 
 		ImGui::End();
 
@@ -60,8 +133,11 @@ public:
 			LoadScene(sceneName);
 		}
 
+		//Every edit below is marked on the scene and committed at the end of the panel, the renderer then restarts
+		//only the pixels the edits can affect
 		if (ImGui::Button("Add Sphere")) {
 			_scene.spheres.emplace_back();
+			_scene.MarkAllChanged();
 		}
 		ImGui::SameLine();
 		if (ImGui::Button("Add Material")) {
@@ -78,11 +154,15 @@ public:
 			ImGui::PushID(i);
 
 			Sphere& sphere = _scene.spheres[i];
-			ImGui::DragFloat3("Position", glm::value_ptr(sphere.pos), 0.1f);
-			ImGui::DragFloat("Radius", &sphere.radius, 0.1f);
-			ImGui::SliderInt("Material", &sphere.materialIndex, 0, (int)_scene.materials.size() - 1);
+			AABB previousBounds = sphere.GetBounds();
+			bool sphereChanged = ImGui::DragFloat3("Position", glm::value_ptr(sphere.pos), 0.1f);
+			sphereChanged |= ImGui::DragFloat("Radius", &sphere.radius, 0.1f);
+			sphereChanged |= ImGui::SliderInt("Material", &sphere.materialIndex, 0, (int)_scene.materials.size() - 1);
+			if (sphereChanged) {
+				_scene.MarkSphereChanged((uint32_t)i, previousBounds);
+			}
 			if (ImGui::Button("Delete Sphere")) {
-				indexToDelete = 0;
+				indexToDelete = i;
 			}
 			ImGui::Separator();
 
@@ -91,224 +171,290 @@ public:
 
 		if (indexToDelete != -1) {
 			_scene.spheres.erase(_scene.spheres.begin() + indexToDelete);
+			_scene.MarkAllChanged();
 			indexToDelete = -1;
 		}
 
-		ImGui::Text("Materials");
+		if (!_scene.groups.empty()) {
+			ImGui::Text("Instances");
 
-		for (size_t i = 0; i < _scene.materials.size(); i++) {
-			ImGui::PushID(i);
+			//Instance widgets share labels with the sphere widgets above
+			ImGui::PushID("Instances");
 
-			Material& mat = _scene.materials[i];
+			if (ImGui::Button("Add Instance")) {
+				_scene.instances.emplace_back();
+				_scene.MarkAllChanged();
+			}
 
-			ImGui::ColorEdit3("Albedo", glm::value_ptr(mat.albedo), 0.1f);
-			ImGui::DragFloat("Roughness", &mat.roughness, 0.01f, 0.0f, 1.0f);
-			ImGui::DragFloat("Metallic", &mat.metallic, 0.01f, 0.0f, 1.0f);
+			bool instancesMoved = false;
+			for (size_t i = 0; i < _scene.instances.size(); i++) {
+				ImGui::PushID(i);
 
-			if (ImGui::Button("Delete Material")) {
-				indexToDelete = i;
+				Instance& instance = _scene.instances[i];
+				int groupIndex = (int)instance.groupIndex;
+				if (ImGui::SliderInt("Group", &groupIndex, 0, (int)_scene.groups.size() - 1)) {
+					instance.groupIndex = (uint32_t)groupIndex;
+					instancesMoved = true;
+				}
+				ImGui::Text("%s", _scene.groups[instance.groupIndex].name.c_str());
+				instancesMoved |= ImGui::DragFloat3("Position", glm::value_ptr(instance.position), 0.1f);
+				instancesMoved |= ImGui::DragFloat3("Rotation", glm::value_ptr(instance.rotation), 1.0f);
+				instancesMoved |= ImGui::DragFloat3("Scale", glm::value_ptr(instance.scale), 0.01f);
+				if (ImGui::Button("Delete Instance")) {
+					indexToDelete = i;
+				}
+				ImGui::Separator();
+
+				ImGui::PopID();
 			}
 
-			ImGui::Separator();
+			if (indexToDelete != -1) {
+				_scene.instances.erase(_scene.instances.begin() + indexToDelete);
+				indexToDelete = -1;
+				instancesMoved = true;
+			}
+
+			if (instancesMoved) {
+				_scene.MarkAllChanged();
+			}
 
 			ImGui::PopID();
 		}
 
-		if (indexToDelete != -1) {
-			_scene.materials.erase(_scene.materials.begin() + indexToDelete);
-		}
+		ImGui::Text("Planes");
 
+		ImGui::PushID("Planes");
 
+		//Planes, boxes and meshes are not tracked individually, any edit restarts the whole image
+		bool shapesChanged = false;
 
-		ImGui::End();
+		if (ImGui::Button("Add Plane")) {
+			_scene.planes.emplace_back();
+			shapesChanged = true;
+		}
 
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
-		ImGui::Begin("Viewport");
+		for (size_t i = 0; i < _scene.planes.size(); i++) {
+			ImGui::PushID(i);
 
-		_viewportWidth = ImGui::GetContentRegionAvail().x;
-		_viewportHeight = ImGui::GetContentRegionAvail().y;
+			Plane& plane = _scene.planes[i];
+			shapesChanged |= ImGui::DragFloat3("Normal", glm::value_ptr(plane.normal), 0.01f);
+			shapesChanged |= ImGui::DragFloat("Offset", &plane.offset, 0.1f);
+			shapesChanged |= ImGui::SliderInt("Material", &plane.materialIndex, 0, (int)_scene.materials.size() - 1);
+			if (ImGui::Button("Delete Plane")) {
+				indexToDelete = i;
+			}
+			ImGui::Separator();
 
-		auto image = _renderer.GetFinalImage();
-		if (image) {
-			ImGui::Image(image->GetDescriptorSet(), { (float)image->GetWidth(), (float)image->GetHeight() },
-				ImVec2(0, 1), ImVec2(1, 0));
+			ImGui::PopID();
 		}
 
-		ImGui::End();
-		ImGui::PopStyleVar();
+		if (indexToDelete != -1) {
+			_scene.planes.erase(_scene.planes.begin() + indexToDelete);
+			indexToDelete = -1;
+			shapesChanged = true;
+		}
 
+		ImGui::PopID();
 
-		Render();
-	}
+		ImGui::Text("Boxes");
 
-	void Render() {
-		Timer timer;
+		ImGui::PushID("Boxes");
 
-		_camera.OnResize(_viewportWidth, _viewportHeight);
-		_renderer.OnResize(_viewportWidth, _viewportHeight);
-		_renderer.Render(_scene, _camera);
+		if (ImGui::Button("Add Box")) {
+			_scene.boxes.emplace_back();
+			shapesChanged = true;
+		}
 
-		_lastRenderTime = timer.ElapsedMillis();
-	}
+		for (size_t i = 0; i < _scene.boxes.size(); i++) {
+			ImGui::PushID(i);
+
+			Box& box = _scene.boxes[i];
+			shapesChanged |= ImGui::DragFloat3("Min", glm::value_ptr(box.min), 0.1f);
+			shapesChanged |= ImGui::DragFloat3("Max", glm::value_ptr(box.max), 0.1f);
+			shapesChanged |= ImGui::SliderInt("Material", &box.materialIndex, 0, (int)_scene.materials.size() - 1);
+			if (ImGui::Button("Delete Box")) {
+				indexToDelete = i;
+			}
+			ImGui::Separator();
 
-	void SaveScene(char* sceneName) {
+			ImGui::PopID();
+		}
+
+		if (indexToDelete != -1) {
+			_scene.boxes.erase(_scene.boxes.begin() + indexToDelete);
+			indexToDelete = -1;
+			shapesChanged = true;
+		}
 
-		std::stringstream ss;
+		ImGui::PopID();
 
-		ss << "Scene (\n";
-		ss << "\tscenename: " << sceneName << "\n";
-		ss << ")\n";
+		ImGui::Text("Meshes");
 
-		for (size_t i = 0; i < _scene.spheres.size(); i++) {
-			const Sphere& sphere = _scene.spheres[i];
+		ImGui::PushID("Meshes");
 
-			ss << "sphere (\n";
-			ss << "\tposition: " << sphere.pos.x << ", " << sphere.pos.y << ", " << sphere.pos.z << "\n";
-			ss << "\tradius: " << sphere.radius << "\n";
-			ss << "\tmaterialIndex: " << sphere.materialIndex << "\n";
-			ss << ")\n";
+		static char meshPath[256] = "";
+		ImGui::InputText("OBJ Path", meshPath, IM_ARRAYSIZE(meshPath));
+		if (ImGui::Button("Load Mesh")) {
+			LoadMesh(meshPath);
+		}
+		if (!_meshError.empty()) {
+			ImGui::TextWrapped("%s", _meshError.c_str());
 		}
 
-		for (size_t i = 0; i < _scene.materials.size(); i++) {
-			const Material& mat = _scene.materials[i];
+		for (size_t i = 0; i < _scene.meshes.size(); i++) {
+			ImGui::PushID(i);
 
-			ss << "material (\n";
-			ss << "\talbedo: " << mat.albedo.x << ", " << mat.albedo.y << ", " << mat.albedo.z << "\n";
-			ss << "\troughness: " << mat.roughness << "\n";
-			ss << "\tmetallic: " << mat.metallic << "\n";
-			ss << ")\n";
-		}
+			Mesh& mesh = _scene.meshes[i];
+			ImGui::Text("%s (%u triangles)", mesh.path.c_str(), mesh.GetTriangleCount());
+			shapesChanged |= ImGui::SliderInt("Material", &mesh.materialIndex, 0, (int)_scene.materials.size() - 1);
+			if (ImGui::Button("Delete Mesh")) {
+				indexToDelete = i;
+			}
+			ImGui::Separator();
 
-		std::string sn = "Scenes/" + std::string(sceneName) + ".scene";
-		
-		std::ofstream file(sn);
+			ImGui::PopID();
+		}
 
-		file.write(ss.str().c_str(), ss.str().length());
-		file.close();
+		if (indexToDelete != -1) {
+			_scene.meshes.erase(_scene.meshes.begin() + indexToDelete);
+			indexToDelete = -1;
+			shapesChanged = true;
+		}
 
-	}
+		if (shapesChanged) {
+			_scene.MarkAllChanged();
+		}
 
-	void LoadScene(const char* sceneName) {
-		std::string sn = "Scenes/" + std::string(sceneName) + ".scene";
+		ImGui::PopID();
 
-		std::ifstream inFile(sn);
+		ImGui::Text("Materials");
 
-		if (!inFile.good()) return;
+		for (size_t i = 0; i < _scene.materials.size(); i++) {
+			ImGui::PushID(i);
 
-		Scene ns;
+			Material& mat = _scene.materials[i];
 
-		std::string line;
-		while (getline(inFile, line)) {
-			if (line.find("scene (") != std::string::npos) {
-				std::vector<std::string> sceneAttributes = GetContentInNode(inFile, ")");
-				LoadSceneAttributes(ns, sceneAttributes);
-			}
-			else if (line.find("sphere (") != std::string::npos) {
-				std::vector<std::string> sphereAttributes = GetContentInNode(inFile, ")");
-				LoadSphereAttributes(ns, sphereAttributes);
+			bool materialChanged = ImGui::ColorEdit3("Albedo", glm::value_ptr(mat.albedo), 0.1f);
+			materialChanged |= ImGui::DragFloat("Roughness", &mat.roughness, 0.01f, 0.0f, 1.0f);
+			materialChanged |= ImGui::DragFloat("Metallic", &mat.metallic, 0.01f, 0.0f, 1.0f);
+			materialChanged |= ImGui::ColorEdit3("Emission Color", glm::value_ptr(mat.emissionColor));
+			materialChanged |= ImGui::DragFloat("Emission Power", &mat.emissionPower, 0.05f, 0.0f, FLT_MAX);
+			if (materialChanged) {
+				_scene.MarkMaterialChanged((uint32_t)i);
 			}
-			else if (line.find("material (") != std::string::npos) {
-				std::vector<std::string> materialAttributes = GetContentInNode(inFile, ")");
-				LoadMaterialAttributes(ns, materialAttributes);
+
+			//Something has to stay for the elements that used the last material
+			if (_scene.materials.size() > 1 && ImGui::Button("Delete Material")) {
+				indexToDelete = i;
 			}
-		}
 
-		_scene = ns;
-	}
+			ImGui::Separator();
 
-private:
-	void LoadSceneAttributes(Scene& scene, std::vector<std::string>& data) {
-		for (size_t i = 0; i < data.size(); ++i) {
-			const std::string& line = data[i];
+			ImGui::PopID();
+		}
 
-			if (line.find("scenename") != std::string::npos) {
-				scene.name = GetDataAfterColon(line);
-			}
+		if (indexToDelete != -1) {
+			DeleteMaterial((uint32_t)indexToDelete);
 		}
-	}
 
-	void LoadSphereAttributes(Scene& scene, std::vector<std::string>& data) {
-		Sphere ns;
+		_scene.CommitChanges();
 
-		for (size_t i = 0; i < data.size(); ++i) {
-			const std::string& line = data[i];
 
-			if (line.find("position") != std::string::npos) {
-				std::vector<std::string> posData = split(GetDataAfterColon(line), ',');
-				ns.pos = {
-					std::stof(posData[0]),
-					std::stof(posData[1]),
-					std::stof(posData[2])
-				};
-			}
-			else if (line.find("radius") != std::string::npos) {
-				ns.radius = std::stof(GetDataAfterColon(line));
-			}
-			else if (line.find("materialIndex") != std::string::npos) {
-				ns.materialIndex = std::stoi(GetDataAfterColon(line));
-			}
+
+		ImGui::End();
+
+		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
+		ImGui::Begin("Viewport");
+
+		_viewportWidth = ImGui::GetContentRegionAvail().x;
+		_viewportHeight = ImGui::GetContentRegionAvail().y;
+
+		auto image = _finalImage;
+		if (image) {
+			ImGui::Image(image->GetDescriptorSet(), { (float)image->GetWidth(), (float)image->GetHeight() },
+				ImVec2(0, 1), ImVec2(1, 0));
 		}
 
-		scene.spheres.emplace_back(ns);
+		ImGui::End();
+		ImGui::PopStyleVar();
+
+
+		Render();
 	}
 
-	void LoadMaterialAttributes(Scene& scene, std::vector<std::string>& data) {
-		Material mat;
+	void Render() {
+		Timer timer;
 
-		for (size_t i = 0; i < data.size(); ++i) {
-			const std::string& line = data[i];
+		_camera.OnResize(_viewportWidth, _viewportHeight);
+		_renderer.OnResize(_viewportWidth, _viewportHeight);
+		_renderer.Render(_scene, _camera);
 
-			if (line.find("albedo") != std::string::npos) {
-				std::vector<std::string> colData = split(GetDataAfterColon(line), ',');
-				mat.albedo = {
-					std::stof(colData[0]),
-					std::stof(colData[1]),
-					std::stof(colData[2])
-				};
-			}
-			else if (line.find("roughness") != std::string::npos) {
-				mat.roughness = std::stof(GetDataAfterColon(line));
-			}
-			else if (line.find("metallic") != std::string::npos) {
-				mat.metallic = std::stof(GetDataAfterColon(line));
-			}
+		if (!_finalImage) {
+			_finalImage = std::make_shared<Walnut::Image>(_viewportWidth, _viewportHeight, Walnut::ImageFormat::RGBA);
+		}
+		else if (_finalImage->GetWidth() != _viewportWidth || _finalImage->GetHeight() != _viewportHeight) {
+			_finalImage->Resize(_viewportWidth, _viewportHeight);
 		}
+		_finalImage->SetData(_renderer.GetImageData());
 
-		scene.materials.emplace_back(mat);
+		_lastRenderTime = timer.ElapsedMillis();
 	}
 
-	std::string GetDataAfterColon(const std::string& line) {
-		int locOfColon = line.find(":");
-		if (locOfColon == std::string::npos) return "";
-
-		std::string data = line.substr(locOfColon + 2);
-		return data;
+	//Names without an extension use the text format, "name.bscene" picks the binary one
+	static std::string GetScenePath(const std::string& sceneName) {
+		if (sceneName.find('.') != std::string::npos) return "Scenes/" + sceneName;
+		return "Scenes/" + sceneName + ".scene";
 	}
 
-	std::vector<std::string> GetContentInNode(std::ifstream& file, char* delim) {
-		std::string line;
-		std::vector<std::string> data;
-		do {
-			getline(file, line);
-			data.emplace_back(line);
-		} while (line.find(delim) == std::string::npos);
+	void SaveScene(const char* sceneName) {
+		_scene.name = sceneName;
 
-		return data;
+		SceneSerializer serializer(_scene);
+		serializer.Serialize(GetScenePath(sceneName));
 	}
 
-	std::vector<std::string> split(const std::string& s, char delim) {
-		std::vector<std::string> elems;
+	void LoadScene(const char* sceneName) {
+		SceneSerializer serializer(_scene);
+		if (serializer.Deserialize(GetScenePath(sceneName))) {
+			_scene.BuildAccelerationStructures();
+			_scene.MarkAllChanged();
+		}
+	}
 
-		//converts the passed in string to a stringstream. Needed for getline()
-		std::istringstream iss(s);
+	//Paths are relative to the scenes folder, the same way scene files refer to their meshes
+	void LoadMesh(const char* path) {
+		Mesh mesh;
+		if (!mesh.LoadOBJ("Scenes/" + std::string(path), _meshError)) return;
 
-		std::string item;
-		while (getline(iss, item, delim)) {
-			//Adds the item to the elements vector
-			elems.push_back(item);
+		mesh.path = path;
+		mesh.BuildAccelerationStructure();
+		_scene.meshes.push_back(std::move(mesh));
+		_scene.MarkAllChanged();
+		_meshError.clear();
+	}
+
+	//The renderer indexes materials unchecked, so elements using the deleted material fall back to material 0
+	//and the indices after it move down by one
+	void DeleteMaterial(uint32_t index) {
+		_scene.materials.erase(_scene.materials.begin() + index);
+
+		auto remap = [index](int& materialIndex) {
+			if (materialIndex == (int)index) materialIndex = 0;
+			else if (materialIndex > (int)index) materialIndex--;
+		};
+
+		for (Sphere& sphere : _scene.spheres) remap(sphere.materialIndex);
+		for (Plane& plane : _scene.planes) remap(plane.materialIndex);
+		for (Box& box : _scene.boxes) remap(box.materialIndex);
+		for (Mesh& mesh : _scene.meshes) remap(mesh.materialIndex);
+
+		//Groups keep packed copies of their spheres, which a refit does not update
+		for (SphereGroup& group : _scene.groups) {
+			for (Sphere& sphere : group.spheres) remap(sphere.materialIndex);
+			if (group.IsBuilt()) group.packedSpheres.Update(group.spheres);
 		}
 
-		return elems;
+		_scene.MarkAllChanged();
 	}
 
 private:
@@ -317,9 +463,14 @@ private:
 
 	Renderer _renderer;
 	Camera _camera;
+	CameraController _cameraController;
 	Scene _scene;
 
+	std::shared_ptr<Walnut::Image> _finalImage;
+
 	float _lastRenderTime = 0.0f;
+
+	std::string _meshError;
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
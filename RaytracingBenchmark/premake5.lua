@@ -0,0 +1,46 @@
+project "RaytracingBenchmark"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   -- Renderer core only, same as RaytracingHeadless
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+
+      "../Raytracing/*.h",
+      "../Raytracing/*.cpp",
+   }
+
+   includedirs
+   {
+      "../Walnut/vendor/glm",
+
+      "../Raytracing",
+   }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
@@ -0,0 +1,416 @@
+#include "Renderer.h"
+#include "Camera.h"
+#include "SceneSerializer.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Fixed-workload benchmark of the renderer hot paths. Every case pins scene, camera pose, resolution and seed,
+//so runs on the same machine are comparable across builds. Results are written as JSON.
+//Usage: RaytracingBenchmark [--scenes dir] [--frames N] [--output results.json] [--quick]
+
+struct BenchmarkCase {
+	std::string name;
+	std::string scene;
+	glm::vec3 position;
+	glm::vec3 direction;
+	uint32_t width, height;
+};
+
+struct BenchmarkResult {
+	double msPerFrame = 0.0; //median over the measured frames
+	double minMs = 0.0;
+	double maxMs = 0.0;
+	double raysPerSecond = 0.0;
+	uint64_t rays = 0;
+};
+
+struct SceneLoadResult {
+	double ms = 0.0; //best of Utils::SceneLoadRuns
+	double gigabytesPerSecond = 0.0;
+	uint64_t bytes = 0;
+	size_t spheres = 0;
+};
+
+namespace Utils {
+	static constexpr uint32_t Seed = 1337;
+	static constexpr uint32_t WarmupFrames = 2;
+	static constexpr uint32_t SceneLoadRuns = 3;
+
+	//Deterministic large scene for acceleration-structure scaling, independent of files on disk
+	static Scene GenerateSphereField(uint32_t count) {
+		Scene scene;
+		scene.name = "SphereField";
+
+		Random random(Seed);
+		for (uint32_t i = 0; i < 4; i++) {
+			Material& mat = scene.materials.emplace_back();
+			mat.albedo = random.Vec3(0.2f, 1.0f);
+			mat.roughness = random.Float();
+		}
+
+		Sphere& ground = scene.spheres.emplace_back();
+		ground.pos = glm::vec3(0.0f, -1001.0f, 0.0f);
+		ground.radius = 1000.0f;
+
+		for (uint32_t i = 0; i < count; i++) {
+			Sphere& sphere = scene.spheres.emplace_back();
+			sphere.pos = random.Vec3(-30.0f, 30.0f) * glm::vec3(1.0f, 0.2f, 1.0f) - glm::vec3(0.0f, 0.0f, 32.0f);
+			sphere.radius = 0.1f + random.Float() * 0.4f;
+			sphere.materialIndex = (int)(random.UInt() % 4);
+		}
+
+		return scene;
+	}
+
+	//Repeated clusters through instancing: groupSize unique spheres placed instanceCount times
+	static Scene GenerateInstancedField(uint32_t groupSize, uint32_t instanceCount) {
+		Scene scene = GenerateSphereField(0);
+		scene.name = "InstancedField";
+
+		Random random(Seed + 1);
+		SphereGroup& group = scene.groups.emplace_back();
+		group.name = "Cluster";
+		for (uint32_t i = 0; i < groupSize; i++) {
+			Sphere& sphere = group.spheres.emplace_back();
+			sphere.pos = random.Vec3(-1.0f, 1.0f) * glm::vec3(1.0f, 0.5f, 1.0f);
+			sphere.radius = 0.05f + random.Float() * 0.15f;
+			sphere.materialIndex = (int)(random.UInt() % 4);
+		}
+
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			Instance& instance = scene.instances.emplace_back();
+			instance.position = random.Vec3(-30.0f, 30.0f) * glm::vec3(1.0f, 0.0f, 1.0f) - glm::vec3(0.0f, 0.5f, 32.0f);
+			instance.rotation = glm::vec3(0.0f, random.Float() * 360.0f, 0.0f);
+			instance.scale = glm::vec3(0.5f + random.Float());
+		}
+
+		return scene;
+	}
+
+	static std::string Escape(const std::string& s) {
+		std::string out;
+		for (char c : s) {
+			if (c == '"' || c == '\\') out += '\\';
+			out += c;
+		}
+		return out;
+	}
+}
+
+class Benchmark
+{
+public:
+	Benchmark(const std::string& sceneDirectory, uint32_t frames)
+		: _sceneDirectory(sceneDirectory), _frames(frames)
+	{
+	}
+
+	bool LoadScene(const std::string& name, Scene& scene) {
+		if (name == "SphereField") {
+			scene = Utils::GenerateSphereField(20000);
+		}
+		else if (name == "InstancedField") {
+			scene = Utils::GenerateInstancedField(200, 2000);
+		}
+		else {
+			SceneSerializer serializer(scene);
+			if (!serializer.Deserialize(_sceneDirectory + "/" + name + ".scene")) {
+				std::cerr << "Failed to load scene " << name << " from " << _sceneDirectory << ": " << serializer.GetError() << "\n";
+				return false;
+			}
+		}
+
+		scene.BuildAccelerationStructures();
+		return true;
+	}
+
+	BenchmarkResult Run(const BenchmarkCase& bc, const Scene& scene, const Renderer::Settings& settings) {
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(bc.width, bc.height);
+		camera.SetView(bc.position, bc.direction);
+
+		Renderer renderer;
+		renderer.GetSettings() = settings;
+		renderer.GetSettings().Seed = Utils::Seed;
+		renderer.GetSettings().Accumulate = true;
+		renderer.OnResize(bc.width, bc.height);
+
+		for (uint32_t i = 0; i < Utils::WarmupFrames; i++) {
+			renderer.Render(scene, camera);
+		}
+		renderer.ResetFrameIndex();
+
+		std::vector<double> times;
+		BenchmarkResult result;
+		double totalMs = 0.0;
+
+		for (uint32_t i = 0; i < _frames; i++) {
+			auto start = std::chrono::steady_clock::now();
+			renderer.Render(scene, camera);
+			auto end = std::chrono::steady_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			times.push_back(ms);
+			totalMs += ms;
+			result.rays += renderer.GetStats().RayCount;
+		}
+
+		std::sort(times.begin(), times.end());
+		result.msPerFrame = times[times.size() / 2];
+		result.minMs = times.front();
+		result.maxMs = times.back();
+		result.raysPerSecond = totalMs > 0.0 ? result.rays / (totalMs / 1000.0) : 0.0;
+
+		return result;
+	}
+
+	//Best of a few loads of the same file, the first one also warms the page cache
+	SceneLoadResult MeasureSceneLoad(const std::string& filepath) {
+		SceneLoadResult result;
+		result.bytes = (uint64_t)std::filesystem::file_size(filepath);
+
+		for (uint32_t i = 0; i < Utils::SceneLoadRuns; i++) {
+			Scene scene;
+			SceneSerializer serializer(scene);
+
+			auto start = std::chrono::steady_clock::now();
+			if (!serializer.Deserialize(filepath)) {
+				std::cerr << "Failed to load scene " << filepath << ": " << serializer.GetError() << "\n";
+				return SceneLoadResult();
+			}
+			auto end = std::chrono::steady_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || ms < result.ms) result.ms = ms;
+			result.spheres = scene.spheres.size();
+		}
+
+		result.gigabytesPerSecond = result.ms > 0.0 ? result.bytes / (result.ms * 1e6) : 0.0;
+		return result;
+	}
+
+	uint32_t GetFrames() const { return _frames; }
+
+private:
+	std::string _sceneDirectory;
+	uint32_t _frames;
+};
+
+static void PrintUsage() {
+	std::cout << "Usage: RaytracingBenchmark [--scenes dir] [--frames N] [--output results.json] [--quick]\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::string sceneDirectory = "Raytracing/Scenes";
+	std::string outputPath;
+	uint32_t frames = 8;
+	bool quick = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--quick") == 0) {
+			quick = true;
+			continue;
+		}
+
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!value) {
+			PrintUsage();
+			return 1;
+		}
+
+		if (strcmp(arg, "--scenes") == 0) sceneDirectory = value;
+		else if (strcmp(arg, "--output") == 0) outputPath = value;
+		else if (strcmp(arg, "--frames") == 0) frames = std::max(1ul, std::strtoul(value, nullptr, 10));
+		else {
+			PrintUsage();
+			return 1;
+		}
+
+		i++;
+	}
+
+	const glm::vec3 frontPosition(0.0f, 0.0f, 6.0f), frontDirection(0.0f, 0.0f, -1.0f);
+	const glm::vec3 topPosition(6.0f, 5.0f, 8.0f), topDirection(-0.55f, -0.45f, -0.7f);
+
+	std::vector<BenchmarkCase> cases = {
+		{ "HelloWorld_front_640x360", "HelloWorld", frontPosition, frontDirection, 640, 360 },
+		{ "NewScene_front_640x360", "NewScene", frontPosition, frontDirection, 640, 360 },
+		{ "NewScene_top_640x360", "NewScene", topPosition, topDirection, 640, 360 },
+		{ "SampleScene_front_640x360", "SampleScene", frontPosition, frontDirection, 640, 360 },
+		{ "SphereField_front_640x360", "SphereField", glm::vec3(0.0f, 3.0f, 4.0f), glm::vec3(0.0f, -0.15f, -1.0f), 640, 360 },
+		{ "InstancedField_front_640x360", "InstancedField", glm::vec3(0.0f, 3.0f, 4.0f), glm::vec3(0.0f, -0.15f, -1.0f), 640, 360 },
+	};
+
+	if (!quick) {
+		cases.push_back({ "NewScene_front_1920x1080", "NewScene", frontPosition, frontDirection, 1920, 1080 });
+		cases.push_back({ "SphereField_front_1920x1080", "SphereField", glm::vec3(0.0f, 3.0f, 4.0f), glm::vec3(0.0f, -0.15f, -1.0f), 1920, 1080 });
+	}
+
+	Benchmark benchmark(sceneDirectory, quick ? std::min(frames, 4u) : frames);
+	uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::ostringstream json;
+	json << "{\n";
+	json << "  \"seed\": " << Utils::Seed << ",\n";
+	json << "  \"frames\": " << benchmark.GetFrames() << ",\n";
+	json << "  \"hardwareThreads\": " << hardwareThreads << ",\n";
+	json << "  \"sphereKernel\": \"" << SphereKernels::GetSelectedName() << "\",\n";
+
+	//Fixed cases at default settings
+	json << "  \"cases\": [\n";
+	for (size_t i = 0; i < cases.size(); i++) {
+		const BenchmarkCase& bc = cases[i];
+
+		Scene scene;
+		if (!benchmark.LoadScene(bc.scene, scene)) return 1;
+
+		BenchmarkResult result = benchmark.Run(bc, scene, Renderer::Settings());
+		std::cerr << bc.name << ": " << result.msPerFrame << "ms/frame, " << result.raysPerSecond / 1e6 << " Mrays/s\n";
+
+		json << "    { \"name\": \"" << Utils::Escape(bc.name) << "\", \"scene\": \"" << Utils::Escape(bc.scene) << "\""
+			<< ", \"width\": " << bc.width << ", \"height\": " << bc.height
+			<< ", \"msPerFrame\": " << result.msPerFrame << ", \"minMs\": " << result.minMs << ", \"maxMs\": " << result.maxMs
+			<< ", \"rays\": " << result.rays << ", \"raysPerSecond\": " << result.raysPerSecond << " }"
+			<< (i + 1 < cases.size() ? ",\n" : "\n");
+	}
+	json << "  ],\n";
+
+	//Cost of each extra bounce, from the difference between consecutive bounce limits
+	{
+		const BenchmarkCase& bc = cases[1];
+		Scene scene;
+		if (!benchmark.LoadScene(bc.scene, scene)) return 1;
+
+		json << "  \"bounces\": { \"case\": \"" << Utils::Escape(bc.name) << "\", \"results\": [\n";
+		double previousMs = 0.0;
+		for (uint32_t bounces = 1; bounces <= 5; bounces++) {
+			Renderer::Settings settings;
+			settings.Bounces = bounces;
+
+			BenchmarkResult result = benchmark.Run(bc, scene, settings);
+			json << "    { \"bounces\": " << bounces << ", \"msPerFrame\": " << result.msPerFrame
+				<< ", \"marginalMs\": " << (result.msPerFrame - previousMs) << ", \"rays\": " << result.rays
+				<< ", \"raysPerSecond\": " << result.raysPerSecond << " }" << (bounces < 5 ? ",\n" : "\n");
+			previousMs = result.msPerFrame;
+		}
+		json << "  ] },\n";
+	}
+
+	//Megakernel against the wavefront integrator, with the fixed bounce limit and with Russian roulette
+	json << "  \"integrators\": [\n";
+	const BenchmarkCase* integratorCases[] = { &cases[1], &cases[4] };
+	for (size_t c = 0; c < 2; c++) {
+		const BenchmarkCase& bc = *integratorCases[c];
+		Scene scene;
+		if (!benchmark.LoadScene(bc.scene, scene)) return 1;
+
+		const char* names[] = { "megakernel", "wavefront", "wavefrontRoulette" };
+		json << "    { \"case\": \"" << Utils::Escape(bc.name) << "\", \"results\": [\n";
+		for (int i = 0; i < 3; i++) {
+			Renderer::Settings settings;
+			settings.PathIntegrator = i == 0 ? Renderer::Integrator::Megakernel : Renderer::Integrator::Wavefront;
+			settings.RussianRoulette = i == 2;
+
+			BenchmarkResult result = benchmark.Run(bc, scene, settings);
+			std::cerr << bc.name << " (" << names[i] << "): " << result.msPerFrame << "ms/frame\n";
+
+			json << "      { \"integrator\": \"" << names[i] << "\", \"msPerFrame\": " << result.msPerFrame
+				<< ", \"rays\": " << result.rays << ", \"raysPerSecond\": " << result.raysPerSecond << " }"
+				<< (i + 1 < 3 ? ",\n" : "\n");
+		}
+		json << "    ] }" << (c + 1 < 2 ? ",\n" : "\n");
+	}
+	json << "  ],\n";
+
+	//Thread scaling, powers of two up to the hardware thread count
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t t = 1; t < hardwareThreads; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(hardwareThreads);
+
+	json << "  \"threadScaling\": [\n";
+	const BenchmarkCase* scalingCases[] = { &cases[1], &cases[4] };
+	for (size_t c = 0; c < 2; c++) {
+		const BenchmarkCase& bc = *scalingCases[c];
+		Scene scene;
+		if (!benchmark.LoadScene(bc.scene, scene)) return 1;
+
+		json << "    { \"case\": \"" << Utils::Escape(bc.name) << "\", \"results\": [\n";
+		double singleThreadMs = 0.0;
+		for (size_t i = 0; i < threadCounts.size(); i++) {
+			Renderer::Settings settings;
+			settings.ThreadCount = threadCounts[i];
+
+			BenchmarkResult result = benchmark.Run(bc, scene, settings);
+			if (i == 0) singleThreadMs = result.msPerFrame;
+
+			double speedup = result.msPerFrame > 0.0 ? singleThreadMs / result.msPerFrame : 0.0;
+			json << "      { \"threads\": " << threadCounts[i] << ", \"msPerFrame\": " << result.msPerFrame
+				<< ", \"speedup\": " << speedup << ", \"efficiency\": " << speedup / threadCounts[i] << " }"
+				<< (i + 1 < threadCounts.size() ? ",\n" : "\n");
+		}
+		json << "    ] }" << (c + 1 < 2 ? ",\n" : "\n");
+	}
+	json << "  ],\n";
+
+	//Scene load throughput of the text and binary formats on a generated field written to the temp directory
+	{
+		uint32_t sphereCount = quick ? 100000 : 1000000;
+		Scene scene = Utils::GenerateSphereField(sphereCount);
+
+		std::filesystem::path directory = std::filesystem::temp_directory_path();
+		const std::string paths[] = {
+			(directory / "RaytracingBenchmark.scene").string(),
+			(directory / "RaytracingBenchmark.bscene").string()
+		};
+
+		json << "  \"sceneLoad\": { \"spheres\": " << scene.spheres.size() << ", \"results\": [\n";
+		for (size_t i = 0; i < 2; i++) {
+			SceneSerializer serializer(scene);
+			if (!serializer.Serialize(paths[i])) {
+				std::cerr << "Failed to write " << paths[i] << ": " << serializer.GetError() << "\n";
+				return 1;
+			}
+
+			SceneLoadResult result = benchmark.MeasureSceneLoad(paths[i]);
+			std::remove(paths[i].c_str());
+			if (result.spheres != scene.spheres.size()) return 1;
+
+			const char* format = SceneSerializer::IsBinaryPath(paths[i]) ? "binary" : "text";
+			std::cerr << "Scene load (" << format << "): " << result.ms << "ms, " << result.gigabytesPerSecond << " GB/s\n";
+
+			json << "    { \"format\": \"" << format << "\", \"bytes\": " << result.bytes << ", \"ms\": " << result.ms
+				<< ", \"gigabytesPerSecond\": " << result.gigabytesPerSecond << " }" << (i + 1 < 2 ? ",\n" : "\n");
+		}
+		json << "  ] }\n";
+	}
+	json << "}\n";
+
+	if (outputPath.empty()) {
+		std::cout << json.str();
+	}
+	else {
+		std::ofstream file(outputPath);
+		file << json.str();
+		if (!file.good()) {
+			std::cerr << "Failed to write " << outputPath << "\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,540 @@
+#include "DistributedRender.h"
+
+#include "Camera.h"
+#include "SceneSerializer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#ifndef _WIN32
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <sys/socket.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
+namespace DistributedRender {
+	enum class MessageType : uint32_t {
+		Job = 1,	//Coordinator to worker: JobHeader followed by the .bscene buffer
+		Unit,		//Coordinator to worker: the Renderer::Tile to render
+		Result,		//Worker to coordinator: Renderer::ReadRegion of the unit
+		Done		//Coordinator to worker: no more units
+	};
+
+	struct MessageHeader {
+		uint32_t type;
+		//Unit index for Unit and Result messages
+		uint32_t unit;
+		uint64_t size;
+	};
+
+	//Everything besides the scene that decides what a pixel renders to
+	struct JobHeader {
+		uint32_t version;
+		uint32_t width, height, frames;
+		float position[3], direction[3];
+		float verticalFOV, nearClip, farClip;
+		float lightDirection[3], lightIrradiance[3];
+		uint32_t seed, bounces;
+		uint32_t integrator, russianRoulette, russianRouletteDepth;
+		uint32_t packetTracing, packetLayout, tileSize;
+	};
+
+	static constexpr uint32_t ProtocolVersion = 1;
+
+	//Units are squares of this many tiles a side, enough work to hide a round trip
+	static constexpr uint32_t UnitTiles = 4;
+	//Units a worker holds at once, so the next one is already there when it sends a result
+	static constexpr uint32_t UnitsPerWorker = 2;
+
+	static JobHeader MakeJobHeader(const Job& job, Renderer& renderer) {
+		const Renderer::Settings& settings = renderer.GetSettings();
+
+		JobHeader header = {};
+		header.version = ProtocolVersion;
+		header.width = job.Width;
+		header.height = job.Height;
+		header.frames = job.Frames;
+		for (int i = 0; i < 3; i++) {
+			header.position[i] = job.Position[i];
+			header.direction[i] = job.Direction[i];
+			header.lightDirection[i] = renderer.GetLightDir()[i];
+			header.lightIrradiance[i] = renderer.GetLightIrradiance()[i];
+		}
+		header.verticalFOV = job.VerticalFOV;
+		header.nearClip = job.NearClip;
+		header.farClip = job.FarClip;
+		header.seed = settings.Seed;
+		header.bounces = settings.Bounces;
+		header.integrator = (uint32_t)settings.PathIntegrator;
+		header.russianRoulette = settings.RussianRoulette ? 1 : 0;
+		header.russianRouletteDepth = settings.RussianRouletteDepth;
+		header.packetTracing = settings.PacketTracing ? 1 : 0;
+		header.packetLayout = (uint32_t)settings.PacketLayout;
+		header.tileSize = settings.TileSize;
+		return header;
+	}
+
+	static void ApplyJobHeader(const JobHeader& header, Renderer& renderer) {
+		Renderer::Settings& settings = renderer.GetSettings();
+
+		renderer.SetLightDir(glm::vec3(header.lightDirection[0], header.lightDirection[1], header.lightDirection[2]));
+		renderer.SetLightIrradiance(glm::vec3(header.lightIrradiance[0], header.lightIrradiance[1], header.lightIrradiance[2]));
+		settings.Seed = header.seed;
+		settings.Bounces = header.bounces;
+		settings.PathIntegrator = (Renderer::Integrator)header.integrator;
+		settings.RussianRoulette = header.russianRoulette != 0;
+		settings.RussianRouletteDepth = header.russianRouletteDepth;
+		settings.PacketTracing = header.packetTracing != 0;
+		settings.PacketLayout = (Renderer::PacketShape)header.packetLayout;
+		settings.TileSize = header.tileSize;
+
+		//Units are gathered as accumulation, the coordinator resolves the whole image once
+		settings.Resolve = false;
+		settings.AdaptiveSampling = false;
+		settings.ProgressivePreview = false;
+	}
+
+	//Every frame of one unit, the same on workers and in the coordinator's fallback
+	static void RenderUnit(Renderer& renderer, const Scene& scene, const Camera& camera, const Renderer::Tile& unit, uint32_t frames) {
+		renderer.GetSettings().Region = unit;
+		renderer.ResetFrameIndex();
+
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			renderer.Render(scene, camera);
+		}
+	}
+
+#ifndef _WIN32
+	static bool SendAll(int socket, const void* data, size_t size) {
+		const uint8_t* bytes = (const uint8_t*)data;
+		while (size > 0) {
+			//A worker that went away must not kill the coordinator with SIGPIPE
+			ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+			if (sent <= 0) return false;
+			bytes += sent;
+			size -= (size_t)sent;
+		}
+		return true;
+	}
+
+	static bool ReceiveAll(int socket, void* data, size_t size) {
+		uint8_t* bytes = (uint8_t*)data;
+		while (size > 0) {
+			ssize_t received = recv(socket, bytes, size, 0);
+			if (received <= 0) return false;
+			bytes += received;
+			size -= (size_t)received;
+		}
+		return true;
+	}
+
+	static bool SendMessage(int socket, MessageType type, uint32_t unit, const void* payload, size_t size) {
+		MessageHeader header = { (uint32_t)type, unit, size };
+		return SendAll(socket, &header, sizeof(header)) && SendAll(socket, payload, size);
+	}
+
+	//A worker as the coordinator sees it
+	struct Connection {
+		int socket = -1;
+		//Bytes received that do not make up a whole message yet
+		std::vector<uint8_t> received;
+		//Units sent and not returned yet, oldest first
+		std::vector<uint32_t> units;
+		//Last time a unit came back, or was handed to the worker while it had none
+		std::chrono::steady_clock::time_point lastProgress;
+	};
+
+	bool RunCoordinator(const Job& job, const CoordinatorOptions& options, Renderer& renderer)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		if (listener < 0) {
+			std::cerr << "Failed to create socket: " << strerror(errno) << "\n";
+			return false;
+		}
+
+		int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		//Connections are not authenticated, only --listen opens the port beyond this machine
+		address.sin_addr.s_addr = htonl(options.AcceptRemote ? INADDR_ANY : INADDR_LOOPBACK);
+		address.sin_port = htons(options.Port);
+
+		socklen_t addressLength = sizeof(address);
+		if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0
+			|| getsockname(listener, (sockaddr*)&address, &addressLength) != 0) {
+			std::cerr << "Failed to listen on port " << options.Port << ": " << strerror(errno) << "\n";
+			close(listener);
+			return false;
+		}
+
+		uint16_t port = ntohs(address.sin_port);
+		std::cout << "Coordinator listening on port " << port << "\n";
+
+		//Local workers split the hardware threads between them
+		std::vector<pid_t> children;
+		if (options.LocalWorkers > 0) {
+			uint32_t threads = std::max(1u, std::thread::hardware_concurrency() / options.LocalWorkers);
+			std::string target = "127.0.0.1:" + std::to_string(port);
+			std::string threadArgument = std::to_string(threads);
+
+			for (uint32_t i = 0; i < options.LocalWorkers; i++) {
+				pid_t pid = fork();
+				if (pid == 0) {
+					close(listener);
+					execl(options.Executable.c_str(), options.Executable.c_str(), "--worker", target.c_str(), "--threads", threadArgument.c_str(), (char*)nullptr);
+					_exit(127);
+				}
+
+				if (pid > 0) children.push_back(pid);
+				else std::cerr << "Failed to start local worker: " << strerror(errno) << "\n";
+			}
+		}
+
+		//The job message is the same for every worker
+		JobHeader jobHeader = MakeJobHeader(job, renderer);
+		std::vector<uint8_t> jobPayload(sizeof(JobHeader) + job.Scene.size());
+		memcpy(jobPayload.data(), &jobHeader, sizeof(JobHeader));
+		memcpy(jobPayload.data() + sizeof(JobHeader), job.Scene.data(), job.Scene.size());
+
+		//Units on the tile grid, so each worker renders exactly the tiles a single process would
+		uint32_t unitSize = std::max(1u, renderer.GetSettings().TileSize) * UnitTiles;
+		std::vector<Renderer::Tile> units;
+		for (uint32_t y = 0; y < job.Height; y += unitSize) {
+			for (uint32_t x = 0; x < job.Width; x += unitSize) {
+				units.push_back({ x, y, std::min(x + unitSize, job.Width), std::min(y + unitSize, job.Height) });
+			}
+		}
+
+		std::deque<uint32_t> pending;
+		for (uint32_t i = 0; i < (uint32_t)units.size(); i++) {
+			pending.push_back(i);
+		}
+
+		std::vector<uint8_t> done(units.size(), 0);
+		//Workers holding each unit, more than one once copies of slow units are handed out
+		std::vector<uint32_t> holders(units.size(), 0);
+		uint32_t remaining = (uint32_t)units.size();
+
+		std::vector<std::unique_ptr<Connection>> connections;
+		auto timeout = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(options.WorkerTimeout));
+		Clock::time_point lastConnected = Clock::now();
+
+		//Loaded on first use, for units the coordinator ends up rendering itself
+		std::unique_ptr<Scene> localScene;
+		std::unique_ptr<Camera> localCamera;
+
+		auto drop = [&](size_t index, const char* reason) {
+			Connection& connection = *connections[index];
+			std::cerr << "Dropping worker: " << reason << ", " << connection.units.size() << " units handed out again\n";
+
+			for (uint32_t unit : connection.units) {
+				holders[unit]--;
+				if (!done[unit] && holders[unit] == 0) pending.push_front(unit);
+			}
+
+			close(connection.socket);
+			connections.erase(connections.begin() + index);
+		};
+
+		while (remaining > 0) {
+			std::vector<pollfd> descriptors;
+			descriptors.push_back({ listener, POLLIN, 0 });
+			for (const auto& connection : connections) {
+				descriptors.push_back({ connection->socket, POLLIN, 0 });
+			}
+
+			poll(descriptors.data(), (nfds_t)descriptors.size(), 100);
+			Clock::time_point now = Clock::now();
+			size_t polled = connections.size();
+
+			if (descriptors[0].revents & POLLIN) {
+				int socket = accept(listener, nullptr, nullptr);
+				if (socket >= 0) {
+					int noDelay = 1;
+					setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+					if (SendMessage(socket, MessageType::Job, 0, jobPayload.data(), jobPayload.size())) {
+						auto connection = std::make_unique<Connection>();
+						connection->socket = socket;
+						connection->lastProgress = now;
+						connections.push_back(std::move(connection));
+					}
+					else {
+						close(socket);
+					}
+				}
+			}
+
+			//Results, walking backwards so dropped connections do not shift the ones still to visit
+			for (size_t i = polled; i-- > 0;) {
+				if (!(descriptors[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+				Connection& connection = *connections[i];
+
+				uint8_t buffer[1 << 16];
+				ssize_t received = recv(connection.socket, buffer, sizeof(buffer), 0);
+				if (received <= 0) {
+					drop(i, "connection closed");
+					continue;
+				}
+				connection.received.insert(connection.received.end(), buffer, buffer + received);
+
+				bool valid = true;
+				size_t consumed = 0;
+				while (connection.received.size() - consumed >= sizeof(MessageHeader)) {
+					MessageHeader header;
+					memcpy(&header, connection.received.data() + consumed, sizeof(header));
+
+					//Checked before waiting for the payload, so a bad header cannot make the buffer grow without bound
+					auto held = std::find(connection.units.begin(), connection.units.end(), header.unit);
+					if (header.type != (uint32_t)MessageType::Result || held == connection.units.end()
+						|| header.size != Renderer::GetRegionSize(units[header.unit])) {
+						valid = false;
+						break;
+					}
+
+					if (connection.received.size() - consumed - sizeof(header) < header.size) break;
+
+					const uint8_t* payload = connection.received.data() + consumed + sizeof(header);
+					consumed += sizeof(header) + header.size;
+
+					connection.units.erase(held);
+					holders[header.unit]--;
+					connection.lastProgress = now;
+
+					//The first copy of a unit to come back wins
+					if (!done[header.unit]) {
+						if (!renderer.WriteRegion(units[header.unit], payload, header.size)) {
+							valid = false;
+							break;
+						}
+
+						done[header.unit] = 1;
+						remaining--;
+					}
+				}
+				connection.received.erase(connection.received.begin(), connection.received.begin() + consumed);
+
+				if (!valid) drop(i, "unexpected message");
+			}
+
+			for (size_t i = connections.size(); i-- > 0;) {
+				if (!connections[i]->units.empty() && now - connections[i]->lastProgress > timeout) {
+					drop(i, "timed out");
+				}
+			}
+
+			//Fresh units first, then copies of the least shared units in flight for workers with nothing to do
+			for (size_t i = connections.size(); i-- > 0;) {
+				Connection& connection = *connections[i];
+
+				while (connection.units.size() < UnitsPerWorker) {
+					while (!pending.empty() && done[pending.front()]) pending.pop_front();
+
+					uint32_t unit = UINT32_MAX;
+					if (!pending.empty()) {
+						unit = pending.front();
+						pending.pop_front();
+					}
+					else if (connection.units.empty()) {
+						for (uint32_t candidate = 0; candidate < (uint32_t)units.size(); candidate++) {
+							if (!done[candidate] && holders[candidate] > 0 && (unit == UINT32_MAX || holders[candidate] < holders[unit])) unit = candidate;
+						}
+					}
+					if (unit == UINT32_MAX) break;
+
+					if (connection.units.empty()) connection.lastProgress = now;
+					connection.units.push_back(unit);
+					holders[unit]++;
+
+					if (!SendMessage(connection.socket, MessageType::Unit, unit, &units[unit], sizeof(Renderer::Tile))) {
+						drop(i, "send failed");
+						break;
+					}
+				}
+			}
+
+			if (!connections.empty()) {
+				lastConnected = now;
+				continue;
+			}
+
+			//Nobody to hand units to, render one here and look for workers again
+			if (now - lastConnected > timeout) {
+				while (!pending.empty() && done[pending.front()]) pending.pop_front();
+				if (pending.empty()) continue;
+
+				if (!localScene) {
+					std::cerr << "No workers connected, rendering the remaining units locally\n";
+
+					localScene = std::make_unique<Scene>();
+					SceneSerializer serializer(*localScene);
+					serializer.DeserializeBinary(job.Scene.data(), job.Scene.size());
+					localScene->BuildAccelerationStructures();
+
+					localCamera = std::make_unique<Camera>(job.VerticalFOV, job.NearClip, job.FarClip);
+					localCamera->OnResize(job.Width, job.Height);
+					localCamera->SetView(job.Position, job.Direction);
+				}
+
+				uint32_t unit = pending.front();
+				pending.pop_front();
+
+				Renderer::Settings settings = renderer.GetSettings();
+				RenderUnit(renderer, *localScene, *localCamera, units[unit], job.Frames);
+				renderer.GetSettings() = settings;
+
+				done[unit] = 1;
+				remaining--;
+			}
+		}
+
+		for (const auto& connection : connections) {
+			SendMessage(connection->socket, MessageType::Done, 0, nullptr, 0);
+			close(connection->socket);
+		}
+		close(listener);
+
+		//Local workers exit on Done, ones that hang or never connected are stopped
+		Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+		for (pid_t child : children) {
+			while (waitpid(child, nullptr, WNOHANG) == 0) {
+				if (Clock::now() > deadline) {
+					kill(child, SIGKILL);
+					waitpid(child, nullptr, 0);
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+
+		return true;
+	}
+
+	int RunWorker(const std::string& address, uint32_t threadCount)
+	{
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) {
+			std::cerr << "Expected host:port, got " << address << "\n";
+			return 1;
+		}
+		std::string host = address.substr(0, colon);
+		std::string port = address.substr(colon + 1);
+
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0 || !addresses) {
+			std::cerr << "Failed to resolve " << address << "\n";
+			return 1;
+		}
+
+		//The coordinator may still be starting up
+		int socket = -1;
+		for (uint32_t attempt = 0; attempt < 50 && socket < 0; attempt++) {
+			if (attempt > 0) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+			for (addrinfo* candidate = addresses; candidate && socket < 0; candidate = candidate->ai_next) {
+				socket = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+				if (socket >= 0 && connect(socket, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+					close(socket);
+					socket = -1;
+				}
+			}
+		}
+		freeaddrinfo(addresses);
+
+		if (socket < 0) {
+			std::cerr << "Failed to connect to " << address << "\n";
+			return 1;
+		}
+
+		int noDelay = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		MessageHeader header;
+		JobHeader job;
+		if (!ReceiveAll(socket, &header, sizeof(header)) || header.type != (uint32_t)MessageType::Job || header.size < sizeof(JobHeader)
+			|| !ReceiveAll(socket, &job, sizeof(job)) || job.version != ProtocolVersion) {
+			std::cerr << "Expected a job from " << address << "\n";
+			close(socket);
+			return 1;
+		}
+
+		std::vector<uint8_t> sceneData(header.size - sizeof(JobHeader));
+		Scene scene;
+		SceneSerializer serializer(scene);
+		if (!ReceiveAll(socket, sceneData.data(), sceneData.size()) || !serializer.DeserializeBinary(sceneData.data(), sceneData.size())) {
+			std::cerr << "Failed to receive the scene: " << serializer.GetError() << "\n";
+			close(socket);
+			return 1;
+		}
+		std::vector<uint8_t>().swap(sceneData);
+
+		scene.BuildAccelerationStructures();
+
+		Camera camera(job.verticalFOV, job.nearClip, job.farClip);
+		camera.OnResize(job.width, job.height);
+		camera.SetView(glm::vec3(job.position[0], job.position[1], job.position[2]), glm::vec3(job.direction[0], job.direction[1], job.direction[2]));
+
+		Renderer renderer;
+		ApplyJobHeader(job, renderer);
+		renderer.GetSettings().ThreadCount = threadCount;
+		renderer.OnResize(job.width, job.height);
+
+		uint32_t unitCount = 0;
+		std::vector<uint8_t> result;
+
+		while (ReceiveAll(socket, &header, sizeof(header))) {
+			if (header.type == (uint32_t)MessageType::Done) break;
+
+			Renderer::Tile unit;
+			if (header.type != (uint32_t)MessageType::Unit || header.size != sizeof(unit) || !ReceiveAll(socket, &unit, sizeof(unit))
+				|| unit.maxX > job.width || unit.maxY > job.height || unit.minX >= unit.maxX || unit.minY >= unit.maxY) {
+				std::cerr << "Unexpected message from the coordinator\n";
+				close(socket);
+				return 1;
+			}
+
+			RenderUnit(renderer, scene, camera, unit, job.frames);
+			renderer.ReadRegion(unit, result);
+
+			if (!SendMessage(socket, MessageType::Result, header.unit, result.data(), result.size())) break;
+			unitCount++;
+		}
+
+		close(socket);
+		std::cout << "Worker rendered " << unitCount << " units\n";
+		return 0;
+	}
+#else
+	bool RunCoordinator(const Job& job, const CoordinatorOptions& options, Renderer& renderer)
+	{
+		std::cerr << "Distributed rendering needs POSIX sockets and is not available on this platform\n";
+		return false;
+	}
+
+	int RunWorker(const std::string& address, uint32_t threadCount)
+	{
+		std::cerr << "Distributed rendering needs POSIX sockets and is not available on this platform\n";
+		return 1;
+	}
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Splits a headless render between worker processes over TCP. The coordinator ships the scene once as a .bscene
+//buffer, then hands out units of whole tiles; every worker renders all frames of its unit with Settings::Region
+//and sends back the unit's accumulation, so the gathered image matches a single process render bit for bit.
+//Units held by workers that disconnect or stop answering are handed to others, and once nothing is left to hand
+//out, idle workers take copies of units still in flight so one slow worker cannot hold up the frame.
+//Messages are sent in host byte order, every process must run on the same architecture.
+namespace DistributedRender {
+	struct Job {
+		uint32_t Width = 0, Height = 0;
+		uint32_t Frames = 0;
+		glm::vec3 Position = glm::vec3(0.0f);
+		glm::vec3 Direction = glm::vec3(0.0f, 0.0f, -1.0f);
+		float VerticalFOV = 45.0f, NearClip = 0.1f, FarClip = 100.0f;
+		std::vector<uint8_t> Scene;
+	};
+
+	struct CoordinatorOptions {
+		//Listening port, 0 picks a free one
+		uint16_t Port = 0;
+		//Accept workers from other machines, otherwise only local ones can connect
+		bool AcceptRemote = false;
+		//Workers started on this machine, each with its share of the hardware threads
+		uint32_t LocalWorkers = 0;
+		std::string Executable;
+		//A worker that has not returned a unit for this long is dropped and its units handed out again
+		float WorkerTimeout = 60.0f;
+	};
+
+	//Renders job with the settings of renderer into renderer's accumulation, ready for ResolveImage.
+	//Units are rendered locally when no worker is connected for WorkerTimeout seconds.
+	bool RunCoordinator(const Job& job, const CoordinatorOptions& options, Renderer& renderer);
+
+	//Connects to a coordinator at host:port and renders units until it is told to stop
+	int RunWorker(const std::string& address, uint32_t threadCount);
+}
@@ -0,0 +1,453 @@
+#include "Renderer.h"
+#include "Camera.h"
+#include "SceneSerializer.h"
+#include "BackgroundWriter.h"
+#include "ImageEncoding.h"
+#include "MappedFile.h"
+
+#include "DistributedRender.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Offline render of a .scene or .bscene file with no window or GPU, for CPU-only render nodes
+//Usage: RaytracingHeadless <scene> [--frames N] [--width W] [--height H] [--output file.ppm|file.exr|file.pfm]
+//                          [--position x,y,z] [--direction x,y,z] [--threads N] [--tile-size N] [--seed N]
+//                          [--noise-threshold T] [--tonemap clamp|reinhard|aces] [--linear]
+//                          [--integrator megakernel|wavefront] [--bounces N] [--no-roulette]
+//                          [--denoise] [--aovs prefix]   writes prefix_albedo.ppm, prefix_normal.ppm and prefix_depth.ppm
+//                          [--exr-type half|float]
+//                          [--checkpoint file] [--checkpoint-interval seconds] [--resume]
+//                          [--workers N] [--listen port] [--worker-timeout seconds]
+//       RaytracingHeadless <scene> --convert <output>   converts between the text and binary formats
+//       RaytracingHeadless --worker host:port [--threads N]   renders tiles for a coordinator
+//       RaytracingHeadless --help
+//
+//--workers starts N worker processes on this machine and --listen accepts workers from others, either one makes
+//this process the coordinator of a distributed render (see DistributedRender.h)
+//
+//.exr and .pfm outputs hold the linear mean of each pixel's samples, with no tone mapping, and the EXR also a
+//"samples" channel with every pixel's sample count. --checkpoint saves the render state (see Renderer::SaveState)
+//every --checkpoint-interval seconds and once the last frame is done. With --resume a render continues from its
+//checkpoint when there is one, to the same image the uninterrupted render would have made, and a finished render
+//can be taken further by resuming it with more --frames. Resuming takes the same scene, size, camera and sampling
+//options as the render that saved the checkpoint, anything else is refused. Images and checkpoints are written on a background thread.
+
+namespace Utils {
+	static bool ParseVec3(const char* text, glm::vec3& out) {
+		return std::sscanf(text, "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+	}
+
+	static bool ParseToneMapper(const char* text, ToneMapper& out) {
+		if (strcmp(text, "clamp") == 0) out = ToneMapper::Clamp;
+		else if (strcmp(text, "reinhard") == 0) out = ToneMapper::Reinhard;
+		else if (strcmp(text, "aces") == 0) out = ToneMapper::ACES;
+		else return false;
+		return true;
+	}
+
+	static bool ParseIntegrator(const char* text, Renderer::Integrator& out) {
+		if (strcmp(text, "megakernel") == 0) out = Renderer::Integrator::Megakernel;
+		else if (strcmp(text, "wavefront") == 0) out = Renderer::Integrator::Wavefront;
+		else return false;
+		return true;
+	}
+
+	static bool ParseEXRType(const char* text, ImageEncoding::EXRPixelType& out) {
+		if (strcmp(text, "half") == 0) out = ImageEncoding::EXRPixelType::Half;
+		else if (strcmp(text, "float") == 0) out = ImageEncoding::EXRPixelType::Float;
+		else return false;
+		return true;
+	}
+
+	//FNV-1a, enough to tell scenes apart in a checkpoint
+	static uint64_t HashBytes(const std::vector<uint8_t>& data) {
+		uint64_t hash = 14695981039346656037ull;
+		for (uint8_t byte : data) {
+			hash = (hash ^ byte) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static bool HasExtension(const std::string& filepath, const char* extension) {
+		size_t length = strlen(extension);
+		return filepath.size() >= length && filepath.compare(filepath.size() - length, length, extension) == 0;
+	}
+
+	//Queues an RGBA8 image, copied first since the encoding happens on the writer's thread
+	static void WritePPM(BackgroundWriter& writer, const std::string& filepath, const uint32_t* pixels, uint32_t width, uint32_t height) {
+		std::vector<uint32_t> image(pixels, pixels + (size_t)width * height);
+		writer.Write(filepath, [image = std::move(image), width, height]() {
+			std::vector<uint8_t> data;
+			ImageEncoding::EncodePPM(image.data(), width, height, data);
+			return data;
+		});
+	}
+
+	//Queues the mean of every pixel's samples as an EXR or PFM, chosen by the extension
+	static void WriteHDR(BackgroundWriter& writer, const std::string& filepath, const glm::vec4* sums, const uint32_t* counts,
+		uint32_t width, uint32_t height, ImageEncoding::EXRPixelType exrType) {
+		std::vector<glm::vec3> means((size_t)width * height);
+		for (size_t i = 0; i < means.size(); i++) {
+			means[i] = counts[i] ? glm::vec3(sums[i]) / (float)counts[i] : glm::vec3(0.0f);
+		}
+
+		std::vector<uint32_t> samples(counts, counts + means.size());
+		bool exr = HasExtension(filepath, ".exr");
+
+		writer.Write(filepath, [means = std::move(means), samples = std::move(samples), width, height, exrType, exr]() {
+			std::vector<uint8_t> data;
+			if (exr) ImageEncoding::EncodeEXR(means.data(), samples.data(), width, height, exrType, data);
+			else ImageEncoding::EncodePFM(means.data(), width, height, data);
+			return data;
+		});
+	}
+
+	static uint32_t PackRGB(const glm::vec3& color) {
+		glm::vec3 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+		return (uint32_t)c.r | ((uint32_t)c.g << 8) | ((uint32_t)c.b << 16) | 0xff000000;
+	}
+
+	//Averages of the renderer's feature buffers as images: albedo as is, normals mapped from [-1, 1] to [0, 1]
+	//and depth scaled so the farthest hit is white
+	static void WriteAOVs(BackgroundWriter& writer, const std::string& prefix, const Renderer& renderer) {
+		uint32_t width = renderer.GetWidth(), height = renderer.GetHeight();
+		const uint32_t* counts = renderer.GetSampleCountData();
+
+		float maxDepth = 0.0f;
+		for (uint32_t i = 0; i < width * height; i++) {
+			if (counts[i]) maxDepth = std::max(maxDepth, renderer.GetDepthData()[i] / counts[i]);
+		}
+
+		std::vector<uint32_t> albedo(width * height), normal(width * height), depth(width * height);
+		for (uint32_t i = 0; i < width * height; i++) {
+			float inverseCount = counts[i] ? 1.0f / counts[i] : 0.0f;
+			albedo[i] = PackRGB(renderer.GetAlbedoData()[i] * inverseCount);
+			normal[i] = PackRGB(renderer.GetNormalData()[i] * inverseCount * 0.5f + 0.5f);
+			depth[i] = PackRGB(glm::vec3(maxDepth > 0.0f ? renderer.GetDepthData()[i] * inverseCount / maxDepth : 0.0f));
+		}
+
+		WritePPM(writer, prefix + "_albedo.ppm", albedo.data(), width, height);
+		WritePPM(writer, prefix + "_normal.ppm", normal.data(), width, height);
+		WritePPM(writer, prefix + "_depth.ppm", depth.data(), width, height);
+	}
+}
+
+static void PrintUsage() {
+	std::cout << "Usage: RaytracingHeadless <scene> [--frames N] [--width W] [--height H] [--output file.ppm|file.exr|file.pfm]\n"
+		<< "                          [--position x,y,z] [--direction x,y,z] [--threads N] [--tile-size N] [--seed N]\n"
+		<< "                          [--noise-threshold T] [--tonemap clamp|reinhard|aces] [--linear]\n"
+		<< "                          [--integrator megakernel|wavefront] [--bounces N] [--no-roulette]\n"
+		<< "                          [--denoise] [--aovs prefix] [--exr-type half|float]\n"
+		<< "                          [--checkpoint file] [--checkpoint-interval seconds] [--resume]\n"
+		<< "                          [--workers N] [--listen port] [--worker-timeout seconds]\n"
+		<< "       RaytracingHeadless <scene> --convert <output.scene|output.bscene>\n"
+		<< "       RaytracingHeadless --worker host:port [--threads N]\n"
+		<< "       RaytracingHeadless --help\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		PrintUsage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+		PrintUsage();
+		return 0;
+	}
+
+	//Workers get the scene and settings from their coordinator
+	if (strcmp(argv[1], "--worker") == 0) {
+		if (argc != 3 && !(argc == 5 && strcmp(argv[3], "--threads") == 0)) {
+			PrintUsage();
+			return 1;
+		}
+
+		return DistributedRender::RunWorker(argv[2], argc == 5 ? (uint32_t)std::strtoul(argv[4], nullptr, 10) : 0);
+	}
+
+	std::string scenePath = argv[1];
+	std::string outputPath = "render.ppm";
+	std::string convertPath;
+	std::string aovPrefix;
+	std::string checkpointPath;
+	float checkpointInterval = 60.0f;
+	bool resume = false;
+	ImageEncoding::EXRPixelType exrType = ImageEncoding::EXRPixelType::Half;
+	uint32_t frames = 16;
+	uint32_t width = 1280, height = 720;
+	glm::vec3 position(0.0f, 0.0f, 3.0f);
+	glm::vec3 direction(0.0f, 0.0f, -1.0f);
+
+	DistributedRender::CoordinatorOptions coordinator;
+	bool distributed = false;
+
+	Renderer renderer;
+	Renderer::Settings& settings = renderer.GetSettings();
+
+	for (int i = 2; i < argc; i++) {
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+			PrintUsage();
+			return 0;
+		}
+
+		//Writes the PPM without sRGB encoding
+		if (strcmp(arg, "--linear") == 0) {
+			settings.SRGBEncode = false;
+			continue;
+		}
+
+		//Wavefront paths stop at --bounces instead, like the megakernel
+		if (strcmp(arg, "--no-roulette") == 0) {
+			settings.RussianRoulette = false;
+			continue;
+		}
+
+		if (strcmp(arg, "--denoise") == 0) {
+			settings.Denoise = true;
+			continue;
+		}
+
+		if (strcmp(arg, "--resume") == 0) {
+			resume = true;
+			continue;
+		}
+
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (!value) {
+			std::cerr << "Missing value for " << arg << "\n";
+			return 1;
+		}
+
+		bool valid = true;
+		if (strcmp(arg, "--frames") == 0) frames = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--width") == 0) width = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--height") == 0) height = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--output") == 0) outputPath = value;
+		else if (strcmp(arg, "--convert") == 0) convertPath = value;
+		else if (strcmp(arg, "--aovs") == 0) aovPrefix = value;
+		else if (strcmp(arg, "--exr-type") == 0) valid = Utils::ParseEXRType(value, exrType);
+		else if (strcmp(arg, "--checkpoint") == 0) checkpointPath = value;
+		else if (strcmp(arg, "--checkpoint-interval") == 0) valid = (checkpointInterval = std::strtof(value, nullptr)) >= 0.0f;
+		else if (strcmp(arg, "--workers") == 0) {
+			coordinator.LocalWorkers = (uint32_t)std::strtoul(value, nullptr, 10);
+			distributed = true;
+		}
+		else if (strcmp(arg, "--listen") == 0) {
+			unsigned long port = std::strtoul(value, nullptr, 10);
+			valid = port <= 65535;
+			coordinator.Port = (uint16_t)port;
+			coordinator.AcceptRemote = true;
+			distributed = true;
+		}
+		else if (strcmp(arg, "--worker-timeout") == 0) valid = (coordinator.WorkerTimeout = std::strtof(value, nullptr)) > 0.0f;
+		else if (strcmp(arg, "--position") == 0) valid = Utils::ParseVec3(value, position);
+		else if (strcmp(arg, "--direction") == 0) valid = Utils::ParseVec3(value, direction);
+		else if (strcmp(arg, "--threads") == 0) settings.ThreadCount = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--noise-threshold") == 0) {
+			settings.AdaptiveSampling = true;
+			settings.NoiseThreshold = std::strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--tonemap") == 0) valid = Utils::ParseToneMapper(value, settings.ToneMapping);
+		else if (strcmp(arg, "--integrator") == 0) valid = Utils::ParseIntegrator(value, settings.PathIntegrator);
+		else if (strcmp(arg, "--bounces") == 0) settings.Bounces = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--seed") == 0) settings.Seed = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--tile-size") == 0) valid = (settings.TileSize = (uint32_t)std::strtoul(value, nullptr, 10)) > 0;
+		else {
+			std::cerr << "Unknown option " << arg << "\n";
+			PrintUsage();
+			return 1;
+		}
+
+		if (!valid || width == 0 || height == 0) {
+			std::cerr << "Invalid value for " << arg << ": " << value << "\n";
+			return 1;
+		}
+
+		i++;
+	}
+
+	//Tiles converge depending on how many others still need samples, which differs between processes
+	if (distributed && settings.AdaptiveSampling) {
+		std::cerr << "--noise-threshold cannot be combined with distributed rendering\n";
+		return 1;
+	}
+
+	//The coordinator only gathers finished units, it has no state to save between frames
+	if (distributed && !checkpointPath.empty()) {
+		std::cerr << "--checkpoint cannot be combined with distributed rendering\n";
+		return 1;
+	}
+
+	if (resume && checkpointPath.empty()) {
+		std::cerr << "--resume needs --checkpoint\n";
+		return 1;
+	}
+
+	Scene scene;
+	SceneSerializer serializer(scene);
+
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	if (!serializer.Deserialize(scenePath)) {
+		std::cerr << "Failed to load scene " << scenePath << ": " << serializer.GetError() << "\n";
+		return 1;
+	}
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+	double loadMs = std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+
+	uint32_t triangleCount = 0;
+	for (const Mesh& mesh : scene.meshes) {
+		triangleCount += mesh.GetTriangleCount();
+	}
+
+	std::cout << "Loaded " << scene.spheres.size() << " spheres, " << scene.groups.size() << " groups, "
+		<< scene.instances.size() << " instances, " << scene.planes.size() << " planes, " << scene.boxes.size() << " boxes and "
+		<< scene.meshes.size() << " meshes (" << triangleCount << " triangles) in " << loadMs << "ms\n";
+
+	if (!convertPath.empty()) {
+		if (!serializer.Serialize(convertPath)) {
+			std::cerr << "Failed to write scene " << convertPath << ": " << serializer.GetError() << "\n";
+			return 1;
+		}
+
+		std::cout << "Converted " << scene.spheres.size() << " spheres and " << scene.materials.size()
+			<< " materials to " << convertPath << "\n";
+		return 0;
+	}
+
+	renderer.OnResize(width, height);
+	renderer.ResetFrameIndex();
+
+	//Only the final image is written, so intermediate frames skip the display conversion
+	settings.Resolve = false;
+
+	BackgroundWriter writer;
+	uint32_t renderedFrames = frames;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (distributed) {
+		DistributedRender::Job job;
+		job.Width = width;
+		job.Height = height;
+		job.Frames = frames;
+		job.Position = position;
+		job.Direction = direction;
+		serializer.SerializeBinary(job.Scene);
+
+#ifdef __linux__
+		coordinator.Executable = "/proc/self/exe";
+#else
+		coordinator.Executable = argv[0];
+#endif
+
+		if (!DistributedRender::RunCoordinator(job, coordinator, renderer)) {
+			return 1;
+		}
+	}
+	else {
+		scene.BuildAccelerationStructures();
+
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(width, height);
+		camera.SetView(position, direction);
+
+		//The binary form holds every value the scene renders with, so its hash identifies the scene in checkpoints
+		uint64_t sceneHash = 0;
+		if (!checkpointPath.empty()) {
+			std::vector<uint8_t> sceneData;
+			serializer.SerializeBinary(sceneData);
+			sceneHash = Utils::HashBytes(sceneData);
+		}
+
+		//A missing checkpoint just means the render has not got that far yet
+		if (resume) {
+			MappedFile checkpoint;
+			if (checkpoint.Open(checkpointPath)) {
+				std::string error;
+				if (!renderer.LoadState(checkpoint.GetData(), checkpoint.GetSize(), scene, sceneHash, camera, error)) {
+					std::cerr << "Cannot resume from " << checkpointPath << ": " << error << "\n";
+					return 1;
+				}
+
+				std::cout << "Resumed from " << checkpointPath << " after " << renderer.GetFrameIndex() - 1 << " frames\n";
+			}
+		}
+
+		uint32_t firstFrame = std::min(renderer.GetFrameIndex() - 1, frames);
+		renderedFrames = frames - firstFrame;
+
+		//Saving the state is a copy of the buffers, the file is written while the next frames render. A checkpoint
+		//still being written when the next one is due delays that one instead of the render.
+		std::vector<uint8_t> state;
+		auto lastCheckpoint = std::chrono::steady_clock::now();
+
+		for (uint32_t frame = firstFrame; frame < frames; frame++) {
+			renderer.Render(scene, camera);
+
+			bool last = frame + 1 == frames;
+			bool due = std::chrono::duration<float>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= checkpointInterval;
+
+			if (!checkpointPath.empty() && (last || (due && writer.GetPendingCount() == 0))) {
+				renderer.SaveState(sceneHash, state);
+				writer.Write(checkpointPath, std::move(state));
+				lastCheckpoint = std::chrono::steady_clock::now();
+			}
+		}
+	}
+
+	renderer.ResolveImage();
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double totalMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+	std::cout << "Rendered " << renderedFrames << " frames at " << width << "x" << height
+		<< " in " << totalMs << "ms (" << totalMs / (renderedFrames ? renderedFrames : 1) << "ms/frame)\n";
+
+	if (settings.AdaptiveSampling) {
+		const Renderer::Stats& stats = renderer.GetStats();
+		std::cout << stats.ConvergedTiles << "/" << stats.TileCount << " tiles converged\n";
+	}
+
+	if (Utils::HasExtension(outputPath, ".exr") || Utils::HasExtension(outputPath, ".pfm")) {
+		const glm::vec4* sums = settings.Denoise ? renderer.GetDenoisedData() : renderer.GetAccumulationData();
+		Utils::WriteHDR(writer, outputPath, sums, renderer.GetSampleCountData(), width, height, exrType);
+	}
+	else {
+		Utils::WritePPM(writer, outputPath, renderer.GetImageData(), width, height);
+	}
+
+	if (settings.Denoise) {
+		std::cout << "Denoised in " << renderer.GetStats().DenoiseMs << "ms\n";
+	}
+
+	if (!aovPrefix.empty()) {
+		Utils::WriteAOVs(writer, aovPrefix, renderer);
+	}
+
+	if (!writer.Flush()) {
+		std::cerr << writer.GetError();
+		return 1;
+	}
+
+	std::cout << "Wrote " << outputPath << "\n";
+	if (!aovPrefix.empty()) {
+		std::cout << "Wrote " << aovPrefix << "_albedo.ppm, " << aovPrefix << "_normal.ppm and " << aovPrefix << "_depth.ppm\n";
+	}
+	if (!checkpointPath.empty()) {
+		std::cout << "Saved the render state to " << checkpointPath << "\n";
+	}
+
+	return 0;
+}
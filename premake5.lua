@@ -8,3 +8,5 @@ outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 include "Walnut/WalnutExternal.lua"
 
 include "Raytracing"
+include "RaytracingHeadless"
+include "RaytracingBenchmark"